@@ -2,6 +2,13 @@
 # Set to false to disable SSE/SSE2 support (experimental)
 SSE_SUPPORT=true
 
+# Bits per pixel requested to the bootloader (32, 24 or 16). Lower values use
+# less memory bandwidth, but the bootloader might not support them.
+FB_DEPTH=32
+
+# Set to false to map the memory with 4KiB pages instead of 4MiB pages (PSE)
+PAGING_PSE=true
+
 # Set to false to remove last commit from bootloader entry
 BOOTLOADER_GIT_HASH=true
 
@@ -21,8 +28,16 @@ ISO=$(KERNEL_BIN:.bin=.iso)
 KERNEL_OBJ_FILES=kernel.c.o \
                  vga.c.o \
                  paging.c.o \
+                 frame.c.o \
+                 memtype.c.o \
                  heap.c.o \
+                 slab.c.o \
                  multitask.c.o \
+                 wait.c.o \
+                 timer.c.o \
+                 clock.c.o \
+                 boot_trace.c.o \
+                 font.c.o \
                  framebuffer.c.o \
                  framebuffer_console.c.o \
                  idt.c.o \
@@ -47,6 +62,9 @@ APP_OBJ_FILES=sh/sh.c.o \
               5x5/5x5.c.o \
               mandelbrot/mandelbrot.c.o
 
+# From src/media/*, generated from the GIMP headers
+MEDIA_FB_FILES=logo_small_fb.h
+
 # From src/libk/*
 LIBK_OBJ_FILES=string.c.o \
                stdlib.c.o \
@@ -55,7 +73,8 @@ LIBK_OBJ_FILES=string.c.o \
                time.c.o \
                curses.c.o \
                math.c.o \
-               math.asm.o
+               math.asm.o \
+               string.asm.o
 
 # Paths for the sysroot
 SYSROOT=./sysroot
@@ -74,6 +93,7 @@ LIBK_INCLUDE_DIR=src/libk/include
 KERNEL_OBJS=$(addprefix obj/kernel/, $(KERNEL_OBJ_FILES))
 APP_OBJS=$(addprefix obj/apps/, $(APP_OBJ_FILES))
 LIBK_OBJS=$(addprefix obj/libk/, $(LIBK_OBJ_FILES))
+MEDIA_FB_HEADERS=$(addprefix src/media/, $(MEDIA_FB_FILES))
 
 SRC_HEADERS=$(wildcard $(KERNEL_INCLUDE_DIR)/*/*.h) $(wildcard $(LIBK_INCLUDE_DIR)/*.h)
 SYSROOT_HEADERS=$(patsubst $(LIBK_INCLUDE_DIR)/%, $(SYSROOT_INCLUDE_DIR)/%, \
@@ -89,3 +109,10 @@ ifeq ($(SSE_SUPPORT), true)
 CFLAGS += -msse -msse2 -DENABLE_SSE
 ASM_FLAGS += -D ENABLE_SSE
 endif
+
+ASM_FLAGS += -D FB_DEPTH=$(FB_DEPTH)
+
+ifeq ($(PAGING_PSE), true)
+CFLAGS += -DENABLE_PSE
+ASM_FLAGS += -D ENABLE_PSE
+endif
@@ -0,0 +1,78 @@
+#!/usr/bin/python3
+#
+# Convert an image exported by GIMP as a C header (see fb_drawimage) to an
+# FbImage with 32 bit 0xRRGGBB pixels, so the kernel can draw it with
+# fb_drawimage_fb() without decoding it. Used by the Makefile:
+#
+#   python3 scripts/gimp2fb.py src/media/logo.h > src/media/logo_fb.h
+
+import os, re, sys
+
+# Pixels per line of the generated array
+PIXELS_PER_LINE = 6
+
+def parse_gimp_header(path):
+    with open(path, "r") as file:
+        text = file.read()
+
+    name = re.search(r"GimpImage\s+(\w+)\s*=", text).group(1)
+    h = int(re.search(r"\.h\s*=\s*(\d+)", text).group(1))
+    w = int(re.search(r"\.w\s*=\s*(\d+)", text).group(1))
+
+    # Join the string literals after ".data", undoing the escapes. GIMP only
+    # uses chars from '!' to '`', so only '\\' and '\"' are escaped.
+    data_text = text[text.index(".data"):]
+    literals = re.findall(r'"((?:[^"\\]|\\.)*)"', data_text)
+    data = "".join(literals).replace('\\"', '"').replace("\\\\", "\\")
+
+    if len(data) != h * w * 4:
+        sys.exit("%s: Expected %d chars of data, got %d" %
+                 (path, h * w * 4, len(data)))
+
+    return name, h, w, data
+
+# Same as GIMP_GET_PIXEL and rgb2col in src/kernel/include/kernel/color.h
+def decode_pixels(data):
+    pixels = []
+
+    for i in range(0, len(data), 4):
+        d = [ord(c) - 33 for c in data[i:i + 4]]
+        r = ((d[0] << 2) | (d[1] >> 4)) & 0xFF
+        g = (((d[1] & 0xF) << 4) | (d[2] >> 2)) & 0xFF
+        b = (((d[2] & 0x3) << 6) | d[3]) & 0xFF
+        pixels.append((r << 16) | (g << 8) | b)
+
+    return pixels
+
+def main():
+    if len(sys.argv) != 2:
+        sys.exit("Usage: %s <gimp_header.h>" % sys.argv[0])
+
+    path = sys.argv[1]
+    name, h, w, data = parse_gimp_header(path)
+    pixels = decode_pixels(data)
+
+    base = os.path.basename(path)
+    guard = "MEDIA_%s_FB_H_" % os.path.splitext(base)[0].upper()
+
+    out = sys.stdout
+    out.write("/* Generated by scripts/gimp2fb.py from %s, don't edit */\n\n" %
+              base)
+    out.write("#ifndef %s\n#define %s 1\n\n" % (guard, guard))
+
+    out.write("static const uint32_t %s_fb_data[] = {\n" % name)
+    for i in range(0, len(pixels), PIXELS_PER_LINE):
+        line = ", ".join("0x%06X" % p for p in pixels[i:i + PIXELS_PER_LINE])
+        out.write("    %s,\n" % line)
+    out.write("};\n\n")
+
+    out.write("static const FbImage %s_fb = {\n" % name)
+    out.write("    .h    = %d,\n" % h)
+    out.write("    .w    = %d,\n" % w)
+    out.write("    .data = %s_fb_data,\n" % name)
+    out.write("};\n\n")
+
+    out.write("#endif /* %s */\n" % guard)
+
+if __name__ == "__main__":
+    main()
@@ -17,9 +17,11 @@
 #include <kernel/font.h>
 #include <kernel/keyboard.h>
 #include <kernel/framebuffer.h>
-
-/* If defined, the program will use an intermediate buffer to avoid tearing */
-#define DOUBLE_BUFFERING
+#include <kernel/framebuffer_console.h> /* fbc_flush */
+#include <kernel/multitask.h>
+#include <kernel/wait.h>
+#include <kernel/idt.h> /* irq_save, irq_restore */
+#include <kernel/clock.h>
 
 /* Keys */
 #define KEY_ZOOM_IN     '.'
@@ -58,8 +60,284 @@
 /* Color used to draw the X and Y axis, if enabled */
 #define AXIS_COL 0xDDDDDD
 
+/* Size in px of the square tiles rendered by each worker */
+#define TILE_SZ 64
+
+/*
+ * Number of worker tasks. With a single CPU they don't render faster than the
+ * main task alone, but they let it keep reading keys in the middle of a frame.
+ */
+#define WORKERS 4
+
+/* Colors of the text with the information of the last frame */
+#define OVERLAY_FG 0xFFFFFF
+#define OVERLAY_BG 0x000000
+
+/* Values that can be changed with the keys */
+typedef struct {
+    double zoom;
+    double x_offset;
+    double y_offset;
+    uint32_t max_iter;
+    bool draw_axis;
+} mandel_view;
+
+/* Frame shared by the main task and the workers */
+typedef struct {
+    uint32_t* pixels;      /* Shadow framebuffer, see fb_begin_frame() */
+    uint32_t w, h;         /* Size in px of the frame */
+    double factor_x;       /* Real units per px */
+    double factor_y;       /* Real units per px */
+    uint32_t tiles_x;      /* Tiles in each row */
+    uint32_t tiles;        /* Total number of tiles */
+    mandel_view view;      /* View of the current frame */
+    volatile uint32_t gen; /* Incremented on each frame, cancels the old one */
+    uint32_t next_tile;    /* Next tile that a worker should take */
+    uint32_t done;         /* Tiles of the current frame already rendered */
+    uint64_t start_ns;     /* When the current frame started, see clock_ns() */
+    uint32_t workers;      /* Workers that took a buffer from tile_bufs */
+    uint32_t alive;        /* Workers that didn't return yet */
+    bool quit;             /* Tell the workers to return */
+} mandel_frame;
+
+/*
+ * Everything except the pixels is protected by disabling interrupts, since we
+ * only have one CPU. With SMP, it would need a spinlock.
+ */
+static mandel_frame frame;
+
+/*
+ * Each worker renders its tiles here, and copies them to the frame only if it
+ * wasn't cancelled. Otherwise, a worker preempted in the middle of a tile could
+ * write pixels of the old view over the new frame. Too big for the stack of the
+ * tasks (MT_STACK_SZ).
+ */
+static uint32_t tile_bufs[WORKERS][TILE_SZ * TILE_SZ];
+
+/* Workers waiting for a new frame */
+static wait_queue work_wq = WAIT_QUEUE_INIT;
+
+/* Main task waiting for the workers to return */
+static wait_queue exit_wq = WAIT_QUEUE_INIT;
+
 static uint32_t hue2rgb(float h);
 
+/* Get the position and size in px of a tile, clipped to the frame */
+static void get_tile_rect(uint32_t tile, uint32_t* y, uint32_t* x, uint32_t* h,
+                          uint32_t* w) {
+    *y = (tile / frame.tiles_x) * TILE_SZ;
+    *x = (tile % frame.tiles_x) * TILE_SZ;
+    *h = (*y + TILE_SZ < frame.h) ? TILE_SZ : frame.h - *y;
+    *w = (*x + TILE_SZ < frame.w) ? TILE_SZ : frame.w - *x;
+}
+
+/*
+ * Draw the mandelbrot of a tile of frame `gen` in `buf`, with TILE_SZ px per
+ * row. Stops early if the frame is cancelled.
+ */
+static void render_tile(const mandel_view* view, uint32_t tile, uint32_t gen,
+                        uint32_t* buf) {
+    /* Same as in main_mandelbrot() */
+    const double min_real_x = -2.0;
+    const double min_real_y = -1.0;
+
+    uint32_t y0, x0, h, w;
+    get_tile_rect(tile, &y0, &x0, &h, &w);
+
+    for (uint32_t y_px = y0; y_px < y0 + h; y_px++) {
+        /* Don't waste time on a frame that won't be presented */
+        if (frame.gen != gen)
+            return;
+
+        uint32_t* row = &buf[(y_px - y0) * TILE_SZ];
+
+        /* Real Y is the mandelbrot center vertically. We subtract 1.0 (half
+         * the height) to center it vertically. */
+        double real_y = min_real_y + y_px * frame.factor_y;
+
+        /* Unlike real_x, because real_y values are -1..+1 (min/max_real_y),
+         * we can just zoom at +0 (the center) */
+        real_y *= view->zoom;
+        real_y += view->y_offset;
+
+        for (uint32_t x_px = x0; x_px < x0 + w; x_px++) {
+            /* Real X is the mandelbrot center horizontally. We subtract 2.0
+             * (half the width) to center it horizontally. */
+            double real_x = min_real_x + x_px * frame.factor_x;
+
+            /* Because real_x values are -2..+1 (min/max_real_x), we zoom at
+             * -0.5 (the center) and then we restore. */
+            real_x += 0.5;
+            real_x *= view->zoom;
+            real_x -= 0.5;
+            real_x += view->x_offset;
+
+            /* These 2 values will be increased each iteration below */
+            double x = real_x;
+            double y = real_y;
+
+            /* Overwritten below if we are outside the set */
+            row[x_px - x0] = INSIDE_COL;
+
+            /* In each iteration, we will check if we are inside the
+             * mandebrot set. An interesting property of the mandelbrot set
+             * is that the more iterations an outside value takes, the
+             * closer to the set is. We can use this to change colors. */
+            for (uint32_t iter = 0; iter < view->max_iter; iter++) {
+                /* Calulate squares once */
+                double sqr_x = x * x;
+                double sqr_y = y * y;
+
+                /* Absolute value of a complex number is the distance from
+                 * origin: sqrt(x^2 + y^2) > 2 */
+                if (sqr_x + sqr_y > 2 * 2) {
+                    /* Scale 0..360 HUE based on iter..max_iter ratio */
+                    int scaled_hue = iter * MAX_H / view->max_iter;
+                    row[x_px - x0] = hue2rgb(scaled_hue);
+                    break;
+                }
+
+                /* This part is explained in the povusers link on credits */
+                y = (2.0 * x * y) + real_y;
+                x = (sqr_x - sqr_y) + real_x;
+            }
+        }
+    }
+}
+
+/* Copy a tile rendered by render_tile() to the shadow framebuffer */
+static void copy_tile(uint32_t tile, const uint32_t* buf) {
+    uint32_t y0, x0, h, w;
+    get_tile_rect(tile, &y0, &x0, &h, &w);
+
+    for (uint32_t y = 0; y < h; y++)
+        memcpy(&frame.pixels[(y0 + y) * frame.w + x0], &buf[y * TILE_SZ],
+               w * sizeof(uint32_t));
+}
+
+/* Append the decimal `num` and then `suffix` to `str` */
+static void append_num(char* str, int64_t num, const char* suffix) {
+    str += strlen(str);
+    itoa(str, num);
+    strcat(str, suffix);
+}
+
+/*
+ * Called by the worker that rendered the last tile of frame `gen`. Draws the
+ * axis, presents the frame and draws the overlay with its information.
+ */
+static void finish_frame(uint32_t gen) {
+    /* With a single CPU, the main task can't start another frame until we are
+     * done, so the gen check is still valid when presenting */
+    mt_preempt_disable();
+
+    if (frame.gen != gen) {
+        mt_preempt_enable();
+        return;
+    }
+
+    const uint64_t ns = clock_ns() - frame.start_ns;
+
+    if (frame.view.draw_axis) {
+        const uint32_t mid_x = frame.w / 2;
+        const uint32_t mid_y = frame.h / 2;
+
+        for (uint32_t y_px = 0; y_px < frame.h; y_px++)
+            frame.pixels[y_px * frame.w + mid_x] = AXIS_COL;
+
+        for (uint32_t x_px = 0; x_px < frame.w; x_px++)
+            frame.pixels[mid_y * frame.w + x_px] = AXIS_COL;
+    }
+
+    /* Show the whole frame at once */
+    fb_present();
+
+    /* Enough for the 3 numbers, with up to 20 digits each */
+    char str[128] = "Iters: ";
+    append_num(str, frame.view.max_iter, " | Frame: ");
+    append_num(str, ns / 1000000, " ms | Tiles: ");
+    append_num(str, frame.tiles, " | Workers: ");
+    append_num(str, WORKERS, "");
+
+    static color_pair cols = { OVERLAY_FG, OVERLAY_BG };
+    fb_drawtext(5, 5, cols, &main_font, str);
+
+    mt_preempt_enable();
+}
+
+/*
+ * Entry point of the worker tasks. Renders the tiles of each new frame, until
+ * the frame is cancelled or there are no tiles left.
+ */
+static void mandel_worker(void) {
+    uint32_t gen = 0;
+
+    uint32_t eflags = irq_save();
+    uint32_t* buf   = tile_bufs[frame.workers++];
+
+    for (;;) {
+        while (!frame.quit && frame.gen == gen)
+            wq_wait(&work_wq);
+
+        if (frame.quit)
+            break;
+
+        gen = frame.gen;
+
+        while (frame.gen == gen && frame.next_tile < frame.tiles) {
+            const uint32_t tile    = frame.next_tile++;
+            const mandel_view view = frame.view;
+            irq_restore(eflags);
+
+            render_tile(&view, tile, gen, buf);
+
+            /* With interrupts disabled, the frame can't be cancelled while we
+             * copy the tile */
+            eflags = irq_save();
+            if (frame.gen != gen)
+                continue;
+
+            copy_tile(tile, buf);
+
+            if (++frame.done == frame.tiles) {
+                irq_restore(eflags);
+                finish_frame(gen);
+                eflags = irq_save();
+            }
+        }
+    }
+
+    frame.alive--;
+    wq_wake_all(&exit_wq);
+    irq_restore(eflags);
+}
+
+/* Cancel the current frame, and let the workers render one with `view` */
+static void start_frame(const mandel_view* view) {
+    const uint64_t now = clock_ns();
+
+    const uint32_t eflags = irq_save();
+    frame.view      = *view;
+    frame.next_tile = 0;
+    frame.done      = 0;
+    frame.start_ns  = now;
+    frame.gen++;
+    wq_wake_all(&work_wq);
+    irq_restore(eflags);
+}
+
+/* Tell the workers to return, and wait for them */
+static void stop_workers(void) {
+    const uint32_t eflags = irq_save();
+    frame.quit = true;
+    frame.gen++;
+    wq_wake_all(&work_wq);
+
+    while (frame.alive > 0)
+        wq_wait(&exit_wq);
+    irq_restore(eflags);
+}
+
 /**
  * @todo Use windows once it's added.
  * @todo Being able to... exit
@@ -84,182 +362,102 @@ int main_mandelbrot(int argc, char** argv) {
         return 1;
     }
 
+    /* Draw what the console has pending now, so it doesn't overwrite us */
+    fbc_flush();
+
+    /* Framebuffer. Each 32 bit entry is a color. The workers draw the
+     * mandelbrot to the shadow framebuffer, and then we present it to avoid
+     * tearing. */
+    uint32_t* pixels = fb_begin_frame();
+
     bool was_kb_echo = kb_getecho();
     kb_noecho();
 
     bool was_kb_raw = kb_getraw();
     kb_raw();
 
-    /* Framebuffer. Each 32 bit entry is a color. We will draw the mandelbrot to
-     * the intermediate `pixels` ptr, which will be overwritten if
-     * DOUBLE_BUFFERING is defined. */
-    volatile uint32_t* fb     = fb_get_ptr();
-    volatile uint32_t* pixels = fb;
-
-    const uint32_t w = fb_get_width();
-    const uint32_t h = fb_get_height();
-
-#ifdef DOUBLE_BUFFERING
-    /* Use double buffering */
-    uint32_t* back_buff = calloc(w * h, sizeof(uint32_t));
-    pixels              = back_buff;
-#endif
-
-    /* Draw X and Y axis. Toggled with KEY_TOGGLE_AXIS */
-    bool draw_axis = false;
-
-    /* Can change with KEY_ITER_INC and KEY_ITER_DEC */
-    uint32_t max_iter = DEFAULT_MAX_ITER;
-
-    /* Will become smaller when zooming */
-    double zoom     = DEFAULT_ZOOM;
-    double x_offset = DEFAULT_X_OFF;
-    double y_offset = DEFAULT_X_OFF;
-
-    /* Will be scaled when zooming, so we don't move too much */
-    double move_step = DEFAULT_MOVE_STEP;
-
     /* Calculate some values here for performance */
     const double min_real_x = -2.0;
     const double max_real_x = 1.0;
     const double min_real_y = -1.0;
     const double max_real_y = 1.0;
 
-    const double factor_x = (max_real_x - min_real_x) / (w - 1);
-    const double factor_y = (max_real_y - min_real_y) / (h - 1);
+    frame.pixels   = pixels;
+    frame.w        = fb_get_width();
+    frame.h        = fb_get_height();
+    frame.factor_x = (max_real_x - min_real_x) / (frame.w - 1);
+    frame.factor_y = (max_real_y - min_real_y) / (frame.h - 1);
+    frame.tiles_x  = (frame.w + TILE_SZ - 1) / TILE_SZ;
+    frame.tiles    = frame.tiles_x * ((frame.h + TILE_SZ - 1) / TILE_SZ);
+    frame.gen      = 0;
+    frame.quit     = false;
+    frame.workers  = 0;
+    frame.alive    = WORKERS;
+
+    for (int i = 0; i < WORKERS; i++)
+        mt_newtask("mandelbrot", mandel_worker);
+
+    /* Changed with the keys. The zoom will become smaller when zooming. */
+    mandel_view view = {
+        .zoom      = DEFAULT_ZOOM,
+        .x_offset  = DEFAULT_X_OFF,
+        .y_offset  = DEFAULT_Y_OFF,
+        .max_iter  = DEFAULT_MAX_ITER,
+        .draw_axis = false,
+    };
+
+    /* Will be scaled when zooming, so we don't move too much */
+    double move_step = DEFAULT_MOVE_STEP;
 
     bool main_loop = true;
     while (main_loop) {
-        /* Increased every drawn pixel. Faster than [y * w + x] */
-        uint32_t fb_idx = 0;
-
-        /* Mandelbrot */
-        for (uint32_t y_px = 0; y_px < h; y_px++) {
-            /* Real Y is the mandelbrot center vertically. We subtract 1.0 (half
-             * the height) to center it vertically. */
-            double real_y = min_real_y + y_px * factor_y;
-
-            /* Unlike real_x, because real_y values are -1..+1 (min/max_real_y),
-             * we can just zoom at +0 (the center) */
-            real_y *= zoom;
-            real_y += y_offset;
-
-            for (uint32_t x_px = 0; x_px < w; x_px++) {
-                /* Real X is the mandelbrot center horizontally. We subtract 2.0
-                 * (half the width) to center it horizontally. */
-                double real_x = min_real_x + x_px * factor_x;
-
-                /* Because real_x values are -2..+1 (min/max_real_x), we zoom at
-                 * -0.5 (the center) and then we restore. */
-                real_x += 0.5;
-                real_x *= zoom;
-                real_x -= 0.5;
-                real_x += x_offset;
-
-                /* These 2 values will be increased each iteration below */
-                double x = real_x;
-                double y = real_y;
-
-                bool inside_set = true;
-
-                /* In each iteration, we will check if we are inside the
-                 * mandebrot set. An interesting property of the mandelbrot set
-                 * is that the more iterations an outside value takes, the
-                 * closer to the set is. We can use this to change colors. */
-                for (uint32_t iter = 0; iter < max_iter; iter++) {
-                    /* Calulate squares once */
-                    double sqr_x = x * x;
-                    double sqr_y = y * y;
-
-                    /* Absolute value of a complex number is the distance from
-                     * origin: sqrt(x^2 + y^2) > 2 */
-                    if (sqr_x + sqr_y > 2 * 2) {
-                        /* Scale 0..360 HUE based on iter..max_iter ratio */
-                        int scaled_hue = iter * MAX_H / max_iter;
-                        pixels[fb_idx] = hue2rgb(scaled_hue);
-
-                        inside_set = false;
-                        break;
-                    }
-
-                    /* This part is explained in the povusers link on credits */
-                    y = (2.0 * x * y) + real_y;
-                    x = (sqr_x - sqr_y) + real_x;
-                }
-
-                /* We passed all iterations, we are inside the set. */
-                if (inside_set)
-                    pixels[fb_idx] = INSIDE_COL;
-
-                fb_idx++;
-            }
-        }
-
-        if (draw_axis) {
-            const uint32_t mid_x = w / 2;
-            const uint32_t mid_y = h / 2;
-
-            for (uint32_t y_px = 0; y_px < h; y_px++)
-                pixels[y_px * w + mid_x] = AXIS_COL;
-
-            for (uint32_t x_px = 0; x_px < w; x_px++)
-                pixels[mid_y * w + x_px] = AXIS_COL;
-        }
-
-#ifdef DOUBLE_BUFFERING
-        /* Swap the buffers */
-        for (uint32_t i = 0; i < w * h; i++)
-            fb[i] = pixels[i];
-#endif
-
-        static char iter_str[] = "Iters: 9999";
-        itoa(&iter_str[7], max_iter);
-
-        static color_pair cols = { 0xFFFFFF, 0x000000 };
-        fb_drawtext(5, 5, cols, &main_font, iter_str);
+        /* The workers render it while we wait for the next key. If it arrives
+         * before they are done, the frame is cancelled and we start the next
+         * one with the new values. */
+        start_frame(&view);
 
         /* Get user input */
         switch (getchar()) {
             case KEY_ZOOM_IN:
-                zoom *= ZOOM_STEP;
+                view.zoom *= ZOOM_STEP;
                 move_step *= ZOOM_STEP;
                 break;
             case KEY_ZOOM_OUT:
-                zoom /= ZOOM_STEP;
+                view.zoom /= ZOOM_STEP;
                 move_step /= ZOOM_STEP;
                 break;
             case KEY_UP:
-                if (y_offset > -1.1)
-                    y_offset -= move_step;
+                if (view.y_offset > -1.1)
+                    view.y_offset -= move_step;
                 break;
             case KEY_DOWN:
-                if (y_offset < 1.1)
-                    y_offset += move_step;
+                if (view.y_offset < 1.1)
+                    view.y_offset += move_step;
                 break;
             case KEY_LEFT:
-                if (x_offset > -2.1)
-                    x_offset -= move_step;
+                if (view.x_offset > -2.1)
+                    view.x_offset -= move_step;
                 break;
             case KEY_RIGHT:
-                if (x_offset < 2.1)
-                    x_offset += move_step;
+                if (view.x_offset < 2.1)
+                    view.x_offset += move_step;
                 break;
             case KEY_ITER_INC:
-                max_iter += ITER_STEP;
+                view.max_iter += ITER_STEP;
                 break;
             case KEY_ITER_DEC:
-                if (max_iter > ITER_STEP)
-                    max_iter -= ITER_STEP;
+                if (view.max_iter > ITER_STEP)
+                    view.max_iter -= ITER_STEP;
                 break;
             case KEY_RESET:
-                zoom      = DEFAULT_ZOOM;
-                move_step = DEFAULT_MOVE_STEP;
-                x_offset  = DEFAULT_X_OFF;
-                y_offset  = DEFAULT_X_OFF;
-                max_iter  = DEFAULT_MAX_ITER;
+                view.zoom     = DEFAULT_ZOOM;
+                view.x_offset = DEFAULT_X_OFF;
+                view.y_offset = DEFAULT_Y_OFF;
+                view.max_iter = DEFAULT_MAX_ITER;
+                move_step     = DEFAULT_MOVE_STEP;
                 break;
             case KEY_TOGGLE_AXIS:
-                draw_axis = !draw_axis;
+                view.draw_axis = !view.draw_axis;
                 break;
             case KEY_QUIT:
                 /* TODO */
@@ -270,9 +468,7 @@ int main_mandelbrot(int argc, char** argv) {
         }
     }
 
-#ifdef DOUBLE_BUFFERING
-    free(back_buff);
-#endif
+    stop_workers();
 
     if (was_kb_echo)
         kb_echo();
@@ -10,14 +10,21 @@
 #include <time.h> /* sleep */
 
 #include <kernel/framebuffer_console.h> /* fbc_setfore, fbc_clear */
+#include <kernel/framebuffer.h>         /* fb_drawrect_fast */
+#include <kernel/memtype.h>             /* memtype_set_wc */
 #include <kernel/paging.h>              /* paging_show_map */
+#include <kernel/frame.h>               /* frame_get_free */
 #include <kernel/heap.h>                /* heap_dump_headers */
+#include <kernel/slab.h>                /* kmem_cache_dump */
 #include <kernel/pit.h>                 /* pit_get_ticks */
+#include <kernel/timer.h>               /* timer_add, timer_cancel */
+#include <kernel/clock.h>               /* clock_cycles, clock_get_freq */
+#include <kernel/boot_trace.h>          /* boot_trace_count, boot_trace_ns */
 #include <kernel/rtc.h>                 /* rtc_get_datetime */
 #include <kernel/pcspkr.h>              /* pcspkr_beep */
 #include <kernel/keyboard.h>            /* kb_setlayout, Layout */
 #include <kernel/rand.h>                /* cpu_rand */
-#include <kernel/multitask.h>           /* mt_newtask, mt_endtask */
+#include <kernel/multitask.h>           /* mt_newtask, mt_dump_tasks */
 
 #include "sh.h"
 
@@ -59,6 +66,8 @@ static int cmd_loadkeys(int argc, char** argv);
 static int cmd_ticks();
 static int cmd_date();
 static int cmd_timer(int argc, char** argv);
+static int cmd_clock();
+static int cmd_boot_trace();
 
 static int cmd_beep(int argc, char** argv);
 static int cmd_metronome(int argc, char** argv);
@@ -74,8 +83,23 @@ static int cmd_primes(int argc, char** argv);
 static int cmd_test_libk();
 static int cmd_test_multitask();
 
+static int cmd_tasks();
+static int cmd_nice(int argc, char** argv);
+static int cmd_quantum(int argc, char** argv);
+static int cmd_tickless(int argc, char** argv);
+
 static int cmd_page_map();
+static int cmd_mem_info();
 static int cmd_heap_headers();
+static int cmd_heap_bench(int argc, char** argv);
+static int cmd_slab_info();
+static int cmd_fb_bench(int argc, char** argv);
+static int cmd_scroll_bench(int argc, char** argv);
+static int cmd_fill_bench(int argc, char** argv);
+static int cmd_switch_bench(int argc, char** argv);
+static int cmd_idle_bench(int argc, char** argv);
+static int cmd_mem_bench(int argc, char** argv);
+static int cmd_str_bench(int argc, char** argv);
 static int cmd_kernel_map();
 
 /*
@@ -130,6 +154,16 @@ static Command cmd_list[] = {
       "Simple timer command (Wrapper for time.h functions)",
       cmd_timer,
     },
+    {
+      "clock",
+      "Show the clocksource used for measuring time",
+      cmd_clock,
+    },
+    {
+      "boot_trace",
+      "Show how long each stage of the kernel initialization took",
+      cmd_boot_trace,
+    },
     {
       "beep",
       "Beep through the pc speaker (optional frequency and duration)",
@@ -185,16 +219,86 @@ static Command cmd_list[] = {
       "Test multitasking with 3 threads",
       cmd_test_multitask,
     },
+    {
+      "tasks",
+      "List the tasks. Commands ending with \" &\" run in the background",
+      cmd_tasks,
+    },
+    {
+      "nice",
+      "Run a command with a different priority (0 is the highest)",
+      cmd_nice,
+    },
+    {
+      "quantum",
+      "Show or change the time slice of the scheduler (ticks, 0 disables)",
+      cmd_quantum,
+    },
+    {
+      "tickless",
+      "Show or change the tickless idle mode (on/off)",
+      cmd_tickless,
+    },
     {
       "page_map",
       "Display the page director and page table layout",
       cmd_page_map,
     },
+    {
+      "mem_info",
+      "Show the usable and free physical memory",
+      cmd_mem_info,
+    },
     {
       "heap_headers",
       "Dump the alloc headers",
       cmd_heap_headers,
     },
+    {
+      "heap_bench",
+      "Compare the heap allocation policies (optional block count)",
+      cmd_heap_bench,
+    },
+    {
+      "slab_info",
+      "Show the kernel object caches and their usage",
+      cmd_slab_info,
+    },
+    {
+      "fb_bench",
+      "Framebuffer fill-rate with and without write-combining",
+      cmd_fb_bench,
+    },
+    {
+      "scroll_bench",
+      "Console scrolling, moving the pixels or drawing again (optional lines)",
+      cmd_scroll_bench,
+    },
+    {
+      "fill_bench",
+      "Fill-rate of the framebuffer primitives and a pixel loop (opt. frames)",
+      cmd_fill_bench,
+    },
+    {
+      "switch_bench",
+      "Task switches per second, with and without FPU usage (optional ms)",
+      cmd_switch_bench,
+    },
+    {
+      "idle_bench",
+      "Interrupts per second while idle, with and without ticks (optional ms)",
+      cmd_idle_bench,
+    },
+    {
+      "mem_bench",
+      "Speed of memcpy and memset at different sizes (optional MiB per test)",
+      cmd_mem_bench,
+    },
+    {
+      "str_bench",
+      "Compare the string functions with byte loops (optional length)",
+      cmd_str_bench,
+    },
     {
       "kernel_map",
       "Show the address in memory of each kernel section",
@@ -209,6 +313,11 @@ static int cmd_unk() {
     return 1;
 }
 
+/* Print nanoseconds as milliseconds, with all the decimals */
+static void print_ns_as_ms(uint64_t ns) {
+    printf("%ld.%06ldms", (uint32_t)(ns / 1000000), (uint32_t)(ns % 1000000));
+}
+
 static int cmd_help() {
     fbc_setfore(COLOR_WHITE_B);
     puts("Command list:");
@@ -336,7 +445,9 @@ static int cmd_timer(int argc, char** argv) {
     if (strcmp(argv[1], "start") == 0) {
         timer_start();
     } else if (strcmp(argv[1], "stop") == 0) {
-        printf("%llums\n", timer_stop());
+        const uint64_t ns = timer_stop_ns();
+        print_ns_as_ms(ns);
+        putchar('\n');
     } else {
         printf("Invalid option \"%s\"\n"
                "Usage:\n"
@@ -350,6 +461,54 @@ static int cmd_timer(int argc, char** argv) {
     return 0;
 }
 
+static int cmd_clock() {
+    const uint64_t freq = clock_get_freq();
+
+    /* Measure the cost of reading the clock itself */
+    const uint64_t start = clock_cycles();
+    for (int i = 0; i < 1000; i++)
+        clock_cycles();
+    const uint64_t cost = (clock_cycles() - start) / 1000;
+
+    printf("Source:     %s\n", clock_is_tsc() ? "TSC" : "PIT channel 0");
+    printf("Frequency:  %lldhz\n", freq);
+    printf("Resolution: %lldps\n", 1000000000000ULL / freq);
+    printf("Read cost:  %lld cycles (%lldns)\n", cost,
+           clock_cycles_to_ns(cost));
+
+    return 0;
+}
+
+static int cmd_boot_trace() {
+    const uint32_t count = boot_trace_count();
+    if (count == 0 || !clock_is_tsc()) {
+        puts("The boot stages are only recorded if the CPU has a TSC.");
+        return 1;
+    }
+
+    uint64_t total = 0;
+    for (uint32_t i = 0; i < count; i++)
+        total += boot_trace_ns(i);
+
+    fbc_setfore(COLOR_WHITE_B);
+    printf("%16s%18s%9s\n", "Stage", "Time", "Total");
+    fbc_setfore(COLOR_WHITE);
+
+    for (uint32_t i = 0; i < count; i++) {
+        const uint64_t ns = boot_trace_ns(i);
+
+        printf("%16s  ", boot_trace_name(i));
+        print_ns_as_ms(ns);
+        printf("%8.1f%%\n", (total > 0) ? ns * 100.0 / total : 0);
+    }
+
+    printf("%16s  ", "kernel_main");
+    print_ns_as_ms(total);
+    putchar('\n');
+
+    return 0;
+}
+
 static int cmd_beep(int argc, char** argv) {
     /* Default beep */
     Beep beep_info = {
@@ -381,6 +540,21 @@ static int cmd_beep(int argc, char** argv) {
     return 0;
 }
 
+/* Timer callback, stops the beep of metronome_beep() */
+static void metronome_silence(void* data) {
+    (void)data;
+    pcspkr_clear();
+}
+
+/* Periodic timer callback of cmd_metronome. Starts the beep and arms a one-shot
+ * timer for stopping it, so nothing blocks inside the PIT interrupt. */
+static void metronome_beep(void* data) {
+    const Beep* beep = data;
+
+    pcspkr_play(beep->freq);
+    timer_add(beep->ms_len, metronome_silence, NULL, false);
+}
+
 static int cmd_metronome(int argc, char** argv) {
     const int beep_duration = 10;  /* ms */
     uint32_t freq           = 150; /* hz for the pcspkr */
@@ -445,11 +619,22 @@ static int cmd_metronome(int argc, char** argv) {
            "Hold \'q\' to quit...\n",
            freq, bpm);
 
-    while (!kb_held('q')) {
-        pcspkr_beep_custom(beep);
-        sleep_ms(ms_delay);
+    /* The beats come from a periodic kernel timer, so they don't drift with
+     * the time we spend polling the keyboard */
+    metronome_beep(&beep);
+    const timer_id timer = timer_add(ms_delay, metronome_beep, &beep, true);
+    if (timer == TIMER_NONE) {
+        pcspkr_clear();
+        printf("Could not arm a kernel timer.\n");
+        return 1;
     }
 
+    while (!kb_held('q'))
+        sleep_ms(10);
+
+    timer_cancel(timer);
+    pcspkr_clear();
+
     return 0;
 }
 
@@ -528,14 +713,120 @@ static int cmd_primes(int argc, char** argv) {
             found++;
         }
     }
-    uint32_t end = (uint32_t)timer_stop();
+    const uint64_t ns = timer_stop_ns();
 
-    printf("Done. %ld primes found from 1 to %ld in %ld ticks.\n", found, num,
-           end);
+    printf("Done. %ld primes found from 1 to %ld in ", found, num);
+    print_ns_as_ms(ns);
+    printf(".\n");
 
     return 0;
 }
 
+/* Byte at a time versions, used for checking and benchmarking the ones of
+ * src/libk/string.c. The volatile reads stop the compiler from replacing the
+ * loops with calls to the functions we are comparing. */
+static size_t str_ref_strlen(const volatile char* str) {
+    size_t ret = 0;
+    while (str[ret] != '\0')
+        ret++;
+    return ret;
+}
+
+static char* str_ref_strchr(const volatile char* str, int c) {
+    for (;; str++) {
+        if (*str == (char)c)
+            return (char*)str;
+        if (*str == '\0')
+            return NULL;
+    }
+}
+
+static int str_ref_strcmp(const volatile char* a, const volatile char* b) {
+    while (*a == *b && *a != '\0') {
+        a++;
+        b++;
+    }
+    return (uint8_t)*a - (uint8_t)*b;
+}
+
+static inline int str_sign(int x) {
+    return (x > 0) - (x < 0);
+}
+
+/* Compare the string functions with the byte loops, for all the alignments and
+ * lengths that matter for the word at a time loops. Prints the first mismatch
+ * and returns false if there is one. */
+static bool str_check(void) {
+    char a[64];
+    char b[64];
+
+    for (int align = 0; align < 4; align++) {
+        for (int len = 0; len < 40; len++) {
+            char* sa = &a[align];
+            memset(a, '#', sizeof(a));
+            memset(b, '\0', sizeof(b));
+            for (int i = 0; i < len; i++)
+                sa[i] = 'a' + (i % 26);
+            sa[len] = '\0';
+
+            if (strlen(sa) != str_ref_strlen(sa)) {
+                printf("strlen failed (align %d, len %d)\n", align, len);
+                return false;
+            }
+
+            for (int i = 0; i <= len; i++) {
+                if (strchr(sa, sa[i]) != str_ref_strchr(sa, sa[i]) ||
+                    strchr(sa, '#') != NULL) {
+                    printf("strchr failed (align %d, len %d)\n", align, len);
+                    return false;
+                }
+            }
+
+            /* Same and different alignments of the second string */
+            for (int align_b = 0; align_b < 4; align_b++) {
+                char* sb = &b[align_b];
+                memcpy(sb, sa, len + 1);
+
+                for (int i = 0; i <= len; i++) {
+                    if (strcmp(sa, sb) != 0) {
+                        printf("strcmp failed (align %d/%d, len %d)\n", align,
+                               align_b, len);
+                        return false;
+                    }
+
+                    /* Change one char, it should be the first mismatch */
+                    const char old = sb[i];
+                    sb[i]          = (i % 2 == 0) ? 'A' : '~';
+                    if (str_sign(strcmp(sa, sb)) !=
+                        str_sign(str_ref_strcmp(sa, sb))) {
+                        printf("strcmp failed (align %d/%d, len %d, pos %d)\n",
+                               align, align_b, len, i);
+                        return false;
+                    }
+                    sb[i] = old;
+                }
+            }
+
+            /* Overlapping in both directions */
+            char* dst = &b[align];
+            memcpy(b, a, sizeof(b));
+            memmove(dst + 3, dst, len);
+            if (memcmp(dst + 3, sa, len) != 0) {
+                printf("memmove failed (align %d, len %d)\n", align, len);
+                return false;
+            }
+            memcpy(b, a, sizeof(b));
+            memmove(dst, dst + 3, len);
+            if (memcmp(dst, sa + 3, len) != 0) {
+                printf("memmove failed (align %d, len %d)\n", align, len);
+                return false;
+            }
+        }
+    }
+
+    return true;
+}
+
 static int cmd_test_libk() {
     TEST_TITLE("\nTesting stdlib.h functions");
 
@@ -569,6 +860,25 @@ static int cmd_test_libk() {
     printf("tan(M_PI / 4.0) = %f\n", tan(M_PI / 4.0));
     printf("cot(5.0)        = %f\n", cot(5.0));
 
+    TEST_TITLE("\nTesting string.h functions");
+    char str_buf[] = "0123456789";
+    char tok_buf[] = "  ls -l   /dev ";
+    printf("strlen(\"Hello, world!\")     = %ld\n", strlen("Hello, world!"));
+    printf("strchr(\"Hello\", 'l')        = \"%s\"\n", strchr("Hello", 'l'));
+    printf("strchr(\"Hello\", 'x')        = %p\n", strchr("Hello", 'x'));
+    printf("strcmp(\"abc\", \"abd\")       = %d\n", strcmp("abc", "abd"));
+    printf("strncmp(\"abcx\", \"abcy\", 3) = %d\n",
+           strncmp("abcx", "abcy", 3));
+    printf("memmove(buf + 2, buf, 6)    = \"%s\"\n",
+           (char*)memmove(str_buf + 2, str_buf, 6) - 2);
+    printf("strtok(\"%s\", \" \")    = ", tok_buf);
+    for (char* tok = strtok(tok_buf, " "); tok != NULL; tok = strtok(NULL, " "))
+        printf("\"%s\" ", tok);
+    putchar('\n');
+    printf("Checking against byte loops: ");
+    if (str_check())
+        puts("OK");
+
     TEST_TITLE("\nTesting time.h functions");
     printf("Hello, ");
     sleep(1);
@@ -580,14 +890,25 @@ static int cmd_test_libk() {
 #define MT_TEST_ITERS 3
 #define MT_TEST_DELAY 100
 
+/* Number of test tasks that returned. See cmd_test_multitask */
+static volatile int mt_test_done = 0;
+
+static void multitask_test_finish(void) {
+    /* Not atomic, make sure we are not preempted in the middle */
+    mt_preempt_disable();
+    mt_test_done++;
+    mt_preempt_enable();
+}
+
 static void multitask_test0(void) {
     Ctx* self = mt_gettask();
 
     for (int i = 0; i <= MT_TEST_ITERS; i++) {
         printf("%s: %.2f\n", self->name, i + 0.1f);
         sleep_ms(MT_TEST_DELAY);
-        mt_switch(self->next);
     }
+
+    multitask_test_finish();
 }
 
 static void multitask_test1(void) {
@@ -596,8 +917,9 @@ static void multitask_test1(void) {
     for (int i = 0; i <= MT_TEST_ITERS; i++) {
         printf("%s: %.2f\n", self->name, i + 0.2f);
         sleep_ms(MT_TEST_DELAY);
-        mt_switch(self->next);
     }
+
+    multitask_test_finish();
 }
 
 static void multitask_test2(void) {
@@ -606,14 +928,17 @@ static void multitask_test2(void) {
     for (int i = 0; i <= MT_TEST_ITERS; i++) {
         printf("%s: %.2f\n", self->name, i + 0.3f);
         sleep_ms(MT_TEST_DELAY);
-        mt_switch(self->next);
     }
+
+    multitask_test_finish();
 }
 
 static int cmd_test_multitask() {
     TEST_TITLE("Testing multitasking with %d iterations and %dms of delay",
                MT_TEST_ITERS, MT_TEST_DELAY);
 
+    mt_test_done = 0;
+
     /*
      * When creating more than 1 task, the last tasks added will be placed after
      * the current task:
@@ -626,25 +951,93 @@ static int cmd_test_multitask() {
      * So in the end:
      *     [cur_task] -> [task0] -> [task1] -> [task2]
      *
-     * For more information, call dump_task_list() after creating the tasks.
+     * The tasks don't need to switch manually, the scheduler will switch when
+     * they sleep or when their time slice runs out. When they return, they
+     * are freed by the scheduler. For more information, call mt_dump_tasks()
+     * after creating the tasks.
      */
-    Ctx* task2 = mt_newtask("task2", multitask_test2);
-    Ctx* task1 = mt_newtask("task1", multitask_test1);
-    Ctx* task0 = mt_newtask("task0", multitask_test0);
+    mt_newtask("task2", multitask_test2);
+    mt_newtask("task1", multitask_test1);
+    mt_newtask("task0", multitask_test0);
 
     Ctx* self = mt_gettask();
 
     for (int i = 0; i <= MT_TEST_ITERS; i++) {
         printf("%s: %.2f\n", self->name, (float)i);
         sleep_ms(MT_TEST_DELAY);
-        mt_switch(self->next);
     }
 
-    /* Order does not matter */
-    mt_endtask(task0);
-    mt_endtask(task1);
-    mt_endtask(task2);
+    /* Wait for the other tasks */
+    while (mt_test_done < 3)
+        sleep_ms(MT_TEST_DELAY);
+
+    return 0;
+}
+
+static int cmd_tasks() {
+    mt_dump_tasks();
+    return 0;
+}
+
+static int cmd_nice(int argc, char** argv) {
+    if (argc < 3 || argv[1][0] < '0' || argv[1][0] > '9') {
+        printf("Usage:\n"
+               "\t%s <prio> <command> [args...]   - Run command with a "
+               "priority from 0 to %d\n",
+               argv[0], MT_PRIO_LEVELS - 1);
+        return 1;
+    }
+
+    for (size_t i = 0; i < LENGTH(cmd_list); i++) {
+        if (strcmp(argv[2], cmd_list[i].cmd) != 0)
+            continue;
+
+        Ctx* self            = mt_gettask();
+        const uint32_t saved = self->priority;
+
+        mt_setprio(self, atoi(argv[1]));
+        const int ret = cmd_list[i].func(argc - 2, &argv[2]);
+        mt_setprio(self, saved);
+
+        return ret;
+    }
+
+    return cmd_unk();
+}
+
+static int cmd_quantum(int argc, char** argv) {
+    if (argc > 2) {
+        printf("Usage:\n"
+               "\t%s [ticks]   - Set the time slice of each task, in ms\n",
+               argv[0]);
+        return 1;
+    }
+
+    if (argc == 2)
+        mt_set_quantum(atoi(argv[1]));
+
+    const uint32_t quantum = mt_get_quantum();
+    if (quantum == 0)
+        puts("Preemption disabled");
+    else
+        printf("Time slice: %ld ticks\n", quantum);
+
+    return 0;
+}
+
+static int cmd_tickless(int argc, char** argv) {
+    if (argc > 2 ||
+        (argc == 2 && strcmp(argv[1], "on") && strcmp(argv[1], "off"))) {
+        printf("Usage:\n"
+               "\t%s [on|off]  - Stop the PIT ticks while idle\n",
+               argv[0]);
+        return 1;
+    }
+
+    if (argc == 2)
+        mt_set_tickless(!strcmp(argv[1], "on"));
 
+    printf("Tickless idle: %s\n", mt_get_tickless() ? "on" : "off");
     return 0;
 }
 
@@ -653,11 +1046,652 @@ static int cmd_page_map() {
     return 0;
 }
 
+static int cmd_mem_info() {
+    const uint32_t total  = frame_get_total();
+    const uint32_t unused = frame_get_free();
+
+    printf("Usable: %ld frames (%ldKiB)\n", total, total * (FRAME_SIZE / 1024));
+    printf("Free:   %ld frames (%ldKiB)\n", unused,
+           unused * (FRAME_SIZE / 1024));
+
+    return 0;
+}
+
 static int cmd_heap_headers() {
     heap_dump_headers();
     return 0;
 }
 
+#define HEAP_BENCH_DEFAULT 2000
+#define HEAP_BENCH_SEED    1234
+
+/* Allocate and free `n` blocks of pseudo-random sizes with the current heap
+ * policy, and return the nanoseconds it took. */
+static uint64_t heap_bench_run(void** ptrs, uint32_t n) {
+    /* Same sizes for each policy */
+    srand(HEAP_BENCH_SEED);
+
+    timer_start();
+
+    /* Allocate all blocks so the heap has `n` used blocks */
+    for (uint32_t i = 0; i < n; i++)
+        ptrs[i] = malloc(16 + rand() % 1024);
+
+    /* Free every other block to fragment the heap */
+    for (uint32_t i = 0; i < n; i += 2)
+        free(ptrs[i]);
+
+    /* Fill the holes again. Some of the blocks won't fit in the holes */
+    for (uint32_t i = 0; i < n; i += 2)
+        ptrs[i] = malloc(16 + rand() % 2048);
+
+    for (uint32_t i = 0; i < n; i++)
+        free(ptrs[i]);
+
+    return timer_stop_ns();
+}
+
+static int cmd_heap_bench(int argc, char** argv) {
+    uint32_t n = HEAP_BENCH_DEFAULT;
+
+    if (argc > 1) {
+        const int arg = atoi(argv[1]);
+        if (!strcmp(argv[1], "-h") || !strcmp(argv[1], "--help") || arg < 2) {
+            printf("Usage:\n"
+                   "\t%s [blocks]  - Benchmark the heap with N blocks (default "
+                   "%d)\n",
+                   argv[0], HEAP_BENCH_DEFAULT);
+            return 1;
+        }
+
+        n = arg;
+    }
+
+    void** ptrs = malloc(n * sizeof(void*));
+
+    TEST_TITLE("Allocating and freeing %ld blocks", n);
+
+    heap_set_policy(HEAP_POLICY_FIRST_FIT);
+    const uint64_t first_fit = heap_bench_run(ptrs, n);
+
+    heap_set_policy(HEAP_POLICY_BINS);
+    const uint64_t bins = heap_bench_run(ptrs, n);
+
+    free(ptrs);
+
+    printf("First fit:  ");
+    print_ns_as_ms(first_fit);
+    printf("\nSize bins:  ");
+    print_ns_as_ms(bins);
+    putchar('\n');
+    fbc_setfore(COLOR_WHITE);
+
+    return 0;
+}
+
+static int cmd_slab_info() {
+    kmem_cache_dump();
+    return 0;
+}
+
+#define FB_BENCH_DEFAULT 50
+
+/* Fill the framebuffer console region `frames` times and return the MiB/s */
+static double fb_bench_run(uint32_t frames) {
+    const fbc_ctx* ctx = fbc_get_ctx();
+
+    /* Don't let pending console changes draw over it */
+    fbc_flush();
+
+    timer_start();
+
+    for (uint32_t i = 0; i < frames; i++)
+        fb_drawrect_fast(ctx->y, ctx->x, ctx->h, ctx->w,
+                         (i % 2 == 0) ? COLOR_BLUE : COLOR_BLACK);
+
+    const uint64_t ns = timer_stop_ns();
+
+    /* Bytes written to the framebuffer, in MiB. 15 bpp also uses 2 bytes. */
+    const uint32_t bytespp = (fb_get_bpp() + 7) / 8;
+    const double mib =
+      (double)ctx->h * ctx->w * bytespp * frames / (1024 * 1024);
+
+    return (ns == 0) ? 0 : mib * 1000000000 / ns;
+}
+
+static int cmd_fb_bench(int argc, char** argv) {
+    uint32_t frames = FB_BENCH_DEFAULT;
+
+    if (argc > 1) {
+        const int arg = atoi(argv[1]);
+        if (!strcmp(argv[1], "-h") || !strcmp(argv[1], "--help") || arg < 1) {
+            printf("Usage:\n"
+                   "\t%s [frames]  - Fill the screen N times (default %d)\n",
+                   argv[0], FB_BENCH_DEFAULT);
+            return 1;
+        }
+
+        frames = arg;
+    }
+
+    void* fb          = (void*)fb_get_ptr();
+    const uint32_t sz = fb_get_pitch() * fb_get_height();
+
+    /* Default memory type, as set by the bootloader/BIOS */
+    memtype_set_default(fb, sz);
+    const double def_rate = fb_bench_run(frames);
+
+    const enum memtype_method method = memtype_set_wc(fb, sz);
+    const double wc_rate             = fb_bench_run(frames);
+
+    /* Restore the console we just overwrote */
+    fbc_refresh();
+
+    TEST_TITLE("Filled the console %ld times", frames);
+    printf("Default:          %fMiB/s\n", def_rate);
+
+    if (method == MEMTYPE_NONE)
+        printf("Write-combining:  Not supported\n");
+    else
+        printf("Write-combining:  %fMiB/s (%s)\n", wc_rate,
+               memtype_method_str(method));
+
+    fbc_setfore(COLOR_WHITE);
+    return 0;
+}
+
+#define SCROLL_BENCH_DEFAULT 200
+
+/* Print `lines` lines, scrolling and drawing after each one. Returns the
+ * nanoseconds per line. */
+static uint64_t scroll_bench_run(uint32_t lines, bool blit) {
+    fbc_set_scroll_blit(blit);
+
+    /* Make sure we are in the last row, so every line scrolls */
+    for (uint32_t i = 0; i < fbc_get_ctx()->ch_h; i++)
+        putchar('\n');
+    fbc_flush();
+
+    const uint64_t start = clock_ns();
+    for (uint32_t i = 0; i < lines; i++) {
+        printf("Line %ld of %ld\n", i + 1, lines);
+        fbc_flush();
+    }
+
+    return (clock_ns() - start) / lines;
+}
+
+static int cmd_scroll_bench(int argc, char** argv) {
+    uint32_t lines = SCROLL_BENCH_DEFAULT;
+
+    if (argc > 1) {
+        const int arg = atoi(argv[1]);
+        if (!strcmp(argv[1], "-h") || !strcmp(argv[1], "--help") || arg < 1) {
+            printf("Usage:\n"
+                   "\t%s [lines]  - Lines to print in each test (default %d)\n",
+                   argv[0], SCROLL_BENCH_DEFAULT);
+            return 1;
+        }
+
+        lines = arg;
+    }
+
+    const bool old_blit = fbc_get_scroll_blit();
+
+    const uint64_t redraw_ns = scroll_bench_run(lines, false);
+    const uint64_t blit_ns   = scroll_bench_run(lines, true);
+
+    fbc_set_scroll_blit(old_blit);
+
+    TEST_TITLE("Scrolled %ld lines (time per line)", lines);
+    printf("Drawing again:  ");
+    print_ns_as_ms(redraw_ns);
+    printf("\nMoving pixels:  ");
+    print_ns_as_ms(blit_ns);
+    printf("\nSpeedup:        %.1fx\n",
+           (blit_ns > 0) ? (double)redraw_ns / blit_ns : 0);
+
+    fbc_setfore(COLOR_WHITE);
+    return 0;
+}
+
+#define FILL_BENCH_DEFAULT 50
+
+typedef void (*fill_bench_func)(const fbc_ctx* ctx, uint32_t col,
+                                const uint32_t* src);
+
+/* Fill the console region one pixel at a time, as a reference */
+static void fill_px(const fbc_ctx* ctx, uint32_t col, const uint32_t* src) {
+    (void)src;
+
+    for (uint32_t y = ctx->y; y < ctx->y + ctx->h; y++)
+        for (uint32_t x = ctx->x; x < ctx->x + ctx->w; x++)
+            fb_setpx_col(y, x, col);
+}
+
+static void fill_rect(const fbc_ctx* ctx, uint32_t col, const uint32_t* src) {
+    (void)src;
+    fb_drawrect_fast(ctx->y, ctx->x, ctx->h, ctx->w, col);
+}
+
+static void fill_blit(const fbc_ctx* ctx, uint32_t col, const uint32_t* src) {
+    (void)col;
+    fb_blit(ctx->y, ctx->x, ctx->h, ctx->w, src, ctx->w * sizeof(uint32_t));
+}
+
+/* Fill the framebuffer console region `frames` times and return the MiB/s */
+static double fill_bench_run(fill_bench_func func, const uint32_t* src,
+                             uint32_t frames) {
+    const fbc_ctx* ctx = fbc_get_ctx();
+
+    const uint64_t start = clock_ns();
+    for (uint32_t i = 0; i < frames; i++)
+        func(ctx, (i % 2 == 0) ? COLOR_BLUE : COLOR_BLACK, src);
+    const uint64_t ns = clock_ns() - start;
+
+    /* Bytes written to the framebuffer, in MiB. 15 bpp also uses 2 bytes. */
+    const uint32_t bytespp = (fb_get_bpp() + 7) / 8;
+    const double mib =
+      (double)ctx->h * ctx->w * bytespp * frames / (1024 * 1024);
+
+    return (ns == 0) ? 0 : mib * 1000000000 / ns;
+}
+
+static int cmd_fill_bench(int argc, char** argv) {
+    uint32_t frames = FILL_BENCH_DEFAULT;
+
+    if (argc > 1) {
+        const int arg = atoi(argv[1]);
+        if (!strcmp(argv[1], "-h") || !strcmp(argv[1], "--help") || arg < 1) {
+            printf("Usage:\n"
+                   "\t%s [frames]  - Fill the console N times (default %d)\n",
+                   argv[0], FILL_BENCH_DEFAULT);
+            return 1;
+        }
+
+        frames = arg;
+    }
+
+    /* Source of fb_blit, an image of the console size in normal memory */
+    const fbc_ctx* ctx = fbc_get_ctx();
+    uint32_t* src      = malloc(ctx->h * ctx->w * sizeof(uint32_t));
+    if (src == NULL) {
+        printf("Could not allocate the image.\n");
+        return 1;
+    }
+    memset32(src, COLOR_GRAY, ctx->h * ctx->w);
+
+    /* Don't let pending console changes draw over it */
+    fbc_flush();
+
+    const double px_rate   = fill_bench_run(fill_px, src, frames);
+    const double rect_rate = fill_bench_run(fill_rect, src, frames);
+    const double blit_rate = fill_bench_run(fill_blit, src, frames);
+
+    /* Restore the console we just overwrote */
+    fbc_refresh();
+    free(src);
+
+    TEST_TITLE("Filled the console %ld times", frames);
+    printf("Pixel loop:        %fMiB/s\n", px_rate);
+    printf("fb_drawrect_fast:  %fMiB/s (%.1fx)\n", rect_rate,
+           (px_rate > 0) ? rect_rate / px_rate : 0);
+    printf("fb_blit:           %fMiB/s (%.1fx)\n", blit_rate,
+           (px_rate > 0) ? blit_rate / px_rate : 0);
+
+    fbc_setfore(COLOR_WHITE);
+    return 0;
+}
+
+#define SWITCH_BENCH_DEFAULT 1000
+
+/* Shared with the task created by switch_bench_run */
+static volatile bool switch_bench_running = false;
+static volatile bool switch_bench_fpu     = false;
+static volatile bool switch_bench_done    = false;
+
+static void switch_bench_task(void) {
+    volatile float f = 1.0f;
+
+    while (switch_bench_running) {
+        if (switch_bench_fpu)
+            f *= 1.0001f;
+
+        mt_yield();
+    }
+
+    switch_bench_done = true;
+}
+
+/* Returns the number of task switches per second during `ms` */
+static uint32_t switch_bench_run(uint32_t ms, bool fpu, uint32_t* traps) {
+    switch_bench_running = true;
+    switch_bench_fpu     = fpu;
+    switch_bench_done    = false;
+
+    mt_newtask("switch_bench", switch_bench_task);
+
+    const uint32_t old_traps = mt_fpu_traps;
+    volatile float f         = 1.0f;
+    uint32_t yields          = 0;
+
+    /* Compare cycles instead of converting each time */
+    const uint64_t start = clock_cycles();
+    const uint64_t end   = start + clock_get_freq() * ms / 1000;
+    uint64_t now;
+    while ((now = clock_cycles()) < end) {
+        if (fpu)
+            f *= 1.0001f;
+
+        /* Each yield that switches is a round trip to the other task */
+        if (mt_yield())
+            yields++;
+    }
+
+    *traps = mt_fpu_traps - old_traps;
+
+    switch_bench_running = false;
+    while (!switch_bench_done)
+        mt_yield();
+
+    return (uint64_t)yields * 2 * 1000000000 / clock_cycles_to_ns(now - start);
+}
+
+static int cmd_switch_bench(int argc, char** argv) {
+    uint32_t ms = SWITCH_BENCH_DEFAULT;
+
+    if (argc > 1) {
+        const int arg = atoi(argv[1]);
+        if (!strcmp(argv[1], "-h") || !strcmp(argv[1], "--help") || arg < 1) {
+            printf("Usage:\n"
+                   "\t%s [ms]  - Duration of each test (default %d)\n",
+                   argv[0], SWITCH_BENCH_DEFAULT);
+            return 1;
+        }
+
+        ms = arg;
+    }
+
+    uint32_t int_traps, fpu_traps;
+    const uint32_t int_rate = switch_bench_run(ms, false, &int_traps);
+    const uint32_t fpu_rate = switch_bench_run(ms, true, &fpu_traps);
+
+    TEST_TITLE("Switching between 2 tasks for %ldms", ms);
+    printf("Integer only: %ld switches/s (%ld FPU swaps)\n", int_rate,
+           int_traps);
+    printf("FPU in both:  %ld switches/s (%ld FPU swaps)\n", fpu_rate,
+           fpu_traps);
+
+    return 0;
+}
+
+#define IDLE_BENCH_DEFAULT 2000
+
+/* Sleeps for `ms`, and returns the interrupts per second received while idle.
+ * Also returns the percentage of the time that was spent idle. */
+static uint32_t idle_bench_run(uint32_t ms, bool tickless, uint32_t* idle_pct) {
+    mt_set_tickless(tickless);
+
+    const uint32_t old_wakeups = mt_get_idle_wakeups();
+    const uint64_t old_ticks   = mt_get_idle_ticks();
+
+    /* Blocks this task, so the idle task runs */
+    sleep_ms(ms);
+
+    const uint32_t wakeups = mt_get_idle_wakeups() - old_wakeups;
+    const uint64_t ticks   = mt_get_idle_ticks() - old_ticks;
+
+    *idle_pct = ticks * 100 / ms;
+    return (ticks > 0) ? (uint64_t)wakeups * 1000 / ticks : 0;
+}
+
+static int cmd_idle_bench(int argc, char** argv) {
+    uint32_t ms = IDLE_BENCH_DEFAULT;
+
+    if (argc > 1) {
+        const int arg = atoi(argv[1]);
+        if (!strcmp(argv[1], "-h") || !strcmp(argv[1], "--help") || arg < 1) {
+            printf("Usage:\n"
+                   "\t%s [ms]  - Duration of each test (default %d)\n",
+                   argv[0], IDLE_BENCH_DEFAULT);
+            return 1;
+        }
+
+        ms = arg;
+    }
+
+    const bool old_tickless = mt_get_tickless();
+
+    uint32_t periodic_pct, tickless_pct;
+    const uint32_t periodic = idle_bench_run(ms, false, &periodic_pct);
+    const uint32_t tickless = idle_bench_run(ms, true, &tickless_pct);
+
+    mt_set_tickless(old_tickless);
+
+    TEST_TITLE("Sleeping for %ldms", ms);
+    printf("Periodic ticks: %ld irq/s while idle (%ld%% idle)\n", periodic,
+           periodic_pct);
+    printf("Tickless:       %ld irq/s while idle (%ld%% idle)\n", tickless,
+           tickless_pct);
+
+    return 0;
+}
+
+#define MEM_BENCH_DEFAULT 64 /* MiB */
+#define MEM_BENCH_MAX_SZ  (4 * 1024 * 1024)
+
+typedef void* (*memcpy_func)(void* restrict, const void* restrict, size_t);
+typedef void* (*memset_func)(void*, int, size_t);
+
+/* Prints the GB/s of `total` bytes copied in blocks of `sz`. Bytes per
+ * nanosecond is GB/s. */
+static void mem_bench_cpy(memcpy_func func, uint8_t* dst, uint8_t* src,
+                          uint32_t sz, uint64_t total) {
+    if (func == NULL) {
+        printf("%10s", "-");
+        return;
+    }
+
+    const uint32_t iters = (total / sz > 0) ? total / sz : 1;
+
+    const uint64_t start = clock_ns();
+    for (uint32_t i = 0; i < iters; i++)
+        func(dst, src, sz);
+    const uint64_t ns = clock_ns() - start;
+
+    printf("%10.2f", (ns == 0) ? 0 : (double)iters * sz / ns);
+}
+
+/* Prints the GB/s of `total` bytes filled in blocks of `sz` */
+static void mem_bench_set(memset_func func, uint8_t* dst, uint32_t sz,
+                          uint64_t total) {
+    if (func == NULL) {
+        printf("%10s", "-");
+        return;
+    }
+
+    const uint32_t iters = (total / sz > 0) ? total / sz : 1;
+
+    const uint64_t start = clock_ns();
+    for (uint32_t i = 0; i < iters; i++)
+        func(dst, i, sz);
+    const uint64_t ns = clock_ns() - start;
+
+    printf("%10.2f", (ns == 0) ? 0 : (double)iters * sz / ns);
+}
+
+static int cmd_mem_bench(int argc, char** argv) {
+    uint32_t mib = MEM_BENCH_DEFAULT;
+
+    if (argc > 1) {
+        const int arg = atoi(argv[1]);
+        if (!strcmp(argv[1], "-h") || !strcmp(argv[1], "--help") || arg < 1) {
+            printf("Usage:\n"
+                   "\t%s [MiB]  - Bytes to move in each test (default %d)\n",
+                   argv[0], MEM_BENCH_DEFAULT);
+            return 1;
+        }
+
+        mib = arg;
+    }
+
+    /* NULL if not supported, see src/libk/string.c */
+    memcpy_func cpy_sse2 = NULL;
+    memset_func set_sse2 = NULL;
+#ifdef ENABLE_SSE
+    extern bool sse_supported; /* src/kernel/kernel.c */
+    if (sse_supported) {
+        cpy_sse2 = memcpy_sse2;
+        set_sse2 = memset_sse2;
+    }
+#endif
+
+    const uint32_t sizes[] = { 64, 512, 4096, 64 * 1024, 1024 * 1024,
+                               MEM_BENCH_MAX_SZ };
+    const uint64_t total   = (uint64_t)mib * 1024 * 1024;
+
+    /* One extra byte so we can also test unaligned copies */
+    uint8_t* src = malloc(MEM_BENCH_MAX_SZ + 1);
+    uint8_t* dst = malloc(MEM_BENCH_MAX_SZ + 1);
+    if (src == NULL || dst == NULL) {
+        printf("Could not allocate the buffers.\n");
+        free(src);
+        free(dst);
+        return 1;
+    }
+    memset(src, 0xAB, MEM_BENCH_MAX_SZ + 1);
+
+    TEST_TITLE("Moving %ldMiB in each test (GB/s)", mib);
+    printf("%10s%10s%10s%10s%10s%10s%10s\n", "Size", "cpy", "cpy rep",
+           "cpy sse2", "unaligned", "set rep", "set sse2");
+
+    for (size_t i = 0; i < LENGTH(sizes); i++) {
+        const uint32_t sz = sizes[i];
+
+        printf("%10ld", sz);
+        mem_bench_cpy(memcpy, dst, src, sz, total);
+        mem_bench_cpy(memcpy_rep, dst, src, sz, total);
+        mem_bench_cpy(cpy_sse2, dst, src, sz, total);
+        mem_bench_cpy(cpy_sse2, dst, src + 1, sz, total);
+        mem_bench_set(memset_rep, dst, sz, total);
+        mem_bench_set(set_sse2, dst, sz, total);
+        putchar('\n');
+    }
+
+    free(src);
+    free(dst);
+
+    fbc_setfore(COLOR_WHITE);
+    return 0;
+}
+
+#define STR_BENCH_DEFAULT 4096
+#define STR_BENCH_BYTES   (16 * 1024 * 1024)
+
+/* Same arguments for all the benchmarked functions: `a` and `b` are two equal
+ * strings that end with 'z' */
+typedef uintptr_t (*str_bench_func)(const char* a, const char* b);
+
+static uintptr_t sb_strlen(const char* a, const char* b) {
+    (void)b;
+    return strlen(a);
+}
+
+static uintptr_t sb_ref_strlen(const char* a, const char* b) {
+    (void)b;
+    return str_ref_strlen(a);
+}
+
+static uintptr_t sb_strchr(const char* a, const char* b) {
+    (void)b;
+    return (uintptr_t)strchr(a, 'z');
+}
+
+static uintptr_t sb_ref_strchr(const char* a, const char* b) {
+    (void)b;
+    return (uintptr_t)str_ref_strchr(a, 'z');
+}
+
+static uintptr_t sb_strcmp(const char* a, const char* b) {
+    return strcmp(a, b);
+}
+
+static uintptr_t sb_ref_strcmp(const char* a, const char* b) {
+    return str_ref_strcmp(a, b);
+}
+
+/* Returns the nanoseconds per call */
+static double str_bench_run(str_bench_func func, const char* a, const char* b,
+                            uint32_t iters) {
+    const uint64_t start = clock_ns();
+    for (uint32_t i = 0; i < iters; i++)
+        func(a, b);
+    const uint64_t ns = clock_ns() - start;
+
+    return (double)ns / iters;
+}
+
+static int cmd_str_bench(int argc, char** argv) {
+    uint32_t len = STR_BENCH_DEFAULT;
+
+    if (argc > 1) {
+        const int arg = atoi(argv[1]);
+        if (!strcmp(argv[1], "-h") || !strcmp(argv[1], "--help") || arg < 1) {
+            printf("Usage:\n"
+                   "\t%s [len]  - Length of the strings (default %d)\n",
+                   argv[0], STR_BENCH_DEFAULT);
+            return 1;
+        }
+
+        len = arg;
+    }
+
+    char* a = malloc(len + 1);
+    char* b = malloc(len + 1);
+    if (a == NULL || b == NULL) {
+        printf("Could not allocate the strings.\n");
+        free(a);
+        free(b);
+        return 1;
+    }
+
+    /* The last char is the only one that strchr will find */
+    memset(a, 'a', len);
+    a[len - 1] = 'z';
+    a[len]     = '\0';
+    memcpy(b, a, len + 1);
+
+    const uint32_t iters = (STR_BENCH_BYTES / len > 0) ? STR_BENCH_BYTES / len
+                                                       : 1;
+
+    TEST_TITLE("Strings of %ld bytes (ns per call)", len);
+    printf("%10s%12s%12s%10s\n", "Function", "libk", "byte loop", "Speedup");
+
+    const struct {
+        const char* name;
+        str_bench_func libk;
+        str_bench_func ref;
+    } funcs[] = {
+        { "strlen", sb_strlen, sb_ref_strlen },
+        { "strchr", sb_strchr, sb_ref_strchr },
+        { "strcmp", sb_strcmp, sb_ref_strcmp },
+    };
+
+    for (size_t i = 0; i < LENGTH(funcs); i++) {
+        const double libk = str_bench_run(funcs[i].libk, a, b, iters);
+        const double ref  = str_bench_run(funcs[i].ref, a, b, iters);
+
+        printf("%10s%12.1f%12.1f%9.1fx\n", funcs[i].name, libk, ref,
+               (libk > 0) ? ref / libk : 0);
+    }
+
+    free(a);
+    free(b);
+
+    fbc_setfore(COLOR_WHITE);
+    return 0;
+}
+
 static int cmd_kernel_map() {
     /* Symbols from cfg/linker.ld */
     extern uint8_t _text_start;
@@ -1,10 +1,12 @@
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <stddef.h>
 #include <stdbool.h>
 #include <string.h>
 
-#include <kernel/color.h> /* color palette */
+#include <kernel/color.h>     /* color palette */
+#include <kernel/multitask.h> /* mt_newtask */
 
 #include "sh.h"
 #include "commands.h"
@@ -14,6 +16,65 @@
 
 #define LENGTH(arr) (sizeof(arr) / sizeof(arr[0]))
 
+/**
+ * @brief Command running in its own task. See start_job()
+ */
+typedef struct {
+    /** @brief Copy of the command, the arguments point here */
+    char cmd[MAX_CMD_SZ];
+
+    /** @brief Arguments of the command, NULL terminated */
+    char* argv[MAX_ARGC];
+
+    /** @brief Number of arguments */
+    int argc;
+
+    /** @brief Function of the command, from cmd_list */
+    int (*func)(int argc, char** argv);
+} Job;
+
+/**
+ * @brief Entry point of the tasks created by start_job()
+ * @details The task ends when this function returns.
+ */
+static void job_entry(void) {
+    Job* job = mt_gettask()->data;
+
+    job->func(job->argc, job->argv);
+
+    free(job);
+}
+
+/**
+ * @brief Run a command in a new task, so the shell doesn't wait for it.
+ * @param[in] cmd Command with the words separated by null terminators.
+ * @param[in] argv Arguments pointing inside `cmd`.
+ * @param[in] argc Number of arguments.
+ * @param[in] command Entry of cmd_list for the command.
+ */
+static void start_job(const char* cmd, char** argv, int argc,
+                      const Command* command) {
+    Job* job = malloc(sizeof(Job));
+
+    /* The arguments point to the shell's buffer, which will be overwritten by
+     * the next command */
+    memcpy(job->cmd, cmd, MAX_CMD_SZ);
+    for (int i = 0; i < argc; i++)
+        job->argv[i] = &job->cmd[argv[i] - cmd];
+    job->argv[argc] = NULL;
+
+    job->argc = argc;
+    job->func = command->func;
+
+    /* Don't let the task run before we set its data */
+    mt_preempt_disable();
+    Ctx* task  = mt_newtask(command->cmd, job_entry);
+    task->data = job;
+    mt_preempt_enable();
+
+    printf("[%p] %s\n", task, command->cmd);
+}
+
 int sh_main(void) {
     int c = 0;
 
@@ -31,28 +92,30 @@ int sh_main(void) {
             cur_cmd[cmd_pos++] = c;
         cur_cmd[cmd_pos] = '\0';
 
-        /* For checking each word of the argv arr. Start as true to store the
-         * first arg (program name) */
-        bool was_space = true;
-
-        /* Fill the argv array */
-        for (cmd_pos = 0, argc = 0;
-             cur_cmd[cmd_pos] != '\0' && argc < MAX_ARGC - 1; cmd_pos++) {
-            if (cur_cmd[cmd_pos] == ' ') {
-                /* First space after a word, set to null */
-                if (!was_space)
-                    cur_cmd[cmd_pos] = '\0';
-
-                was_space = true;
-            } else if (was_space) {
-                /* First non-space after spaces, start of word */
-                argv[argc++] = &cur_cmd[cmd_pos];
-                was_space    = false;
-            }
-        }
+        /* Fill the argv array. The spaces after each word are replaced with
+         * null terminators, so the arguments point inside cur_cmd. Reentrant
+         * version, since background jobs might also use strtok. */
+        char* saveptr = NULL;
+        argc          = 0;
+        for (char* word = strtok_r(cur_cmd, " ", &saveptr);
+             word != NULL && argc < MAX_ARGC - 1;
+             word = strtok_r(NULL, " ", &saveptr))
+            argv[argc++] = word;
+
         /* Last item of argv is 0 */
         argv[argc] = NULL;
 
+        /* Empty command */
+        if (argc == 0)
+            continue;
+
+        /* If the last argument is "&", run the command in the background */
+        bool background = false;
+        if (argc > 1 && strcmp(argv[argc - 1], "&") == 0) {
+            argv[--argc] = NULL;
+            background   = true;
+        }
+
 #ifdef ARG_DEBUG
         printf("[dbg] argc: %d\n", argc);
         printf("[dbg] argv: [ ");
@@ -65,15 +128,21 @@ int sh_main(void) {
         bool valid_cmd = false;
         for (size_t i = 0; i < LENGTH(cmd_list); i++) {
             if (strcmp(argv[0], cmd_list[i].cmd) == 0) {
-                /* Call the function with the args and store the return value */
-                last_ret  = (*cmd_list[i].func)(argc, argv);
                 valid_cmd = true;
+
+                if (background) {
+                    start_job(cur_cmd, argv, argc, &cmd_list[i]);
+                    break;
+                }
+
+                /* Call the function with the args and store the return value */
+                last_ret = (*cmd_list[i].func)(argc, argv);
                 break;
             }
         }
 
         /* If none of the cmds of cmd_list were valid, error */
-        if (!valid_cmd && cur_cmd[0] != '\0')
+        if (!valid_cmd)
             cmd_unk();
     }
 
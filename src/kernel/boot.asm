@@ -7,6 +7,11 @@ MB_ALIGN    equ 1 << 0      ; Align loaded modules on page boundaries
 MB_MEMINFO  equ 1 << 1      ; Provide memory map
 MB_GFX      equ 1 << 2      ; Use GFX (For the framebuffer, see below)
 
+; Bits per pixel we ask the bootloader for. See FB_DEPTH in config.mk
+%ifndef FB_DEPTH
+%define FB_DEPTH 32
+%endif
+
 ; Multiboot flag field
 MB_FLAGS    equ MB_ALIGN | MB_MEMINFO | MB_GFX
 
@@ -33,7 +38,7 @@ section .multiboot
     dd      0x00000000      ; (graphics) requested mode_type (See last comment)
     dd      0x00000000      ; (graphics) width
     dd      0x00000000      ; (graphics) height
-    dd      32              ; (graphics) depth
+    dd      FB_DEPTH        ; (graphics) depth
 
 ; Allocate 16KiB for the main kernel stack, add labels to indicate where it
 ; starts and ends. The stack must be 16 byte aligned acording to the System V
@@ -58,6 +63,8 @@ section .text
     extern msr_supported                ; src/kernel/kernel.c
     extern is_tsc_supported             ; src/kernel/util.asm
     extern tsc_supported                ; src/kernel/kernel.c
+    extern is_pse_supported             ; src/kernel/util.asm
+    extern pse_supported                ; src/kernel/kernel.c
 
 global _start:function
 _start:
@@ -92,6 +99,16 @@ _start:
     mov     cr4, eax
 %endif ; ENABLE_SSE
 
+%ifdef ENABLE_PSE
+    ; CR4.PSE is set by paging_init if the CPU supports it
+    call    is_pse_supported            ; Defined in util.asm
+    test    eax, eax
+    jnz     .pse_checked                ; Returned true
+    mov     [pse_supported], byte 0     ; Returned 0, set to var false
+
+.pse_checked:
+%endif ; ENABLE_PSE
+
 %ifdef DEBUG
     call    is_msr_supported            ; Defined in util.asm
     test    eax, eax
@@ -0,0 +1,63 @@
+/**
+ * @brief Timestamps of the initialization stages of kernel_main().
+ *
+ * @file
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <kernel/boot_trace.h>
+#include <kernel/clock.h>
+#include <kernel/util.h> /* is_tsc_supported */
+
+/** @brief Name and end of each stage */
+static struct {
+    const char* name;
+    uint64_t end;
+} stages[BOOT_TRACE_MAX];
+
+static uint32_t stage_count = 0;
+
+/** @brief TSC value when boot_trace_start() was called */
+static uint64_t trace_start = 0;
+
+/** @brief False if the CPU has no TSC, see boot_trace_start() */
+static bool enabled = false;
+
+/*----------------------------------------------------------------------------*/
+
+void boot_trace_start(void) {
+    stage_count = 0;
+    enabled     = is_tsc_supported();
+
+    if (enabled)
+        trace_start = rdtsc();
+}
+
+void boot_trace_mark(const char* name) {
+    if (!enabled || stage_count >= BOOT_TRACE_MAX)
+        return;
+
+    stages[stage_count].name = name;
+    stages[stage_count].end  = rdtsc();
+    stage_count++;
+}
+
+uint32_t boot_trace_count(void) {
+    return stage_count;
+}
+
+const char* boot_trace_name(uint32_t idx) {
+    return (idx < stage_count) ? stages[idx].name : NULL;
+}
+
+uint64_t boot_trace_ns(uint32_t idx) {
+    /* Without a TSC, the clocksource is the PIT, and we didn't record anything
+     * anyway */
+    if (idx >= stage_count || !clock_is_tsc())
+        return 0;
+
+    const uint64_t start = (idx == 0) ? trace_start : stages[idx - 1].end;
+    return clock_cycles_to_ns(stages[idx].end - start);
+}
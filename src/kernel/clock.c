@@ -0,0 +1,115 @@
+/**
+ * @brief High resolution clocksource using the TSC, calibrated with the PIT.
+ *
+ * See Intel SDM Vol. 3, Chapter 17.17 (Time-Stamp Counter) and:
+ * https://wiki.osdev.org/TSC
+ *
+ * @file
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <kernel/clock.h>
+#include <kernel/pit.h>
+#include <kernel/pcspkr.h> /* PCSPKR_PORT */
+#include <kernel/io.h>
+#include <kernel/idt.h> /* irq_save, irq_restore */
+#include <kernel/util.h>
+
+/** @brief Bit of PCSPKR_PORT that enables the gate of PIT channel 2 */
+#define CH2_GATE 0x01
+
+/** @brief Bit of PCSPKR_PORT that connects PIT channel 2 to the speaker */
+#define CH2_SPEAKER 0x02
+
+/** @brief Bit of PCSPKR_PORT with the OUT pin of PIT channel 2 */
+#define CH2_OUT 0x20
+
+/** @brief True if we are using the TSC, false if we fell back to the PIT */
+static bool use_tsc = false;
+
+/** @brief Cycles per second of clock_cycles() */
+static uint64_t freq = PIT_BASE_FREQ;
+
+/*----------------------------------------------------------------------------*/
+
+/**
+ * @brief Count the TSC cycles of a CLOCK_CALIBRATE_MS one-shot of PIT channel
+ * 2.
+ * @details Channel 2 can be polled through PCSPKR_PORT without interrupts, and
+ * channel 0 keeps running normally.
+ */
+static uint64_t calibrate_once(void) {
+    const uint16_t count = PIT_BASE_FREQ / 1000 * CLOCK_CALIBRATE_MS;
+
+    const uint32_t eflags     = irq_save();
+    const uint32_t tick_start = pit_lost_ticks_start();
+
+    /* Enable the gate of channel 2, but keep the speaker disconnected */
+    const uint8_t old_port = io_inb(PCSPKR_PORT);
+    io_outb(PCSPKR_PORT, (old_port & ~CH2_SPEAKER) | CH2_GATE);
+
+    /* The count starts once we write the high byte */
+    io_outb(PIT_CHANNEL_CMD, PIT_FLAG_CHANNEL_2 | PIT_FLAG_ACCESS_LOHI |
+                               PIT_FLAG_MODE_INT | PIT_FLAG_BINARY_OFF);
+    io_outb(PIT_CHANNEL_2, (uint8_t)(count & 0xFF));
+    io_outb(PIT_CHANNEL_2, (uint8_t)((count & 0xFF00) >> 8));
+
+    const uint64_t start = rdtsc();
+    while (!(io_inb(PCSPKR_PORT) & CH2_OUT))
+        ;
+    const uint64_t end = rdtsc();
+
+    io_outb(PCSPKR_PORT, old_port);
+
+    /* The PIT interrupt couldn't count the ticks of the measurement */
+    pit_add_lost_ticks(tick_start, count);
+    irq_restore(eflags);
+
+    /* Scale to a second, using the exact count we used */
+    return (end - start) * PIT_BASE_FREQ / count;
+}
+
+/*----------------------------------------------------------------------------*/
+
+void clock_init(void) {
+    use_tsc = false;
+    freq    = PIT_BASE_FREQ;
+
+    if (!is_tsc_supported())
+        return;
+
+    uint64_t best = 0;
+    for (int i = 0; i < CLOCK_CALIBRATE_TRIES; i++) {
+        const uint64_t cur = calibrate_once();
+        if (best == 0 || cur < best)
+            best = cur;
+    }
+
+    /* Something went wrong, keep using the PIT */
+    if (best < PIT_BASE_FREQ)
+        return;
+
+    use_tsc = true;
+    freq    = best;
+}
+
+bool clock_is_tsc(void) {
+    return use_tsc;
+}
+
+uint64_t clock_get_freq(void) {
+    return freq;
+}
+
+uint64_t clock_cycles(void) {
+    return use_tsc ? rdtsc() : pit_get_cycles();
+}
+
+uint64_t clock_cycles_to_ns(uint64_t cycles) {
+    /* Split it so (cycles * 1e9) doesn't overflow */
+    const uint64_t sec = cycles / freq;
+    const uint64_t rem = cycles % freq;
+
+    return sec * 1000000000ULL + rem * 1000000000ULL / freq;
+}
@@ -0,0 +1,29 @@
+/**
+ * @brief Expanded rows of the font bitmaps, for drawing the glyphs without
+ * checking each bit.
+ *
+ * @file
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <kernel/font.h>
+
+uint32_t font_row_masks[256][FONT_MAX_W];
+
+static bool initialized = false;
+
+/*----------------------------------------------------------------------------*/
+
+void font_init(void) {
+    if (initialized)
+        return;
+
+    /* Each row of a glyph is a byte, with the first pixel in the highest bit.
+     * See get_font_bit(). */
+    for (uint32_t row = 0; row < 256; row++)
+        for (uint32_t x = 0; x < FONT_MAX_W; x++)
+            font_row_masks[row][x] = (row & (0x80 >> x)) ? 0xFFFFFFFF : 0;
+
+    initialized = true;
+}
@@ -0,0 +1,224 @@
+/**
+ * @brief Physical frame allocator.
+ *
+ * Each bit of the bitmap represents a 4KiB frame of the 32 bit physical address
+ * space. A set bit means the frame is used or reserved.
+ *
+ * @file
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h> /* memset */
+#include <kernel/frame.h>
+#include <kernel/heap.h> /* HEAP_START, HEAP_SIZE */
+
+/** @brief Frame number of a physical address */
+#define ADDR_TO_FRAME(addr) ((uint32_t)(addr) / FRAME_SIZE)
+
+/** @brief Bits in each entry of the bitmap */
+#define WORD_BITS 32
+
+/** @brief Entries of the bitmap */
+#define BITMAP_WORDS (FRAME_COUNT / WORD_BITS)
+
+/* End of the kernel, declared in cfg/linker.ld */
+extern uint8_t _bss_end;
+
+/** @brief Bitmap of the used frames. 128KiB in .bss */
+static uint32_t bitmap[BITMAP_WORDS];
+
+/** @brief Number of free frames in the bitmap */
+static uint32_t free_frames = 0;
+
+/** @brief Number of frames in the available regions of the memory map */
+static uint32_t total_frames = 0;
+
+/** @brief Bitmap word where the last allocation was found. Searches start here
+ * so we don't scan the low (usually full) memory each time. */
+static uint32_t next_word = 0;
+
+/*----------------------------------------------------------------------------*/
+
+static inline bool is_used(uint32_t frame) {
+    return (bitmap[frame / WORD_BITS] >> (frame % WORD_BITS)) & 1;
+}
+
+/**
+ * @brief Mark `n` frames starting at `frame` as used or free.
+ * @details Only the frames that change state are counted in free_frames.
+ */
+static void set_range(uint32_t frame, uint32_t n, bool used) {
+    if (frame >= FRAME_COUNT)
+        return;
+
+    if (n > FRAME_COUNT - frame)
+        n = FRAME_COUNT - frame;
+
+    for (; n > 0; frame++, n--) {
+        const uint32_t mask = 1u << (frame % WORD_BITS);
+        uint32_t* word      = &bitmap[frame / WORD_BITS];
+
+        if (used && !(*word & mask)) {
+            *word |= mask;
+            free_frames--;
+        } else if (!used && (*word & mask)) {
+            *word &= ~mask;
+            free_frames++;
+        }
+    }
+}
+
+/**
+ * @brief Mark the frames of the [start, end) physical region as used.
+ * @details The start is aligned down and the end is aligned up, so partially
+ * used frames are reserved.
+ */
+static inline void reserve_region(uint64_t start, uint64_t end) {
+    const uint32_t first = start / FRAME_SIZE;
+    const uint64_t last  = (end + FRAME_SIZE - 1) / FRAME_SIZE;
+
+    if (last > first)
+        set_range(first, last - first, true);
+}
+
+/*----------------------------------------------------------------------------*/
+
+void frame_init(const Multiboot* mb_info) {
+    /* Everything is used until the bootloader tells us otherwise */
+    memset(bitmap, 0xFF, sizeof(bitmap));
+    free_frames  = 0;
+    total_frames = 0;
+    next_word    = 0;
+
+    if (mb_info->flags & MULTIBOOT_FLAG_MMAP) {
+        const uint32_t mmap_end = mb_info->mmap_addr + mb_info->mmap_length;
+
+        for (Multiboot_mmap* entry = (Multiboot_mmap*)mb_info->mmap_addr;
+             (uint32_t)entry < mmap_end;
+             entry = (Multiboot_mmap*)((uint32_t)entry + entry->size +
+                                       sizeof(entry->size))) {
+            if (entry->type != MULTIBOOT_MMAP_AVAILABLE)
+                continue;
+
+            /* Only use the full frames inside the region, and ignore anything
+             * above 4GiB */
+            uint64_t start = entry->addr;
+            uint64_t end   = entry->addr + entry->len;
+
+            if (start >= 0x100000000ULL)
+                continue;
+
+            if (end > 0x100000000ULL)
+                end = 0x100000000ULL;
+
+            const uint32_t first = (start + FRAME_SIZE - 1) / FRAME_SIZE;
+            const uint32_t last  = end / FRAME_SIZE;
+
+            if (last > first) {
+                set_range(first, last - first, false);
+                total_frames += last - first;
+            }
+        }
+    } else if (mb_info->flags & MULTIBOOT_FLAG_MEM) {
+        /* mem_upper is the KiB of memory starting at 1MiB */
+        const uint32_t first = ADDR_TO_FRAME(0x100000);
+        const uint32_t n     = mb_info->mem_upper / (FRAME_SIZE / 1024);
+
+        set_range(first, n, false);
+        total_frames = n;
+    }
+
+    /* Low memory (BIOS data, VGA memory, etc.) and the kernel itself, which
+     * starts at 1MiB. Also makes sure that frame 0 (FRAME_NONE) is never
+     * returned. */
+    reserve_region(0, (uint32_t)&_bss_end);
+
+    /* The heap is still a fixed region, see src/kernel/heap.c */
+    reserve_region((uint32_t)HEAP_START, (uint32_t)HEAP_START + HEAP_SIZE);
+
+    /* Multiboot information, in case the bootloader placed it above 1MiB */
+    reserve_region((uint32_t)mb_info, (uint32_t)mb_info + sizeof(Multiboot));
+    if (mb_info->flags & MULTIBOOT_FLAG_MMAP)
+        reserve_region(mb_info->mmap_addr,
+                       mb_info->mmap_addr + mb_info->mmap_length);
+}
+
+uint32_t frame_alloc(void) {
+    /* Start searching where the last allocation was, and wrap around */
+    for (uint32_t i = 0; i < BITMAP_WORDS; i++) {
+        const uint32_t w = (next_word + i) % BITMAP_WORDS;
+
+        /* All frames of this word are used */
+        if (bitmap[w] == 0xFFFFFFFF)
+            continue;
+
+        /* Index of the first clear bit */
+        const uint32_t frame = w * WORD_BITS + __builtin_ctz(~bitmap[w]);
+
+        set_range(frame, 1, true);
+        next_word = w;
+
+        return frame * FRAME_SIZE;
+    }
+
+    return FRAME_NONE;
+}
+
+uint32_t frame_alloc_contig(uint32_t n) {
+    if (n == 0)
+        return FRAME_NONE;
+
+    if (n == 1)
+        return frame_alloc();
+
+    /* Length of the current run of free frames, and where it started */
+    uint32_t run       = 0;
+    uint32_t run_start = 0;
+
+    for (uint32_t frame = 0; frame < FRAME_COUNT; frame++) {
+        /* Skip full words at once if we are not in a run */
+        if (run == 0 && frame % WORD_BITS == 0 &&
+            bitmap[frame / WORD_BITS] == 0xFFFFFFFF) {
+            frame += WORD_BITS - 1;
+            continue;
+        }
+
+        if (is_used(frame)) {
+            run = 0;
+            continue;
+        }
+
+        if (run == 0)
+            run_start = frame;
+
+        if (++run == n) {
+            set_range(run_start, n, true);
+            return run_start * FRAME_SIZE;
+        }
+    }
+
+    return FRAME_NONE;
+}
+
+void frame_free(uint32_t paddr, uint32_t n) {
+    const uint32_t frame = ADDR_TO_FRAME(paddr);
+
+    set_range(frame, n, false);
+
+    /* Make the next search start at the freed frames */
+    if (frame / WORD_BITS < next_word)
+        next_word = frame / WORD_BITS;
+}
+
+void frame_reserve(uint32_t paddr, uint32_t n) {
+    set_range(ADDR_TO_FRAME(paddr), n, true);
+}
+
+uint32_t frame_get_free(void) {
+    return free_frames;
+}
+
+uint32_t frame_get_total(void) {
+    return total_frames;
+}
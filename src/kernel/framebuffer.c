@@ -1,32 +1,247 @@
-
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h> /* calloc, malloc */
+#include <string.h> /* memcpy, memmove, memset32 */
 #include <kernel/framebuffer.h>
+#include <kernel/idt.h> /* irq_save, irq_restore */
+
+/* Address of the pixel at y, x of the framebuffer */
+#define PX_PTR(y, x) (&g_fb[(y)*g_pitch + (x)*g_bytespp])
 
-/* Framebuffer globals */
-static volatile uint32_t* g_fb;
+/* For writing 4 bytes of packed 24 bpp pixels, which are not aligned */
+typedef volatile uint32_t __attribute__((may_alias, aligned(1))) unaligned_u32;
+
+/* Framebuffer globals. The drawing functions use g_fb, g_pitch, g_bytespp and
+ * g_native, which are the ones of the shadow framebuffer while drawing to it,
+ * see fb_draw_to_shadow() */
+static volatile uint8_t* g_fb;
 static uint32_t g_pitch;
 static uint32_t g_width;
 static uint32_t g_height;
 static uint32_t g_bpp;
 
-void fb_init(volatile uint32_t* fb, uint32_t pitch, uint32_t w, uint32_t h,
-             uint32_t bpp) {
+/* Pixel format, and bytes of each pixel */
+static fb_format g_fmt;
+static uint32_t g_bytespp;
+
+/* True if the pixels are 32 bit 0xRRGGBB colors, so they don't need to be
+ * converted, see pack_col() */
+static bool g_native;
+
+/* Shadow framebuffer, allocated by the first fb_begin_frame() */
+static uint32_t* g_shadow = NULL;
+
+/* Values of the drawing globals for the screen, see fb_draw_to_shadow() */
+static struct {
+    volatile uint8_t* fb;
+    uint32_t pitch;
+    uint32_t bytespp;
+    bool native;
+} g_screen;
+
+/* Decoded GimpImage's, see image_cache_get() */
+static struct {
+    const GimpImage* img;
+    uint32_t* data;
+} g_image_cache[FB_IMAGE_CACHE_SZ];
+static uint32_t g_image_cache_next = 0;
+
+/*----------------------------------------------------------------------------*/
+
+/**
+ * @brief Convert a 32 bit 0xRRGGBB color to the pixel format of the
+ * framebuffer.
+ * @details Only the highest bits of each component are kept.
+ */
+static inline uint32_t pack_col(uint32_t col) {
+    if (g_native)
+        return col;
+
+    const uint32_t r = (col >> 16) & 0xFF;
+    const uint32_t g = (col >> 8) & 0xFF;
+    const uint32_t b = col & 0xFF;
+
+    return ((r >> (8 - g_fmt.r_size)) << g_fmt.r_pos) |
+           ((g >> (8 - g_fmt.g_size)) << g_fmt.g_pos) |
+           ((b >> (8 - g_fmt.b_size)) << g_fmt.b_pos);
+}
+
+/**
+ * @brief Write a pixel already in the format of the framebuffer.
+ */
+static inline void put_px(volatile uint8_t* p, uint32_t px) {
+    switch (g_bytespp) {
+        case 4:
+            *(volatile uint32_t*)p = px;
+            break;
+        case 3:
+            p[0] = px & 0xFF;
+            p[1] = (px >> 8) & 0xFF;
+            p[2] = (px >> 16) & 0xFF;
+            break;
+        case 2:
+            *(volatile uint16_t*)p = px;
+            break;
+    }
+}
+
+/**
+ * @brief Fill `n` pixels of a row with a pixel in the framebuffer format.
+ * @details Uses memset32() for 32 bpp, and writes a dword at a time for the
+ * packed formats.
+ */
+static void fill_span(volatile uint8_t* p, uint32_t px, uint32_t n) {
+    switch (g_bytespp) {
+        case 4:
+            /* For big rows, memset32 uses SSE2 (see memset32_sse2) */
+            memset32((void*)p, px, n);
+            break;
+        case 3: {
+            /* Groups of 4 pixels fill 3 dwords */
+            const uint32_t d0 = px | (px << 24);
+            const uint32_t d1 = (px >> 8) | (px << 16);
+            const uint32_t d2 = (px >> 16) | (px << 8);
+
+            for (; n >= 4; n -= 4, p += 12) {
+                ((unaligned_u32*)p)[0] = d0;
+                ((unaligned_u32*)p)[1] = d1;
+                ((unaligned_u32*)p)[2] = d2;
+            }
+
+            for (; n > 0; n--, p += 3)
+                put_px(p, px);
+        } break;
+        case 2:
+            /* Align to a dword, and fill 2 pixels at a time */
+            if (n > 0 && ((uint32_t)p & 2)) {
+                put_px(p, px);
+                p += 2;
+                n--;
+            }
+
+            memset32((void*)p, px | (px << 16), n / 2);
+
+            if (n % 2 != 0)
+                put_px(p + (n - 1) * 2, px);
+            break;
+    }
+}
+
+/**
+ * @brief Write `n` 0xRRGGBB colors to a row, converting them to the format of
+ * the framebuffer.
+ * @details The packed formats are written a dword at a time.
+ */
+static void copy_span(volatile uint8_t* p, const uint32_t* src, uint32_t n) {
+    switch (g_bytespp) {
+        case 4:
+            /* Only used for formats other than 0xRRGGBB, see fb_blit() */
+            for (uint32_t i = 0; i < n; i++)
+                ((volatile uint32_t*)p)[i] = pack_col(src[i]);
+            break;
+        case 3:
+            for (; n >= 4; n -= 4, p += 12, src += 4) {
+                const uint32_t p0 = pack_col(src[0]);
+                const uint32_t p1 = pack_col(src[1]);
+                const uint32_t p2 = pack_col(src[2]);
+                const uint32_t p3 = pack_col(src[3]);
+
+                ((unaligned_u32*)p)[0] = p0 | (p1 << 24);
+                ((unaligned_u32*)p)[1] = (p1 >> 8) | (p2 << 16);
+                ((unaligned_u32*)p)[2] = (p2 >> 16) | (p3 << 8);
+            }
+
+            for (; n > 0; n--, p += 3)
+                put_px(p, pack_col(*src++));
+            break;
+        case 2:
+            if (n > 0 && ((uint32_t)p & 2)) {
+                put_px(p, pack_col(*src++));
+                p += 2;
+                n--;
+            }
+
+            for (; n >= 2; n -= 2, p += 4, src += 2)
+                *(volatile uint32_t*)p =
+                  pack_col(src[0]) | (pack_col(src[1]) << 16);
+
+            if (n > 0)
+                put_px(p, pack_col(*src));
+            break;
+    }
+}
+
+/**
+ * @brief Get the 0xRRGGBB pixels of a GimpImage, decoding it the first time.
+ * @details The images are cached by pointer, since they are static arrays that
+ * don't change. Once the cache is full, the oldest image is replaced.
+ * @return Decoded pixels, or NULL if they couldn't be allocated.
+ */
+static const uint32_t* image_cache_get(const GimpImage* img) {
+    for (uint32_t i = 0; i < FB_IMAGE_CACHE_SZ; i++)
+        if (g_image_cache[i].img == img)
+            return g_image_cache[i].data;
+
+    uint32_t* data = malloc(img->h * img->w * sizeof(uint32_t));
+    if (data == NULL)
+        return NULL;
+
+    const char* gimp_data = img->data;
+    uint8_t rgb[3];
+
+    for (uint32_t i = 0; i < img->h * img->w; i++) {
+        GIMP_GET_PIXEL(gimp_data, rgb);
+        data[i] = rgb2col(rgb[0], rgb[1], rgb[2]);
+    }
+
+    const uint32_t idx = g_image_cache_next;
+    g_image_cache_next = (g_image_cache_next + 1) % FB_IMAGE_CACHE_SZ;
+
+    free(g_image_cache[idx].data);
+    g_image_cache[idx].img  = img;
+    g_image_cache[idx].data = data;
+
+    return data;
+}
+
+/*----------------------------------------------------------------------------*/
+
+bool fb_init(volatile void* fb, uint32_t pitch, uint32_t w, uint32_t h,
+             const fb_format* fmt) {
     /* Set globals to the parameter values we received from main (multiboot
      * info) */
     g_fb     = fb;
     g_pitch  = pitch;
     g_width  = w;
     g_height = h;
-    g_bpp    = bpp;
+    g_bpp    = fmt->bpp;
+    g_fmt    = *fmt;
 
-    for (uint32_t y = 0; y < h; y++) {
-        for (uint32_t x = 0; x < w; x++) {
-            g_fb[y * w + x] = 0x000000;
-        }
-    }
+    /* 15 bpp modes also use 2 bytes */
+    g_bytespp = (g_bpp + 7) / 8;
+    if (g_bytespp < 2 || g_bytespp > 4)
+        return false;
+
+    g_native = g_bytespp == 4 && fmt->r_pos == 16 && fmt->g_pos == 8 &&
+               fmt->b_pos == 0 && fmt->r_size == 8 && fmt->g_size == 8 &&
+               fmt->b_size == 8;
+
+    /* For drawing to the screen again, see fb_draw_to_shadow() */
+    g_screen.fb      = g_fb;
+    g_screen.pitch   = g_pitch;
+    g_screen.bytespp = g_bytespp;
+    g_screen.native  = g_native;
+
+    /* For drawing text, see get_font_row() */
+    font_init();
+
+    fb_drawrect_fast(0, 0, h, w, 0x000000);
+    return true;
 }
 
-volatile uint32_t* fb_get_ptr(void) {
-    return g_fb;
+volatile void* fb_get_ptr(void) {
+    return g_screen.fb;
 }
 
 uint32_t fb_get_width(void) {
@@ -37,11 +252,74 @@ uint32_t fb_get_height(void) {
     return g_height;
 }
 
+uint32_t fb_get_pitch(void) {
+    return g_screen.pitch;
+}
+
+uint32_t fb_get_bpp(void) {
+    return g_bpp;
+}
+
+uint32_t* fb_begin_frame(void) {
+    /* 0xRRGGBB colors, with fb_get_width() pixels per row. Kept for the next
+     * frames, so they only need to draw what changed. */
+    if (g_shadow == NULL)
+        g_shadow = calloc(g_width * g_height, sizeof(uint32_t));
+
+    return g_shadow;
+}
+
+void fb_present(void) {
+    fb_present_rect(0, 0, g_height, g_width);
+}
+
+void fb_present_rect(uint32_t y, uint32_t x, uint32_t h, uint32_t w) {
+    if (g_shadow == NULL || y >= g_height || x >= g_width)
+        return;
+
+    /* Don't copy outside of the screen */
+    if (h > g_height - y)
+        h = g_height - y;
+
+    if (w > g_width - x)
+        w = g_width - x;
+
+    /* Only writes to the framebuffer */
+    const bool was_shadow = fb_draw_to_shadow(false);
+    fb_blit(y, x, h, w, &g_shadow[y * g_width + x], g_width * sizeof(uint32_t));
+    fb_draw_to_shadow(was_shadow);
+}
+
+bool fb_draw_to_shadow(bool enabled) {
+    if (enabled)
+        fb_begin_frame();
+
+    /* The keyboard handler can also draw, see fbc_putchar() */
+    const uint32_t eflags = irq_save();
+    const bool was_shadow = g_fb != g_screen.fb;
+
+    if (enabled) {
+        /* Same format as the 0xRRGGBB colors we draw, see pack_col() */
+        g_fb      = (volatile uint8_t*)g_shadow;
+        g_pitch   = g_width * sizeof(uint32_t);
+        g_bytespp = sizeof(uint32_t);
+        g_native  = true;
+    } else {
+        g_fb      = g_screen.fb;
+        g_pitch   = g_screen.pitch;
+        g_bytespp = g_screen.bytespp;
+        g_native  = g_screen.native;
+    }
+
+    irq_restore(eflags);
+    return was_shadow;
+}
+
 void fb_setpx_col(uint32_t y, uint32_t x, uint32_t col) {
     if (y >= g_height || x >= g_width)
         return;
 
-    g_fb[y * g_width + x] = col;
+    put_px(PX_PTR(y, x), pack_col(col));
 }
 
 void fb_drawrect_col(uint32_t y, uint32_t x, uint32_t h, uint32_t w,
@@ -59,67 +337,105 @@ void fb_drawrect_col(uint32_t y, uint32_t x, uint32_t h, uint32_t w,
     if (final_x >= g_width)
         final_x = g_width - 1;
 
-    for (uint32_t cur_y = y; cur_y < final_y; cur_y++)
-        for (uint32_t cur_x = x; cur_x < final_x; cur_x++)
-            g_fb[cur_y * g_width + cur_x] = col;
+    fb_drawrect_fast(y, x, final_y - y, final_x - x, col);
 }
 
 void fb_drawrect_fast(uint32_t y, uint32_t x, uint32_t h, uint32_t w,
                       uint32_t col) {
+    const uint32_t px = pack_col(col);
+
+    /* Rows of the whole width are contiguous if the rows have no padding, fill
+     * them at once */
+    if (x == 0 && w == g_width && g_pitch == w * g_bytespp) {
+        fill_span(PX_PTR(y, 0), px, h * w);
+        return;
+    }
+
     for (uint32_t cur_y = y; cur_y < y + h; cur_y++)
-        for (uint32_t cur_x = x; cur_x < x + w; cur_x++)
-            g_fb[cur_y * g_width + cur_x] = col;
+        fill_span(PX_PTR(cur_y, x), px, w);
 }
 
-void fb_drawtext(uint32_t y, uint32_t x, color_pair cols, Font* font,
-                 const char* s) {
-    const uint32_t fb_w = fb_get_width();
+void fb_blit(uint32_t y, uint32_t x, uint32_t h, uint32_t w,
+             const uint32_t* src, uint32_t src_pitch) {
+    const uint8_t* src_row = (const uint8_t*)src;
 
-    /* Iterate chars of string */
-    for (; *s != '\0'; s++, x += font->w) {
-        /* Then iterate each pixel that forms the font char */
-        for (uint8_t fy = 0; fy < font->h; fy++) {
-            for (uint8_t fx = 0; fx < font->w; fx++) {
-                /* Screen coordinates of current pixel offset  */
-                const uint32_t final_y = y + fy;
-                const uint32_t final_x = x + fx;
-
-                /* Depending on the font, set background or foreground */
-                g_fb[final_y * fb_w + final_x] =
-                  get_font_bit(font, *s, fy, fx) ? cols.fg : cols.bg;
-            }
+    for (uint32_t cur_y = y; cur_y < y + h; cur_y++, src_row += src_pitch) {
+        /* Same format, for big rows memcpy uses SSE2 (see memcpy_sse2) */
+        if (g_native)
+            memcpy((void*)PX_PTR(cur_y, x), src_row, w * sizeof(uint32_t));
+        else
+            copy_span(PX_PTR(cur_y, x), (const uint32_t*)src_row, w);
+    }
+}
+
+void fb_copy_rect(uint32_t dst_y, uint32_t dst_x, uint32_t src_y,
+                  uint32_t src_x, uint32_t h, uint32_t w) {
+    const uint32_t row_sz = w * g_bytespp;
+
+    /* From the top, so each row is read before we overwrite it. Doesn't need
+     * to know the format, the bytes are the same. */
+    for (uint32_t i = 0; i < h; i++)
+        memmove((void*)PX_PTR(dst_y + i, dst_x),
+                (const void*)PX_PTR(src_y + i, src_x), row_sz);
+}
+
+void fb_drawchar(uint32_t y, uint32_t x, const Font* font, uint8_t c,
+                 uint32_t fg, uint32_t bg) {
+    /* Convert the colors once. Each pixel is the background, or the foreground
+     * if the mask of the row is set. */
+    const uint32_t px_bg = pack_col(bg);
+    const uint32_t diff  = pack_col(fg) ^ px_bg;
+
+    volatile uint8_t* row = PX_PTR(y, x);
+
+    for (uint8_t fy = 0; fy < font->h; fy++, row += g_pitch) {
+        const uint32_t* mask = get_font_row(font, c, fy);
+
+        switch (g_bytespp) {
+            case 4:
+                for (uint8_t fx = 0; fx < font->w; fx++)
+                    ((volatile uint32_t*)row)[fx] = px_bg ^ (diff & mask[fx]);
+                break;
+            case 2:
+                for (uint8_t fx = 0; fx < font->w; fx++)
+                    ((volatile uint16_t*)row)[fx] = px_bg ^ (diff & mask[fx]);
+                break;
+            default:
+                for (uint8_t fx = 0; fx < font->w; fx++)
+                    put_px(&row[fx * g_bytespp], px_bg ^ (diff & mask[fx]));
+                break;
         }
     }
 }
 
+void fb_drawtext(uint32_t y, uint32_t x, color_pair cols, Font* font,
+                 const char* s) {
+    /* Iterate chars of string */
+    for (; *s != '\0'; s++, x += font->w)
+        fb_drawchar(y, x, font, *s, cols.fg, cols.bg);
+}
+
 void fb_drawimage(uint32_t y, uint32_t x, const GimpImage* img) {
-    if (y >= g_height || x >= g_width)
+    const uint32_t* data = image_cache_get(img);
+    if (data == NULL)
         return;
 
-    uint32_t final_y = y + img->h;
-    uint32_t final_x = x + img->w;
+    const FbImage fb_img = {
+        .h    = img->h,
+        .w    = img->w,
+        .data = data,
+    };
 
-    /* Adjust final_y to not draw outside of the screen. If we exceed the
-     * height, we are not going to draw anything on the X coord. See loop
-     * contents for more info. */
-    if (final_y >= g_height)
-        final_y = g_height - 1;
-
-    const char* data = img->data;
-    uint8_t rgb[3];
+    fb_drawimage_fb(y, x, &fb_img);
+}
 
-    for (uint32_t cur_y = y; cur_y < final_y; cur_y++) {
-        for (uint32_t cur_x = x; cur_x < final_x; cur_x++) {
-            /* Need to call even if out of bounds because  */
-            GIMP_GET_PIXEL(data, rgb);
+void fb_drawimage_fb(uint32_t y, uint32_t x, const FbImage* img) {
+    if (y >= g_height || x >= g_width)
+        return;
 
-            /* Unlike with final_y, we need to check here instead of adjusting
-             * final_x because the macro needs to be called even when not
-             * drawing. */
-            if (cur_x >= g_width)
-                continue;
+    /* Don't draw outside of the screen */
+    const uint32_t h = (img->h < g_height - y) ? img->h : g_height - y;
+    const uint32_t w = (img->w < g_width - x) ? img->w : g_width - x;
 
-            g_fb[cur_y * g_width + cur_x] = rgb2col(rgb[0], rgb[1], rgb[2]);
-        }
-    }
+    fb_blit(y, x, h, w, img->data, img->w * sizeof(uint32_t));
 }
@@ -2,10 +2,15 @@
 #include <stdint.h>
 #include <stdbool.h>
 #include <stdlib.h>
+#include <time.h>   /* sleep_ms */
 #include <kernel/color.h>
 #include <kernel/vga.h> /* VGA_CONSOLE_ADDR */
 #include <kernel/framebuffer.h>
 #include <kernel/framebuffer_console.h>
+#include <kernel/multitask.h> /* mt_preempt_disable, mt_preempt_enable */
+#include <kernel/wait.h>
+#include <kernel/idt.h> /* irq_save, irq_restore */
+#include <kernel/pit.h> /* pit_get_ticks */
 
 /**
  * @brief Converts a char Y position in the fbc to a pixel position
@@ -26,6 +31,7 @@
  *   src/kernel/include/kernel/framebuffer_console.h
  * Properties:
  *   - fbc_entry* fbc
+ *   - uint32_t lines, head, view, hist
  *   - uint32_t y, x, h, w
  *   - uint32_t ch_h, ch_w
  *   - Font* font
@@ -35,8 +41,88 @@
 static fbc_ctx _first_ctx;
 static fbc_ctx* ctx = &_first_ctx;
 
+/*
+ * Range of columns of each row that changed since the last flush, [lo, hi).
+ * The row is clean if lo >= hi. Only used for the current context, since we
+ * flush before changing it. See fbc_flush().
+ */
+static uint16_t dirty_lo[FBC_MAX_ROWS];
+static uint16_t dirty_hi[FBC_MAX_ROWS];
+
+/* True if any row is dirty */
+static volatile bool any_dirty = false;
+
+/* Rows of chars that the next flush has to move up, see fbc_shift_rows() */
+static uint32_t pending_scroll = 0;
+
+/* True while fbc_flush_nolock() is drawing. If the keyboard handler scrolls in
+ * the middle, the rows we are drawing would be moved again by the next blit, so
+ * it marks everything as dirty instead, see fbc_shift_rows() */
+static volatile bool flushing = false;
+
+/* True if the view changed and the next flush has to draw the whole screen,
+ * see fbc_scroll_view() */
+static bool view_redraw = false;
+
+/* If false, scrolling draws every row again instead of moving the pixels. Only
+ * used for comparing them, see fbc_set_scroll_blit() */
+static bool scroll_blit = true;
+
+/* PIT tick of the last flush, for limiting the flushes on newlines */
+static uint64_t last_flush = 0;
+
+/* The flush task waits here while there is nothing to draw */
+static wait_queue flush_wq    = WAIT_QUEUE_INIT;
+static bool flush_task_started = false;
+
 /* -------------------------------------------------------------------------- */
 
+/**
+ * @brief Returns the entries of a row of the screen, for printing to it.
+ * @details The rows of the fbc array are a ring starting at ctx->head, so
+ * scrolling only needs to move the head. See fbc_shift_rows().
+ */
+static inline fbc_entry* get_row(uint32_t cy) {
+    return &ctx->fbc[((ctx->head + cy) % ctx->lines) * ctx->ch_w];
+}
+
+/**
+ * @brief Same as get_row(), but for the row that is drawn, which is older if
+ * we are viewing the scrollback.
+ */
+static inline fbc_entry* get_view_row(uint32_t cy) {
+    const uint32_t row = ctx->head + ctx->lines - ctx->view + cy;
+    return &ctx->fbc[(row % ctx->lines) * ctx->ch_w];
+}
+
+/**
+ * @brief Tell the flush task that there is something to draw.
+ * @details Should be called with interrupts disabled.
+ */
+static inline void request_flush(void) {
+    /* Wake it only for the first change since the last flush */
+    if (!any_dirty) {
+        any_dirty = true;
+        wq_wake_one(&flush_wq);
+    }
+}
+
+/**
+ * @brief Copy the rows [top, bottom) of the console from the shadow framebuffer
+ * to the screen, and stop drawing to the shadow framebuffer.
+ * @details The console is drawn to the shadow framebuffer, so scrolling doesn't
+ * read back from the screen, see blit_scroll().
+ * @param was_shadow Value returned by fb_draw_to_shadow() when we started
+ * drawing, in case we interrupted someone drawing to it.
+ */
+static void present_rows(uint32_t top, uint32_t bottom, bool was_shadow) {
+    if (top < bottom)
+        fb_present_rect(CHAR_Y_TO_PX(top), ctx->x,
+                        (bottom - top) * ctx->font->h, ctx->w);
+
+    fb_draw_to_shadow(was_shadow);
+}
+
 /**
  * @brief Refreshes the pixels on the screen corresponding to the specified fbc
  * character.
@@ -44,26 +130,227 @@ static fbc_ctx* ctx = &_first_ctx;
  */
 static inline void fbc_refresh_entry(uint32_t cy, uint32_t cx) {
     /* Get the current fbc_entry */
-    const fbc_entry cur_entry = ctx->fbc[cy * ctx->ch_w + cx];
-    volatile uint32_t* fb_ptr = fb_get_ptr();
-    const uint32_t fb_w       = fb_get_width();
-
-    /* Then iterate each pixel that forms the font char */
-    for (uint8_t fy = 0; fy < ctx->font->h; fy++) {
-        for (uint8_t fx = 0; fx < ctx->font->w; fx++) {
-            /* Get real screen position from the char offset on the screen and
-             * the pixel font offset on the char */
-            const uint32_t final_y = CHAR_Y_TO_PX(cy) + fy;
-            const uint32_t final_x = CHAR_X_TO_PX(cx) + fx;
-
-            /* We check if the current bit of the current column is 1.
-             * Depending on that, set it to foreground or background. For
-             * more information see: src/kernel/include/kernel/font.h */
-            fb_ptr[final_y * fb_w + final_x] =
-              (get_font_bit(ctx->font, cur_entry.c, fy, fx)) ? cur_entry.fg
-                                                             : cur_entry.bg;
+    const fbc_entry cur_entry = get_view_row(cy)[cx];
+
+    /* Get real screen position from the char offset on the screen */
+    fb_drawchar(CHAR_Y_TO_PX(cy), CHAR_X_TO_PX(cx), ctx->font, cur_entry.c,
+                cur_entry.fg, cur_entry.bg);
+}
+
+/**
+ * @brief Draw the columns [lo, hi) of a row of the fbc.
+ * @details Entries after the first '\0' are not part of the line, so we fill
+ * them with a rectangle instead.
+ */
+static void fbc_refresh_span(uint32_t cy, uint32_t lo, uint32_t hi) {
+    const fbc_entry* row = get_view_row(cy);
+
+    for (uint32_t cx = lo; cx < hi; cx++) {
+        const fbc_entry* entry = &row[cx];
+
+        if (entry->c == '\0') {
+            fb_drawrect_fast(CHAR_Y_TO_PX(cy), CHAR_X_TO_PX(cx), ctx->font->h,
+                             (hi - cx) * ctx->font->w, entry->bg);
+            break;
+        }
+
+        fbc_refresh_entry(cy, cx);
+    }
+}
+
+/**
+ * @brief Mark the columns [lo, hi) of a row as changed, so they are drawn on
+ * the next flush.
+ * @details Rows that don't fit in the dirty arrays are drawn immediately,
+ * unless we are viewing the scrollback.
+ */
+static void mark_dirty(uint32_t cy, uint32_t lo, uint32_t hi) {
+    if (cy >= FBC_MAX_ROWS) {
+        if (ctx->view == 0) {
+            const bool was_shadow = fb_draw_to_shadow(true);
+            fbc_refresh_span(cy, lo, hi);
+            present_rows(cy, cy + 1, was_shadow);
+        }
+        return;
+    }
+
+    /* The keyboard handler can also print, see kb_handler() */
+    const uint32_t eflags = irq_save();
+
+    if (dirty_lo[cy] >= dirty_hi[cy]) {
+        dirty_lo[cy] = lo;
+        dirty_hi[cy] = hi;
+    } else {
+        if (lo < dirty_lo[cy])
+            dirty_lo[cy] = lo;
+        if (hi > dirty_hi[cy])
+            dirty_hi[cy] = hi;
+    }
+
+    request_flush();
+
+    irq_restore(eflags);
+}
+
+/**
+ * @brief Change an entry of the fbc, and mark it as dirty.
+ * @details If the entry didn't change, it doesn't need to be drawn again:
+ * Either the screen already has it, or it's dirty from a previous change.
+ */
+static inline void set_entry(uint32_t cy, uint32_t cx, fbc_entry entry) {
+    fbc_entry* cur = &get_row(cy)[cx];
+    if (cur->c == entry.c && cur->fg == entry.fg && cur->bg == entry.bg)
+        return;
+
+    *cur = entry;
+    mark_dirty(cy, cx, cx + 1);
+}
+
+/**
+ * @brief Forget the dirty entries, used when we just drew all of them.
+ */
+static void clear_dirty(void) {
+    const uint32_t eflags = irq_save();
+
+    for (uint32_t cy = 0; cy < FBC_MAX_ROWS; cy++)
+        dirty_lo[cy] = dirty_hi[cy] = 0;
+    any_dirty      = false;
+    pending_scroll = 0;
+    view_redraw    = false;
+
+    irq_restore(eflags);
+}
+
+/**
+ * @brief Add `n` rows that scrolled out of the screen to the scrollback.
+ * @details If we are viewing the scrollback, keep showing the same rows. If
+ * they were overwritten, show the oldest ones we have.
+ */
+static void add_hist(uint32_t n) {
+    /* The view can also change from the keyboard handler */
+    const uint32_t eflags = irq_save();
+
+    const uint32_t max_hist = ctx->lines - ctx->ch_h;
+
+    ctx->hist = (ctx->hist + n < max_hist) ? ctx->hist + n : max_hist;
+
+    if (ctx->view > 0) {
+        if (ctx->view + n > ctx->hist) {
+            ctx->view   = ctx->hist;
+            view_redraw = true;
+            request_flush();
+        } else {
+            ctx->view += n;
         }
     }
+
+    irq_restore(eflags);
+}
+
+/**
+ * @brief Move the pixels of the console up `rows` rows of chars.
+ * @details Only the rows that stay on the screen are moved. The exposed ones
+ * were marked as dirty by fbc_shift_rows(). Should be drawing to the shadow
+ * framebuffer, since reading the pixels from the screen is very slow on real
+ * hardware.
+ */
+static void blit_scroll(uint32_t rows) {
+    const uint32_t src_y = CHAR_Y_TO_PX(rows);
+    const uint32_t lines = (ctx->ch_h - rows) * ctx->font->h;
+
+    /* From the top, so each line is read before we overwrite it */
+    fb_copy_rect(ctx->y, ctx->x, src_y, ctx->x, lines, ctx->w);
+}
+
+/**
+ * @brief Draw the dirty entries. See fbc_flush()
+ */
+static void fbc_flush_nolock(void) {
+    if (!any_dirty)
+        return;
+
+    flushing = true;
+
+    /* The view changed, draw everything from the new one */
+    if (view_redraw) {
+        fbc_refresh();
+        last_flush = pit_get_ticks();
+        flushing   = false;
+        return;
+    }
+
+    /* The changes are not on the screen, and we will draw everything once we
+     * are back at the bottom */
+    if (ctx->view > 0) {
+        clear_dirty();
+        flushing = false;
+        return;
+    }
+
+    /* Take the scroll before blitting, like the ranges of each row below */
+    uint32_t eflags       = irq_save();
+    const uint32_t scroll = pending_scroll;
+
+    pending_scroll = 0;
+    any_dirty      = false;
+    irq_restore(eflags);
+
+    /* Rows of chars that we have to present, [top, bottom) */
+    const uint32_t rows = (ctx->ch_h < FBC_MAX_ROWS) ? ctx->ch_h : FBC_MAX_ROWS;
+    uint32_t top        = rows;
+    uint32_t bottom     = 0;
+
+    const bool was_shadow = fb_draw_to_shadow(true);
+
+    /* First move what is already on the screen, then draw on top of it */
+    if (scroll > 0 && scroll < ctx->ch_h) {
+        blit_scroll(scroll);
+        top    = 0;
+        bottom = ctx->ch_h;
+    }
+
+    for (uint32_t cy = 0; cy < rows; cy++) {
+        /* Take the range of the row. If the keyboard handler changes it while
+         * we draw, it will be marked again for the next flush. */
+        eflags            = irq_save();
+        const uint32_t lo = dirty_lo[cy];
+        const uint32_t hi = dirty_hi[cy];
+
+        dirty_lo[cy] = dirty_hi[cy] = 0;
+        irq_restore(eflags);
+
+        if (lo >= hi)
+            continue;
+
+        fbc_refresh_span(cy, lo, hi);
+
+        if (cy < top)
+            top = cy;
+        if (cy + 1 > bottom)
+            bottom = cy + 1;
+    }
+
+    present_rows(top, bottom, was_shadow);
+
+    last_flush = pit_get_ticks();
+    flushing   = false;
+}
+
+/**
+ * @brief Entry point of the task that flushes the console in the background.
+ * @details Sleeps until something changes, and then waits FBC_FLUSH_MS more so
+ * the output of that interval is drawn in a single batch.
+ */
+static void flush_task(void) {
+    for (;;) {
+        const uint32_t eflags = irq_save();
+        while (!any_dirty)
+            wq_wait(&flush_wq);
+        irq_restore(eflags);
+
+        sleep_ms(FBC_FLUSH_MS);
+        fbc_flush();
+    }
 }
 
 /* -------------------------------------------------------------------------- */
@@ -87,14 +374,24 @@ void fbc_init(uint32_t y, uint32_t x, uint32_t h, uint32_t w, Font* font) {
 
     ctx->should_shift = false;
 
-    /* Allocate the number of fbc_entry's. Rows and cols of the console */
-    ctx->fbc = malloc(ctx->ch_h * ctx->ch_w * sizeof(fbc_entry));
+    /* Allocate the number of fbc_entry's. Rows of the console and scrollback,
+     * and cols of the console */
+    ctx->lines = ctx->ch_h + FBC_SCROLLBACK;
+    ctx->fbc   = malloc(ctx->lines * ctx->ch_w * sizeof(fbc_entry));
 
     fbc_clear();
     fbc_refresh_raw();
+
+    /* Needs multitasking, see kernel_main() */
+    if (!flush_task_started && mt_current_task != NULL) {
+        mt_newtask("fbc_flush", flush_task);
+        flush_task_started = true;
+    }
 }
 
 void fbc_change_ctx(fbc_ctx* new_ctx) {
+    /* The dirty entries belong to the old context */
+    fbc_flush();
     ctx = new_ctx;
 }
 
@@ -106,17 +403,24 @@ void fbc_clear(void) {
     ctx->cur_x = 0;
     ctx->cur_y = 0;
 
+    /* The scrollback is also cleared, start the ring again */
+    ctx->head = 0;
+    ctx->view = 0;
+    ctx->hist = 0;
+
     for (uint32_t cy = 0; cy < ctx->ch_h; cy++) {
+        fbc_entry* row = get_row(cy);
+
         /* First entry is newline, rest spaces. We dont need to call
          * fbc_refresh_entry because we know the whole line is empty */
-        ctx->fbc[cy * ctx->ch_w + 0] = (fbc_entry){
+        row[0] = (fbc_entry){
             .c  = '\n',
             .fg = DEFAULT_FG,
             .bg = DEFAULT_BG,
         };
 
         for (uint32_t cx = 1; cx < ctx->ch_w; cx++) {
-            ctx->fbc[cy * ctx->ch_w + cx] = (fbc_entry){
+            row[cx] = (fbc_entry){
                 .c  = '\0',
                 .fg = DEFAULT_FG,
                 .bg = DEFAULT_BG,
@@ -127,21 +431,21 @@ void fbc_clear(void) {
 
 void fbc_clrtoeol(void) {
     /* Current position will be the end of the current line */
-    ctx->fbc[ctx->cur_y * ctx->ch_w + ctx->cur_x] = (fbc_entry){
-        .c  = '\n',
-        .fg = DEFAULT_FG,
-        .bg = DEFAULT_BG,
-    };
-    fbc_refresh_entry(ctx->cur_y, ctx->cur_x);
+    set_entry(ctx->cur_y, ctx->cur_x,
+              (fbc_entry){
+                .c  = '\n',
+                .fg = DEFAULT_FG,
+                .bg = DEFAULT_BG,
+              });
 
     /* Rest of them as '\0' */
     for (uint32_t cx = ctx->cur_x + 1; cx < ctx->ch_w; cx++) {
-        ctx->fbc[ctx->cur_y * ctx->ch_w + cx] = (fbc_entry){
-            .c  = '\0',
-            .fg = DEFAULT_FG,
-            .bg = DEFAULT_BG,
-        };
-        fbc_refresh_entry(ctx->cur_y, cx);
+        set_entry(ctx->cur_y, cx,
+                  (fbc_entry){
+                    .c  = '\0',
+                    .fg = DEFAULT_FG,
+                    .bg = DEFAULT_BG,
+                  });
     }
 }
 
@@ -150,7 +454,10 @@ void fbc_sprint(const char* s) {
         fbc_putchar(*s++);
 }
 
-void fbc_putchar(char c) {
+/**
+ * @brief Print a char to the current fbc_ctx. See fbc_putchar()
+ */
+static void fbc_putchar_nolock(char c) {
     /* First of all, check if we need to shift the array. We need this kind of
      * "queue" system so the array doesn't immediately shift when a line ends
      * with '\n', for example */
@@ -163,11 +470,12 @@ void fbc_putchar(char c) {
     switch (c) {
         case '\n':
             /* Save newline char (don't display anything) */
-            ctx->fbc[ctx->cur_y * ctx->ch_w + ctx->cur_x] = (fbc_entry){
-                .c  = '\n',
-                .fg = DEFAULT_FG,
-                .bg = DEFAULT_BG,
-            };
+            set_entry(ctx->cur_y, ctx->cur_x,
+                      (fbc_entry){
+                        .c  = '\n',
+                        .fg = DEFAULT_FG,
+                        .bg = DEFAULT_BG,
+                      });
 
             /* If we have rows left on the terminal, go down, if we are on the
              * last one, store that we need to shift 1 up, but stay on that last
@@ -179,12 +487,19 @@ void fbc_putchar(char c) {
 
             ctx->cur_x = 0;
 
+            /* Lines are a good moment for drawing, but don't draw more than
+             * once every FBC_FLUSH_MS. The flush task draws the rest, and
+             * also what the keyboard handler echoes, since we could be
+             * interrupting a flush. */
+            if (irq_enabled() && pit_get_ticks() - last_flush >= FBC_FLUSH_MS)
+                fbc_flush_nolock();
+
             return;
         case '\t':
             /* For having TABSIZE-aligned tabs */
             const int tabs_needed = FBC_TABSIZE - (ctx->cur_x % FBC_TABSIZE);
             for (int i = 0; i < tabs_needed; i++)
-                fbc_putchar(' ');
+                fbc_putchar_nolock(' ');
 
             return;
         case '\b':
@@ -194,35 +509,29 @@ void fbc_putchar(char c) {
                 ctx->cur_y--;
                 ctx->cur_x = ctx->ch_w - 1;
 
-                while (ctx->fbc[ctx->cur_y * ctx->ch_w + ctx->cur_x].c == '\0')
+                const fbc_entry* row = get_row(ctx->cur_y);
+                while (row[ctx->cur_x].c == '\0')
                     ctx->cur_x--;
             }
 
             /* Clear the char we just deleted */
-            ctx->fbc[ctx->cur_y * ctx->ch_w + ctx->cur_x] = (fbc_entry){
-                .c  = ' ',
-                .fg = DEFAULT_FG,
-                .bg = DEFAULT_BG,
-            };
-
-            /* Draw the pixels on the screen */
-            fbc_refresh_entry(ctx->cur_y, ctx->cur_x);
+            set_entry(ctx->cur_y, ctx->cur_x,
+                      (fbc_entry){
+                        .c  = ' ',
+                        .fg = DEFAULT_FG,
+                        .bg = DEFAULT_BG,
+                      });
 
             return;
         case '\r':
-            /* Fill from start of the line to the cursor pos */
-            const uint32_t fill_y = CHAR_Y_TO_PX(ctx->cur_y);
-            const uint32_t fill_x = CHAR_X_TO_PX(0);
-            const uint32_t fill_h = ctx->font->h;
-            const uint32_t fill_w = CHAR_X_TO_PX(ctx->cur_x) - fill_x;
-            fb_drawrect_fast(fill_y, fill_x, fill_h, fill_w, ctx->cur_cols.bg);
-
+            /* Clear from start of the line to the cursor pos */
             for (uint32_t tmp_x = 0; tmp_x < ctx->cur_x; tmp_x++) {
-                ctx->fbc[ctx->cur_y * ctx->ch_w + tmp_x] = (fbc_entry){
-                    .c  = ' ',
-                    .fg = ctx->cur_cols.fg,
-                    .bg = ctx->cur_cols.bg,
-                };
+                set_entry(ctx->cur_y, tmp_x,
+                          (fbc_entry){
+                            .c  = ' ',
+                            .fg = ctx->cur_cols.fg,
+                            .bg = ctx->cur_cols.bg,
+                          });
             }
 
             ctx->cur_x = 0;
@@ -231,14 +540,13 @@ void fbc_putchar(char c) {
             break;
     }
 
-    ctx->fbc[ctx->cur_y * ctx->ch_w + ctx->cur_x] = (fbc_entry){
-        .c  = c,
-        .fg = ctx->cur_cols.fg,
-        .bg = ctx->cur_cols.bg,
-    };
-
-    /* Draw the pixels on the screen */
-    fbc_refresh_entry(ctx->cur_y, ctx->cur_x);
+    /* The pixels are drawn on the next flush */
+    set_entry(ctx->cur_y, ctx->cur_x,
+              (fbc_entry){
+                .c  = c,
+                .fg = ctx->cur_cols.fg,
+                .bg = ctx->cur_cols.bg,
+              });
 
     /* If we reach the end of the line, reset x and increase y */
     if (++(ctx->cur_x) >= ctx->ch_w) {
@@ -252,22 +560,54 @@ void fbc_putchar(char c) {
     }
 }
 
+void fbc_putchar(char c) {
+    /* The console and the cursor are shared by all tasks */
+    mt_preempt_disable();
+    fbc_putchar_nolock(c);
+    mt_preempt_enable();
+}
+
+void fbc_flush(void) {
+    mt_preempt_disable();
+    fbc_flush_nolock();
+    mt_preempt_enable();
+}
+
 void fbc_refresh_raw(void) {
+    /* We are going to draw everything */
+    clear_dirty();
+
+    /* Don't let other tasks draw to the screen while we draw to the shadow
+     * framebuffer, see fb_draw_to_shadow() */
+    mt_preempt_disable();
+    const bool was_shadow = fb_draw_to_shadow(true);
+
     /* Iterate each char of the framebuffer console */
     for (uint32_t cy = 0; cy < ctx->ch_h; cy++)
         for (uint32_t cx = 0; cx < ctx->ch_w; cx++)
             fbc_refresh_entry(cy, cx);
+
+    present_rows(0, ctx->ch_h, was_shadow);
+    mt_preempt_enable();
 }
 
 void fbc_refresh(void) {
+    clear_dirty();
+
+    /* See fbc_refresh_raw() */
+    mt_preempt_disable();
+    const bool was_shadow = fb_draw_to_shadow(true);
+
     /* Iterate each char of the framebuffer console */
     for (uint32_t cy = 0; cy < ctx->ch_h; cy++) {
+        const fbc_entry* row = get_view_row(cy);
+
         for (uint32_t cx = 0; cx < ctx->ch_w; cx++) {
             fbc_refresh_entry(cy, cx);
 
             /* If NULL, we are done with the line: Fill from current pos to end
              * of line and go to the next one */
-            if (ctx->fbc[cy * ctx->ch_w + cx].c == '\0') {
+            if (row[cx].c == '\0') {
                 const uint32_t fill_y = CHAR_Y_TO_PX(cy);
                 const uint32_t fill_x = CHAR_X_TO_PX(cx);
                 const uint32_t fill_h = ctx->font->h;
@@ -278,62 +618,33 @@ void fbc_refresh(void) {
             }
         }
     }
+
+    present_rows(0, ctx->ch_h, was_shadow);
+    mt_preempt_enable();
 }
 
 void fbc_shift_rows(uint8_t n) {
-    /* Get once for performance. The last_row variable is the last row that we
-     * want to replace after shifting. */
+    /* The last_row variable is the last row that we keep after shifting */
     const uint32_t last_row = ctx->ch_h - n - 1;
 
-    /* Shift N rows. We go to the newline instead of always ctx->ch_w because
-     * that will be the last valid char we care about. We can fill the rest
-     * faster with fb_drawrect_fast */
-    for (uint32_t y = 0; y <= last_row; y++) {
-        /* Get once for performance. Used for ctx->fbc[] indexes */
-        const uint32_t raw_y        = y * ctx->ch_w;
-        const uint32_t raw_y_plus_n = (y + n) * ctx->ch_w;
-
-        /* Used to count the position of the last valid char in the line */
-        uint32_t char_count = 0;
+    /* Move the start of the ring. The first N rows are now part of the
+     * scrollback, and the oldest rows of the scrollback are reused for the new
+     * ones at the bottom. */
+    ctx->head = (ctx->head + n) % ctx->lines;
 
-        /* Update valid entries until we encounter a null byte. '\0' denotes the
-         * end of the valid line. */
-        for (uint32_t x = 0; x < ctx->ch_w; x++) {
-            ctx->fbc[raw_y + x] = ctx->fbc[raw_y_plus_n + x];
-
-            /* We need to check after the assignment and not in the for because
-             * we want to also copy the null byte to keep where the line ends */
-            if (ctx->fbc[raw_y_plus_n + x].c == '\0')
-                break;
-
-            fbc_refresh_entry(y, x);
-
-            char_count++;
-        }
-
-        /* Fill from last valid to the end of the line */
-        const uint32_t fill_y = CHAR_Y_TO_PX(y);
-        const uint32_t fill_x = CHAR_X_TO_PX(char_count);
-        const uint32_t fill_w = ctx->w + ctx->x - fill_x;
-        fb_drawrect_fast(fill_y, fill_x, ctx->font->h, fill_w, DEFAULT_BG);
-    }
-
-    /* Clear last n rows with clean entries. Only change the ones that were
-     * full. The y variable starts as the first empty line after shifting */
+    /* Clear the new rows with clean entries */
     for (uint32_t y = last_row + 1; y < ctx->ch_h; y++) {
-        /* Get once for performance. Used for ctx->fbc[] indexes */
-        const uint32_t raw_y = y * ctx->ch_w;
+        fbc_entry* row = get_row(y);
 
-        /* First entry is newline, rest spaces. We dont need to call
-         * fbc_refresh_entry because we know the whole line is empty */
-        ctx->fbc[raw_y + 0] = (fbc_entry){
+        /* First entry is newline, rest spaces */
+        row[0] = (fbc_entry){
             .c  = '\n',
             .fg = DEFAULT_FG,
             .bg = DEFAULT_BG,
         };
 
         for (uint32_t x = 1; x < ctx->ch_w; x++) {
-            ctx->fbc[raw_y + x] = (fbc_entry){
+            row[x] = (fbc_entry){
                 .c  = '\0',
                 .fg = DEFAULT_FG,
                 .bg = DEFAULT_BG,
@@ -341,11 +652,69 @@ void fbc_shift_rows(uint8_t n) {
         }
     }
 
-    /* Fill last empty lines with background color */
-    const uint32_t fill_y = CHAR_Y_TO_PX(ctx->ch_h - n);
-    const uint32_t fill_x = CHAR_X_TO_PX(0);
-    const uint32_t fill_h = n * ctx->font->h;
-    fb_drawrect_fast(fill_y, fill_x, fill_h, ctx->w, DEFAULT_BG);
+    /* The rows we shifted out are now part of the scrollback */
+    add_hist(n);
+
+    /* Without blitting (or if the dirty arrays don't cover the console, or if
+     * we interrupted a flush), draw every row on the next flush. If we scroll
+     * again before that, they are only drawn once. */
+    if (!scroll_blit || ctx->ch_h > FBC_MAX_ROWS || flushing) {
+        for (uint32_t y = 0; y < ctx->ch_h; y++)
+            mark_dirty(y, 0, ctx->ch_w);
+        return;
+    }
+
+    /* Otherwise, the next flush moves the pixels with blit_scroll(), so the
+     * dirty ranges move with their rows, and only the new rows are drawn */
+    const uint32_t eflags = irq_save();
+
+    for (uint32_t y = 0; y <= last_row; y++) {
+        dirty_lo[y] = dirty_lo[y + n];
+        dirty_hi[y] = dirty_hi[y + n];
+    }
+
+    for (uint32_t y = last_row + 1; y < ctx->ch_h; y++) {
+        dirty_lo[y] = dirty_hi[y] = 0;
+        mark_dirty(y, 0, ctx->ch_w);
+    }
+
+    pending_scroll += n;
+
+    irq_restore(eflags);
+}
+
+void fbc_scroll_view(int32_t rows) {
+    /* Also called from the keyboard handler */
+    const uint32_t eflags = irq_save();
+
+    int32_t view = (int32_t)ctx->view + rows;
+    if (view < 0)
+        view = 0;
+    else if ((uint32_t)view > ctx->hist)
+        view = ctx->hist;
+
+    /* Drawn by the next flush, see fbc_flush_nolock() */
+    if ((uint32_t)view != ctx->view) {
+        ctx->view   = view;
+        view_redraw = true;
+        request_flush();
+    }
+
+    irq_restore(eflags);
+}
+
+void fbc_reset_view(void) {
+    fbc_scroll_view(-(int32_t)ctx->view);
+}
+
+void fbc_set_scroll_blit(bool enabled) {
+    /* Don't mix both methods in the same flush */
+    fbc_flush();
+    scroll_blit = enabled;
+}
+
+bool fbc_get_scroll_blit(void) {
+    return scroll_blit;
 }
 
 /* -------------------------------------------------------------------------- */
@@ -1,78 +1,186 @@
-
 #include <stddef.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h> /* memset */
 #include <kernel/heap.h>
+#include <kernel/multitask.h> /* mt_preempt_disable, mt_preempt_enable */
 
 /**
  * @brief Returns the pointer to the actual usable memory of a Block
  */
 #define HEADER_TO_PTR(blk) ((void*)((uint32_t)(blk) + sizeof(Block)))
 
-static Block* const first_block = (Block*)HEAP_START;
+/**
+ * @brief Returns the bin index (size class) of a block of `sz` bytes.
+ * @details The index is the position of the highest bit set. See HEAP_BINS.
+ */
+#define SZ_TO_BIN(sz) (31 - __builtin_clz((uint32_t)(sz) | 1))
 
-void heap_init(void) {
-    memset(HEAP_START, 0, HEAP_SIZE);
+/**
+ * @brief Minimum alignment of the allocated sizes and pointers.
+ * @details Makes sure the headers we place after each block are aligned.
+ */
+#define MIN_ALIGN 8
 
-    *first_block = (Block){
-        .next = NULL,                      /* It's the last block */
-        .prev = NULL,                      /* And first block */
-        .sz   = HEAP_SIZE - sizeof(Block), /* Size of heap - this block */
-        .free = true,                      /* Start free */
-    };
+static Block* first_block = (Block*)HEAP_START;
+
+/** @brief Free lists of each size class. See HEAP_BINS. */
+static Block* bins[HEAP_BINS] = { NULL };
+
+/** @brief Bit N will be set if bins[N] is not empty. */
+static uint32_t bins_used = 0;
+
+/** @brief Current allocation policy. See heap_set_policy() */
+static enum heap_policy cur_policy = HEAP_POLICY_BINS;
+
+/*----------------------------------------------------------------------------*/
+
+/**
+ * @brief Insert a free block at the start of the free list of its bin.
+ * @param[inout] blk Free block to insert.
+ */
+static inline void bin_insert(Block* blk) {
+    const uint32_t idx = SZ_TO_BIN(blk->sz);
+
+    blk->free_prev = NULL;
+    blk->free_next = bins[idx];
+
+    if (bins[idx] != NULL)
+        bins[idx]->free_prev = blk;
+
+    bins[idx] = blk;
+    bins_used |= 1u << idx;
 }
 
-void* heap_alloc(size_t sz, size_t align) {
-    /* From first block, traverse linked list until we find a free one or until
-     * we reach the end. */
-    for (Block* blk = first_block;; blk = blk->next) {
-        /* Is it an invalid block? */
-        if (!blk->free || blk->sz < sz + sizeof(Block)) {
-            /* If we reached the end of the linked list, exit loop and panic.
-             * Otherwise, continue to the next block */
-            if (blk->next == NULL)
-                break;
-            else
-                continue;
-        }
+/**
+ * @brief Remove a free block from the free list of its bin.
+ * @details Must be called before changing the size of the block, since the
+ * size is used to get the bin.
+ * @param[inout] blk Free block to remove.
+ */
+static inline void bin_remove(Block* blk) {
+    const uint32_t idx = SZ_TO_BIN(blk->sz);
+
+    if (blk->free_prev != NULL)
+        blk->free_prev->free_next = blk->free_next;
+    else
+        bins[idx] = blk->free_next;
+
+    if (blk->free_next != NULL)
+        blk->free_next->free_prev = blk->free_prev;
+
+    if (bins[idx] == NULL)
+        bins_used &= ~(1u << idx);
+}
+
+/**
+ * @brief Check if `sz` bytes aligned to `align` fit in a free block.
+ * @param[in] blk Free block to check.
+ * @param[in] sz Size in bytes we want to allocate.
+ * @param[in] align Alignment of the returned pointer.
+ * @param[out] pad Bytes we would need to move the header to align the data.
+ * @return True if the block can hold the allocation.
+ */
+static inline bool blk_fits(const Block* blk, size_t sz, size_t align,
+                            size_t* pad) {
+    *pad = (uint32_t)HEADER_TO_PTR(blk) % align;
+    if (*pad != 0)
+        *pad = align - *pad;
+
+    return blk->sz >= *pad + sz;
+}
+
+/**
+ * @brief Find a free block by walking the linked list from the first block.
+ * @details Cost grows with the number of blocks in the heap. Only used with
+ * HEAP_POLICY_FIRST_FIT.
+ */
+static Block* find_first_fit(size_t sz, size_t align, size_t* pad) {
+    for (Block* blk = first_block; blk != NULL; blk = blk->next)
+        if (blk->free && blk_fits(blk, sz, align, pad))
+            return blk;
+
+    return NULL;
+}
+
+/**
+ * @brief Find a free block using the size class free lists.
+ * @details Blocks in the bin of `sz` might still be too small, so we walk that
+ * one. Blocks in any bigger bin are big enough unless the alignment padding is
+ * too big, so we usually return the first block of the smallest non-empty bin.
+ */
+static Block* find_bins(size_t sz, size_t align, size_t* pad) {
+    uint32_t idx = SZ_TO_BIN(sz);
+
+    for (Block* blk = bins[idx]; blk != NULL; blk = blk->free_next)
+        if (blk_fits(blk, sz, align, pad))
+            return blk;
+
+    /* Non-empty bins bigger than the current one */
+    uint32_t mask = (idx >= HEAP_BINS - 1) ? 0 : bins_used & ~((2u << idx) - 1);
 
-        /* Add padding to the end of the last block so the data of the new block
-         * is aligned. */
-        size_t sz_pad = (uint32_t)HEADER_TO_PTR(blk) % align;
-        if (sz_pad != 0) {
-            /* Once we know we need padding, update var to know how much */
-            sz_pad = align - sz_pad;
-
-            /* Check if the updated size is still enough to hold what was
-             * requested */
-            if (blk->sz - sz_pad < sz)
-                continue;
-
-            /* If the start of the data is not algined, move current 'blk' */
-            Block tmp = *blk;
-            memset(blk, 0, sizeof(Block));
-            blk  = (Block*)((uint32_t)blk + sz_pad);
-            *blk = tmp;
-
-            /* Update current 'blk->sz' since we moved the header */
-            blk->sz -= sz_pad;
-
-            /* If this is not the first block, also update the size and new
-             * location in the previous item */
-            if (blk->prev != NULL) {
-                blk->prev->sz += sz_pad;
-                blk->prev->next = blk;
-            }
-
-            /* Same if there is a next one */
-            if (blk->next != NULL)
-                blk->next->prev = blk;
+    while (mask != 0) {
+        idx = __builtin_ctz(mask);
+
+        for (Block* blk = bins[idx]; blk != NULL; blk = blk->free_next)
+            if (blk_fits(blk, sz, align, pad))
+                return blk;
+
+        /* Clear lowest bit, the bin we just checked */
+        mask &= mask - 1;
+    }
+
+    return NULL;
+}
+
+/**
+ * @brief Allocate `sz` bytes from a free block returned by blk_fits()
+ * @param[inout] blk Free block we are going to use.
+ * @param[in] sz Bytes to allocate, already aligned to MIN_ALIGN.
+ * @param[in] pad Padding returned by blk_fits().
+ * @return Pointer to the usable memory of the block.
+ */
+static void* blk_take(Block* blk, size_t sz, size_t pad) {
+    bin_remove(blk);
+
+    /* Add padding to the end of the last block so the data of the new block
+     * is aligned. */
+    if (pad != 0) {
+        /* If the start of the data is not algined, move current 'blk' */
+        Block tmp = *blk;
+        blk       = (Block*)((uint32_t)blk + pad);
+        *blk      = tmp;
+
+        /* Update current 'blk->sz' since we moved the header */
+        blk->sz -= pad;
+
+        /* If this is not the first block, also update the size and new
+         * location in the previous item. If it's the first one, the padding
+         * bytes are lost. */
+        if (blk->prev != NULL) {
+            /* The size class of the previous block might change */
+            if (blk->prev->free)
+                bin_remove(blk->prev);
+
+            blk->prev->sz += pad;
+            blk->prev->next = blk;
+
+            if (blk->prev->free)
+                bin_insert(blk->prev);
+        } else {
+            first_block = blk;
         }
 
+        /* Same if there is a next one */
+        if (blk->next != NULL)
+            blk->next->prev = blk;
+    }
+
+    /* Only split the block if there is space left for another header and some
+     * data. Otherwise, keep the extra bytes in this block. */
+    if (blk->sz >= sz + sizeof(Block) + MIN_ALIGN) {
         /* Location of the new block we will add after the size we are
-         * allocating: (data ptr + sz we just allocated)
-         * The pointer is const. */
+         * allocating: (data ptr + sz we just allocated) */
         Block* const new_blk = (Block*)((uint32_t)HEADER_TO_PTR(blk) + sz);
 
         /* Place the new block header */
@@ -83,14 +191,67 @@ void* heap_alloc(size_t sz, size_t align) {
             .free = true,
         };
 
+        if (new_blk->next != NULL)
+            new_blk->next->prev = new_blk;
+
+        bin_insert(new_blk);
+
         /* Update values from old block */
         blk->next = new_blk;
         blk->sz   = sz;
-        blk->free = false;
+    }
+
+    blk->free = false;
+
+    /* Return the pointer to the actual usable memory:
+     * (blk + sizeof(Block)) */
+    return HEADER_TO_PTR(blk);
+}
 
-        /* Return the pointer to the actual usable memory:
-         * (blk + sizeof(Block)) */
-        return HEADER_TO_PTR(blk);
+/*----------------------------------------------------------------------------*/
+
+void heap_init(void) {
+    /* The memory is not cleared here, only the headers are initialized. Blocks
+     * that need to be zeroed are cleared on allocation, see heap_calloc() */
+    first_block = (Block*)HEAP_START;
+
+    *first_block = (Block){
+        .next = NULL,                      /* It's the last block */
+        .prev = NULL,                      /* And first block */
+        .sz   = HEAP_SIZE - sizeof(Block), /* Size of heap - this block */
+        .free = true,                      /* Start free */
+    };
+
+    for (int i = 0; i < HEAP_BINS; i++)
+        bins[i] = NULL;
+    bins_used = 0;
+
+    bin_insert(first_block);
+}
+
+void heap_set_policy(enum heap_policy policy) {
+    cur_policy = policy;
+}
+
+void* heap_alloc(size_t sz, size_t align) {
+    if (align < MIN_ALIGN)
+        align = MIN_ALIGN;
+
+    /* Round up so the header we place after the data is aligned */
+    sz = (sz + MIN_ALIGN - 1) & ~(MIN_ALIGN - 1);
+
+    /* The block list is shared by all tasks */
+    mt_preempt_disable();
+
+    size_t pad = 0;
+    Block* blk = (cur_policy == HEAP_POLICY_FIRST_FIT)
+                   ? find_first_fit(sz, align, &pad)
+                   : find_bins(sz, align, &pad);
+
+    if (blk != NULL) {
+        void* ret = blk_take(blk, sz, pad);
+        mt_preempt_enable();
+        return ret;
     }
 
     /* No block available */
@@ -106,8 +267,12 @@ void heap_free(void* ptr) {
 
     Block* blk = (Block*)(ptr - sizeof(Block));
 
+    mt_preempt_disable();
+
     /* If this is not the last block, and the next block is free, merge */
     if (blk->next != NULL && blk->next->free) {
+        bin_remove(blk->next);
+
         /* Add deleted header size and size of old block */
         blk->sz += sizeof(Block) + blk->next->sz;
 
@@ -129,6 +294,8 @@ void heap_free(void* ptr) {
 
     /* If this is not the first block, and the prev block is free, merge */
     if (blk->prev != NULL && blk->prev->free) {
+        bin_remove(blk->prev);
+
         /* Add deleted header size and size of old block */
         blk->prev->sz += sizeof(Block) + blk->sz;
 
@@ -151,36 +318,20 @@ void heap_free(void* ptr) {
         blk = blk->prev;
     }
 
-    /* If the next block is being used, just set this one free */
+    /* Set the (merged) block free and add it to the free list of its new size
+     * class */
     blk->free = true;
+    bin_insert(blk);
+
+    mt_preempt_enable();
 }
 
 void* heap_calloc(size_t item_n, size_t item_sz, size_t align) {
     const size_t bytes = item_n * item_sz;
     void* ptr          = heap_alloc(bytes, align);
 
-    switch (item_sz) {
-        case 2: { /* sizeof(uint16_t) */
-            uint16_t* casted = ptr;
-            for (size_t i = 0; i < item_n; i++)
-                casted[i] = 0;
-            break;
-        }
-        case 4: { /* sizeof(uint32_t) */
-            uint32_t* casted = ptr;
-            for (size_t i = 0; i < item_n; i++)
-                casted[i] = 0;
-            break;
-        }
-        case 1: /* sizeof(uint8_t) || item_sz > sizeof(uint32_t) */
-        default: {
-            /* If it's an unknown size, iterate each byte */
-            uint8_t* casted = ptr;
-            for (size_t i = 0; i < bytes; i++)
-                casted[i] = 0;
-            break;
-        }
-    }
+    /* Only clear the bytes we are returning, see heap_init() */
+    memset(ptr, 0, bytes);
 
     return ptr;
 }
@@ -198,7 +349,7 @@ void heap_dump_headers(void) {
     int i = 0;
 
     /* From start of the heap, jump to the next block until end of heap. */
-    for (Block* blk = HEAP_START; blk != NULL; blk = blk->next, i++) {
+    for (Block* blk = first_block; blk != NULL; blk = blk->next, i++) {
         printf("[%d] [%c] Header: %p | Data: %p | Next: %p", i,
                (blk->free) ? 'F' : 'B', blk, HEADER_TO_PTR(blk), blk->next);
 
@@ -1,4 +1,6 @@
 
+%include "structs.asm"      ; ctx_t, CR0_TS
+
 %macro EXC_WRAPPER 1
     global exc_%1:function
     exc_%1:
@@ -53,7 +55,12 @@ section .text
     extern handle_exception     ; src/kernel/exceptions.c
     extern handle_debug         ; src/kernel/exceptions.c
     extern pit_inc              ; src/kernel/idt.c
+    extern timer_tick           ; src/kernel/timer.c
+    extern mt_sched_tick        ; src/kernel/multitask.c
     extern kb_handler           ; src/kernel/keyboard.c
+    extern mt_current_task      ; src/kernel/multitask.asm
+    extern mt_fpu_owner         ; src/kernel/multitask.asm
+    extern mt_fpu_traps         ; src/kernel/multitask.asm
 
 ; void idt_load(void* idt_desc)
 global idt_load:function
@@ -77,7 +84,7 @@ EXC_WRAPPER     3
 EXC_WRAPPER     4
 EXC_WRAPPER     5
 EXC_WRAPPER     6
-EXC_WRAPPER     7
+; EXC_7 is managed below
 EXC_WRAPPER_ERR 8
 EXC_WRAPPER_ERR 10
 EXC_WRAPPER_ERR 11
@@ -92,6 +99,40 @@ EXC_WRAPPER     19
 EXC_WRAPPER     20
 EXC_WRAPPER_ERR 30
 
+; exc_7: Device Not Available (#NM). Raised when a task uses the FPU, MMX or SSE
+; registers while CR0.TS is set, which means that they still belong to another
+; task (mt_fpu_owner). Save them to the owner's fxdata and restore the ones of
+; the current task. See mt_switch in src/kernel/multitask.asm
+; Registered as an interrupt gate, so no task switch can happen in the middle.
+global exc_7:function
+exc_7:
+    push    eax
+    push    ecx
+
+    clts                                ; Clear CR0.TS, registers usable again
+
+    mov     eax, [mt_fpu_owner]
+    mov     ecx, [mt_current_task]
+    cmp     eax, ecx
+    je      .done                       ; Already the owner
+
+    ; fxsave and fxrstor require a 16byte-aligned address to 512 bytes
+    test    eax, eax
+    jz      .restore                    ; No owner (ended), nothing to save
+    mov     eax, [eax + ctx_t.fxdata]
+    fxsave  [eax]
+
+.restore:
+    mov     eax, [ecx + ctx_t.fxdata]
+    fxrstor [eax]
+    mov     [mt_fpu_owner], ecx
+    inc     dword [mt_fpu_traps]
+
+.done:
+    pop     ecx
+    pop     eax
+    iretd                               ; Retry the instruction
+
 global exc_debug:function
 exc_debug:
     cli                         ; Clear interrupts
@@ -125,10 +166,17 @@ exc_debug:
 ; void irq_pit(void)
 ; First IRQ we remapped to 0x20. Calls the pit_inc C function, located in:
 ; src/kernel/pit.c
+; Then runs the expired kernel timers (src/kernel/timer.c) and calls the
+; scheduler, which might switch to another task. In that case, mt_sched_tick
+; will return once the current task is scheduled again.
 global irq_pit:function
 irq_pit:
     pusha
-    call    pit_inc     ; Increment the static counter from src/kernel/idt.c
+    cld                 ; See irq_kb
+    call    pit_inc     ; Increment the static counter and send the EOI, so the
+                        ; next task can receive interrupts
+    call    timer_tick  ; Might wake up tasks, so before the scheduler
+    call    mt_sched_tick
     popa
     iretd
 
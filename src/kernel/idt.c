@@ -92,7 +92,7 @@ void idt_init(void) {
     register_isr(4, exc_4, true);
     register_isr(5, exc_5, true);
     register_isr(6, exc_6, true);
-    register_isr(7, exc_7, true);
+    register_isr(7, exc_7, false); /* Lazy FPU switching, not an error */
     register_isr(8, exc_8, true);
     register_isr(10, exc_10, true);
     register_isr(11, exc_11, true);
@@ -0,0 +1,47 @@
+#ifndef KERNEL_BOOT_TRACE_H_
+#define KERNEL_BOOT_TRACE_H_ 1
+
+#include <stdint.h>
+
+/**
+ * @def BOOT_TRACE_MAX
+ * @brief Maximum number of stages recorded by boot_trace_mark().
+ */
+#define BOOT_TRACE_MAX 32
+
+/**
+ * @brief Start recording the boot stages.
+ * @details Only reads the TSC, so it can be called before anything else is
+ * initialized. If the CPU has no TSC, nothing is recorded.
+ */
+void boot_trace_start(void);
+
+/**
+ * @brief Mark the end of a boot stage that started with the previous mark (or
+ * with boot_trace_start()).
+ * @details Stores the TSC value in a static buffer, since the console might not
+ * exist yet. Marks after BOOT_TRACE_MAX are ignored.
+ * @param[in] name Name of the stage. Should be a string literal, since we only
+ * store the pointer.
+ */
+void boot_trace_mark(const char* name);
+
+/**
+ * @brief Number of stages recorded.
+ */
+uint32_t boot_trace_count(void);
+
+/**
+ * @brief Name of the stage `idx`, or NULL if there is no such stage.
+ */
+const char* boot_trace_name(uint32_t idx);
+
+/**
+ * @brief Duration of the stage `idx` in nanoseconds.
+ * @details The cycles are converted with the frequency of the clocksource, so
+ * it should be called after clock_init().
+ * @return Nanoseconds, or 0 if there is no such stage.
+ */
+uint64_t boot_trace_ns(uint32_t idx);
+
+#endif /* KERNEL_BOOT_TRACE_H_ */
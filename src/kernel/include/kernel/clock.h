@@ -0,0 +1,77 @@
+#ifndef KERNEL_CLOCK_H_
+#define KERNEL_CLOCK_H_ 1
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/**
+ * @def CLOCK_CALIBRATE_MS
+ * @brief Duration in ms of each measurement used for calibrating the TSC.
+ */
+#define CLOCK_CALIBRATE_MS 10
+
+/**
+ * @def CLOCK_CALIBRATE_TRIES
+ * @brief Number of measurements used for calibrating the TSC. The shortest one
+ * is used, since the others were probably interrupted (e.g. SMIs or the host of
+ * a virtual machine).
+ */
+#define CLOCK_CALIBRATE_TRIES 3
+
+/**
+ * @brief Read the Time-Stamp Counter.
+ * @details Check is_tsc_supported() first. Used by the clocksource and by the
+ * boot trace, which starts before clock_init().
+ * @return Cycles since the CPU was reset.
+ */
+static inline uint64_t rdtsc(void) {
+    uint64_t ret;
+    asm volatile("rdtsc" : "=A"(ret));
+    return ret;
+}
+
+/**
+ * @brief Select the clocksource, and calibrate the TSC against the PIT.
+ * @details Uses PIT channel 2 for the calibration, so it should be called
+ * before using the PC speaker. If the CPU has no TSC, the clocksource falls
+ * back to the count of PIT channel 0, see pit_get_cycles(). Should be called
+ * after pit_init().
+ */
+void clock_init(void);
+
+/**
+ * @brief Check if the clocksource is the TSC.
+ * @return False if it fell back to the PIT.
+ */
+bool clock_is_tsc(void);
+
+/**
+ * @brief Frequency of the clocksource, in cycles per second.
+ */
+uint64_t clock_get_freq(void);
+
+/**
+ * @brief Current value of the clocksource.
+ * @details Use clock_get_freq() for converting to time, or just clock_ns().
+ * @return TSC value, or PIT cycles since boot if there is no TSC.
+ */
+uint64_t clock_cycles(void);
+
+/**
+ * @brief Convert cycles of the clocksource to nanoseconds.
+ * @param[in] cycles Difference between two clock_cycles() calls.
+ * @return Nanoseconds.
+ */
+uint64_t clock_cycles_to_ns(uint64_t cycles);
+
+/**
+ * @brief Nanoseconds since the clocksource started counting.
+ * @details The resolution depends on the clocksource: less than a nanosecond
+ * with the TSC, ~838ns with the PIT. Only meaningful for measuring intervals.
+ * @return Current time in nanoseconds.
+ */
+static inline uint64_t clock_ns(void) {
+    return clock_cycles_to_ns(clock_cycles());
+}
+
+#endif /* KERNEL_CLOCK_H_ */
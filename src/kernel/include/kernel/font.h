@@ -5,6 +5,12 @@
 #include <stdint.h>
 #include <stdbool.h>
 
+/**
+ * @brief Maximum width of a font.
+ * @details Each row of a glyph is stored in a byte.
+ */
+#define FONT_MAX_W 8
+
 typedef struct {
     uint8_t w;     /**< @brief Width */
     uint8_t h;     /**< @brief Height */
@@ -14,6 +20,19 @@ typedef struct {
 
 extern Font main_font;
 
+/**
+ * @brief Pixel masks for each possible row of a glyph.
+ * @details Item [row][x] is 0xFFFFFFFF if pixel x of `row` is set, and 0
+ * otherwise. Filled by font_init(). See get_font_row().
+ */
+extern uint32_t font_row_masks[256][FONT_MAX_W];
+
+/**
+ * @brief Fill the font_row_masks array.
+ * @details Called by fb_init(), before drawing anything.
+ */
+void font_init(void);
+
 /**
  * @brief Gets the bit at pos \p y, \p x of the char \p c from the Font \p font.
  * @details Would be the same as `font->font[c][y][x]` if it was a 3d array.
@@ -33,4 +52,18 @@ static inline bool get_font_bit(Font* font, uint8_t c, uint8_t y, uint8_t x) {
     return font->font[c * font->h + y] & (0x80 >> x);
 }
 
+/**
+ * @brief Gets the pixel masks of the row \p y of the char \p c.
+ * @details Used for drawing a whole row without checking each bit. The color
+ * of pixel `x` is `bg ^ ((fg ^ bg) & mask[x])`. Needs font_init().
+ * @param font Pointer to the current Font struct.
+ * @param c Current char containing the row.
+ * @param y Y position in px inside the character.
+ * @return Array of `font->w` masks, see font_row_masks.
+ */
+static inline const uint32_t* get_font_row(const Font* font, uint8_t c,
+                                           uint8_t y) {
+    return font_row_masks[font->font[c * font->h + y]];
+}
+
 #endif /* KERNEL_FONT_H_ */
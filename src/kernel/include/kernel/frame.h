@@ -0,0 +1,75 @@
+#ifndef KERNEL_FRAME_H_
+#define KERNEL_FRAME_H_ 1
+
+#include <stdint.h>
+#include <kernel/multiboot.h>
+
+/**
+ * @def FRAME_SIZE
+ * @brief Size in bytes of each physical frame. Same as the page size.
+ */
+#define FRAME_SIZE 4096
+
+/**
+ * @def FRAME_COUNT
+ * @brief Number of frames needed to cover the 32 bit physical address space.
+ */
+#define FRAME_COUNT ((uint32_t)(0x100000000ULL / FRAME_SIZE))
+
+/**
+ * @def FRAME_NONE
+ * @brief Returned by the allocation functions on failure.
+ * @details The first frame is always reserved, so it can't be a valid return.
+ */
+#define FRAME_NONE 0
+
+/**
+ * @brief Initialize the physical frame allocator.
+ * @details All the memory is marked as used except the available regions of
+ * the multiboot memory map (or mem_upper if there is no map). Then the low
+ * memory, the kernel, the heap and the multiboot structures are reserved.
+ * @param[in] mb_info Multiboot information from the bootloader.
+ */
+void frame_init(const Multiboot* mb_info);
+
+/**
+ * @brief Allocate a single physical frame.
+ * @return Physical address of the frame, or FRAME_NONE if there are no frames
+ * left.
+ */
+uint32_t frame_alloc(void);
+
+/**
+ * @brief Allocate `n` physically contiguous frames.
+ * @param[in] n Number of frames.
+ * @return Physical address of the first frame, or FRAME_NONE if there is no
+ * region big enough.
+ */
+uint32_t frame_alloc_contig(uint32_t n);
+
+/**
+ * @brief Free `n` contiguous frames starting at `paddr`.
+ * @param[in] paddr Physical address returned by an allocation function.
+ * @param[in] n Number of frames.
+ */
+void frame_free(uint32_t paddr, uint32_t n);
+
+/**
+ * @brief Mark `n` frames starting at `paddr` as used.
+ * @details Used for regions that should never be allocated, like MMIO.
+ * @param[in] paddr Physical address of the first frame. Will be aligned down.
+ * @param[in] n Number of frames.
+ */
+void frame_reserve(uint32_t paddr, uint32_t n);
+
+/**
+ * @brief Number of frames that are currently free.
+ */
+uint32_t frame_get_free(void);
+
+/**
+ * @brief Number of frames reported as usable by the bootloader.
+ */
+uint32_t frame_get_total(void);
+
+#endif /* KERNEL_FRAME_H_ */
@@ -3,6 +3,7 @@
 #define KERNEL_FRAMEBUFFER_H_ 1
 
 #include <stdint.h>
+#include <stdbool.h>
 #include <kernel/color.h>
 #include <kernel/font.h>
 
@@ -17,6 +18,26 @@ enum fb_types {
     FB_TYPE_EGA     = 2,
 };
 
+/**
+ * @def FB_IMAGE_CACHE_SZ
+ * @brief Number of decoded GimpImage's kept by fb_drawimage().
+ */
+#define FB_IMAGE_CACHE_SZ 4
+
+/**
+ * @struct fb_format
+ * @brief Pixel format of the framebuffer.
+ * @details Position and size in bits of each color component, as returned by
+ * the bootloader. The colors of the fb_* functions are always 32 bit 0xRRGGBB,
+ * and they are converted to this format when drawing.
+ */
+typedef struct {
+    uint8_t bpp;           /**< @brief Bits per pixel. 32, 24, 16 or 15 */
+    uint8_t r_pos, r_size; /**< @brief Red component */
+    uint8_t g_pos, g_size; /**< @brief Green component */
+    uint8_t b_pos, b_size; /**< @brief Blue component */
+} fb_format;
+
 /**
  * @struct GimpImage
  * @brief Structure containing the height, width and data of an image exported
@@ -27,6 +48,17 @@ typedef struct {
     const char* data;
 } GimpImage;
 
+/**
+ * @struct FbImage
+ * @brief Image with 32 bit 0xRRGGBB pixels, ready for fb_blit().
+ * @details Generated from the GimpImage headers when building, with
+ * scripts/gimp2fb.py
+ */
+typedef struct {
+    uint32_t h, w;
+    const uint32_t* data;
+} FbImage;
+
 /**
  * @brief Initialize global framebuffer variables and clear the framebuffer
  * @details See Multiboot struct for more info
@@ -34,18 +66,20 @@ typedef struct {
  * @param[in] pitch Framebuffer pitch
  * @param[in] w Framebuffer width in px
  * @param[in] h Framebuffer height in px
- * @param[in] bpp Framebuffer bits per pixel
+ * @param[in] fmt Pixel format of the framebuffer
+ * @return False if the pixel format is not supported
  */
-void fb_init(volatile uint32_t* fb, uint32_t pitch, uint32_t w, uint32_t h,
-             uint32_t bpp);
+bool fb_init(volatile void* fb, uint32_t pitch, uint32_t w, uint32_t h,
+             const fb_format* fmt);
 
 /**
  * @brief Get the framebuffer ptr.
- * @details Used by operations that need high performance like the fbc. Use with
- * caution.
+ * @details The pixels are in the format of the framebuffer, with
+ * fb_get_pitch() bytes per row. Use with caution, the fb_* functions already
+ * handle the format.
  * @return Framebuffer address
  */
-volatile uint32_t* fb_get_ptr(void);
+volatile void* fb_get_ptr(void);
 
 /**
  * @brief Get the framebuffer width in px
@@ -59,6 +93,67 @@ uint32_t fb_get_width(void);
  */
 uint32_t fb_get_height(void);
 
+/**
+ * @brief Get the framebuffer pitch
+ * @return Bytes of each framebuffer row
+ */
+uint32_t fb_get_pitch(void);
+
+/**
+ * @brief Get the bits per pixel of the framebuffer
+ * @return Framebuffer bits per pixel
+ */
+uint32_t fb_get_bpp(void);
+
+/**
+ * @brief Get the shadow framebuffer, for drawing the next frame.
+ * @details The shadow framebuffer is a buffer in normal memory with the same
+ * size as the framebuffer, with fb_get_width() 0xRRGGBB colors per row.
+ * Nothing is shown until fb_present() or fb_present_rect() copy it to the
+ * framebuffer, so the screen doesn't show unfinished frames. The contents are
+ * kept between frames, so a frame only needs to draw and present what changed,
+ * and it never needs to read back from the framebuffer, which is slow.
+ *
+ * Allocated on the first call. Shared by everyone: the console draws its
+ * region here too (see fb_draw_to_shadow()), so call fbc_flush() first, and
+ * fbc_refresh() after drawing on top of it. Like any other allocation of the
+ * kernel heap, it panics if there is not enough memory (see heap_alloc()).
+ * @return Pointer to the shadow framebuffer
+ */
+uint32_t* fb_begin_frame(void);
+
+/**
+ * @brief Copy the whole shadow framebuffer to the screen.
+ * @details See fb_begin_frame().
+ */
+void fb_present(void);
+
+/**
+ * @brief Copy a rectangle of the shadow framebuffer to the screen.
+ * @details Used for presenting only the regions that changed in the frame. See
+ * fb_begin_frame().
+ *
+ * It's only a memcpy() for 32 bpp 0xRRGGBB framebuffers. Otherwise, each pixel
+ * is converted to the format of the framebuffer (see pack_col()), so the
+ * regions that didn't change shouldn't be presented again.
+ * @param y, x Position in px of the rectangle
+ * @param h, w Height and width of the rectangle. Clamped to the screen.
+ */
+void fb_present_rect(uint32_t y, uint32_t x, uint32_t h, uint32_t w);
+
+/**
+ * @brief Make the drawing functions below draw to the shadow framebuffer
+ * instead of the screen, or back to the screen.
+ * @details Nothing is shown until it's presented with fb_present_rect(), which
+ * always writes to the screen. Used by the console, so scrolling with
+ * fb_copy_rect() doesn't read back from the framebuffer. Should be called with
+ * preemption disabled, since the other tasks draw to the screen.
+ * @param enabled True for drawing to the shadow framebuffer, allocated with
+ * fb_begin_frame() if needed.
+ * @return True if we were drawing to the shadow framebuffer, for restoring it.
+ */
+bool fb_draw_to_shadow(bool enabled);
+
 /**
  * @brief Set the pixel at \p y, \p x of the global framebuffer to \p col
  * @param y, x Position in px of the framebuffer
@@ -106,6 +201,46 @@ static inline void fb_drawrect(uint32_t y, uint32_t x, uint32_t h, uint32_t w,
 void fb_drawrect_fast(uint32_t y, uint32_t x, uint32_t h, uint32_t w,
                       uint32_t col);
 
+/**
+ * @brief Copy a rectangle of 0xRRGGBB colors from \p src to the framebuffer.
+ * @details No bounds check, like fb_drawrect_fast(). If the framebuffer uses
+ * the same format, each row is copied at once, with SSE2 if it's big enough.
+ * Otherwise, the colors are converted while copying.
+ * @param y, x Position in px of the framebuffer
+ * @param h, w Height and width of the rectangle
+ * @param[in] src Colors of the first row
+ * @param src_pitch Bytes from the start of a row of \p src to the next. Can be
+ * 0 for drawing the same row \p h times.
+ */
+void fb_blit(uint32_t y, uint32_t x, uint32_t h, uint32_t w,
+             const uint32_t* src, uint32_t src_pitch);
+
+/**
+ * @brief Copy a rectangle of the framebuffer to another position of the
+ * framebuffer.
+ * @details Reads the framebuffer, which is very slow for the screen (uncached
+ * or write-combining memory), so it should be used while drawing to the shadow
+ * framebuffer, see fb_draw_to_shadow(). No bounds check. The rows are copied
+ * from the top, so if the rectangles overlap, \p dst_y should be lower or equal
+ * than \p src_y.
+ * @param dst_y, dst_x Position in px of the destination
+ * @param src_y, src_x Position in px of the source
+ * @param h, w Height and width of the rectangle
+ */
+void fb_copy_rect(uint32_t dst_y, uint32_t dst_x, uint32_t src_y,
+                  uint32_t src_x, uint32_t h, uint32_t w);
+
+/**
+ * @brief Draw a char of a font on the framebuffer
+ * @details No bounds check. Used by fb_drawtext() and the framebuffer console.
+ * @param[in] y, x Top left position of the char on the screen
+ * @param[in] font Font of the char
+ * @param[in] c Char to draw
+ * @param[in] fg, bg Foreground and background 32 bit colors
+ */
+void fb_drawchar(uint32_t y, uint32_t x, const Font* font, uint8_t c,
+                 uint32_t fg, uint32_t bg);
+
 /**
  * @brief Draw text on the framebuffer
  * @param[in] y, x Top left position of the text on the screen
@@ -121,9 +256,22 @@ void fb_drawtext(uint32_t y, uint32_t x, color_pair cols, Font* font,
  * @details For exporting an image to a C array, use:
  * File > Export As > Select File Type (By Extension) > C source code header
  * You will need to store the values generated by GIMP in a GimpImage struct.
+ *
+ * The image is decoded the first time it's drawn, and the last
+ * FB_IMAGE_CACHE_SZ images are kept by pointer, so drawing them again only
+ * needs fb_drawimage_fb(). Images known at build time should be converted with
+ * scripts/gimp2fb.py instead.
  * @param[in] y, x Position in px for drawing the image
- * @param[in] img Pointer to the GimpImage to draw.
+ * @param[in] img Pointer to the GimpImage to draw. Should never change.
  */
 void fb_drawimage(uint32_t y, uint32_t x, const GimpImage* img);
 
+/**
+ * @brief Draw an image that is already in 0xRRGGBB format.
+ * @details Each row is drawn at once with fb_blit().
+ * @param[in] y, x Position in px for drawing the image
+ * @param[in] img Pointer to the FbImage to draw.
+ */
+void fb_drawimage_fb(uint32_t y, uint32_t x, const FbImage* img);
+
 #endif /* KERNEL_FRAMEBUFFER_H_ */
@@ -4,6 +4,7 @@
 
 #include <stdint.h>
 #include <stddef.h>
+#include <stdbool.h>
 #include <kernel/font.h>
 #include <kernel/color.h> /* color_pair */
 
@@ -12,6 +13,26 @@
  */
 #define FBC_TABSIZE 4
 
+/**
+ * @brief Maximum milliseconds between a change and the moment it's drawn.
+ * @details Changes are drawn in batches, see fbc_flush().
+ */
+#define FBC_FLUSH_MS 20
+
+/**
+ * @brief Rows of the console whose changes can be drawn in batches.
+ * @details Enough for 4K screens with 8px fonts. Changes in other rows are
+ * drawn immediately.
+ */
+#define FBC_MAX_ROWS 512
+
+/**
+ * @brief Rows of the console that are kept after scrolling out of the screen.
+ * @details They can be viewed with Shift+PgUp and Shift+PgDn, see
+ * fbc_scroll_view().
+ */
+#define FBC_SCROLLBACK 500
+
 /**
  * @brief Framebuffer console entry.
  */
@@ -26,9 +47,24 @@ typedef struct {
  * @details Used for example by ncurses.
  */
 typedef struct {
-    /** @brief Global framebuffer console. Main fbc_entry array */
+    /** @brief Global framebuffer console. Main fbc_entry array, with `lines`
+     * rows of `ch_w` entries */
     fbc_entry* fbc;
 
+    /** @brief Rows of the fbc array. Used as a ring, the ones that are not on
+     * the screen are the scrollback. At least `ch_h`. */
+    uint32_t lines;
+
+    /** @brief Row of the fbc array with the first row of the screen */
+    uint32_t head;
+
+    /** @brief Rows we are scrolled back, 0 if we are showing the last ones */
+    uint32_t view;
+
+    /** @brief Rows of scrollback that have been written, at most `lines -
+     * ch_h` */
+    uint32_t hist;
+
     /** @name Global size in px of the framebuffer console
      * @{ */
     uint32_t y, x, h, w;
@@ -66,6 +102,7 @@ void fbc_init(uint32_t y, uint32_t x, uint32_t h, uint32_t w, Font* font);
 
 /**
  * @brief Switches to the specified framebuffer console context
+ * @details Flushes the changes of the old context first.
  * @param[in] new_ctx New framebuffer console context
  */
 void fbc_change_ctx(fbc_ctx* new_ctx);
@@ -100,11 +137,25 @@ void fbc_sprint(const char* s);
  */
 void fbc_putchar(char c);
 
+/**
+ * @brief Draw the entries that changed since the last flush.
+ * @details fbc_putchar() and the other functions only mark the entries they
+ * change, and they are drawn together here. Entries that change more than once
+ * are only drawn once, and so are the rows when we scroll more than once.
+ *
+ * Called at most once every FBC_FLUSH_MS on newlines, by a background task
+ * FBC_FLUSH_MS after the first change, and before reading input or changing the
+ * context. Call it before drawing directly to the framebuffer, so pending
+ * changes don't overwrite it later.
+ */
+void fbc_flush(void);
+
 /**
  * @brief Updates each pixel of the framebuffer with the real one in ctx->fbc.
  * @details Calling this function everytime we update ctx.fbc would be slow.
- * Instead we call this function on specific situations and we refresh the
- * entries we need when updating ctx->fbc (e.g. when calling fbc_putchar())
+ * Instead we call this function on specific situations and we mark the entries
+ * we change in ctx->fbc, so fbc_flush() draws them (e.g. when calling
+ * fbc_putchar())
  *
  * The raw version is usually meant for refreshing everything when we control
  * all the contents (e.g. after clearing the fbc)
@@ -120,10 +171,39 @@ void fbc_refresh(void);
 
 /**
  * @brief Scrolls the framebuffer terminal \p n rows.
+ * @details The next fbc_flush() moves the pixels that are already on the screen
+ * and only draws the new rows, unless disabled with fbc_set_scroll_blit().
  * @param n Number of rows to shift
  */
 void fbc_shift_rows(uint8_t n);
 
+/**
+ * @brief Show older rows of the console, from the scrollback.
+ * @details Only changes what is drawn, the console keeps printing to the last
+ * rows. Those changes are drawn once we are back at the bottom. The screen is
+ * drawn again on the next fbc_flush(), so it can be called from interrupts.
+ * @param rows Number of rows to go back. If negative, go forward.
+ */
+void fbc_scroll_view(int32_t rows);
+
+/**
+ * @brief Stop showing the scrollback, and go back to the last rows.
+ */
+void fbc_reset_view(void);
+
+/**
+ * @brief Choose how the console is scrolled.
+ * @details Mainly used for comparing them, see the scroll_bench command.
+ * @param enabled If true (default), move the pixels of the rows. Otherwise,
+ * draw every char again.
+ */
+void fbc_set_scroll_blit(bool enabled);
+
+/**
+ * @brief Check if the console moves the pixels when scrolling.
+ */
+bool fbc_get_scroll_blit(void);
+
 /* fbc_getcols:  */
 /**
  * @brief Writes the current colors of the terminal to \p fg and \p bg.
@@ -9,6 +9,14 @@
 #define HEAP_START ((void*)0xA00000) /* Bytes. 10MB */
 #define HEAP_SIZE  (0x3200000)       /* Bytes. 50MB */
 
+/**
+ * @def HEAP_BINS
+ * @brief Number of size classes used by the allocator.
+ * @details Bin N contains the free blocks with a size in the [2^N, 2^(N+1))
+ * range, so 32 bins cover any 32 bit size.
+ */
+#define HEAP_BINS 32
+
 typedef struct Block Block;
 
 /**
@@ -23,17 +31,27 @@ struct Block {
     Block* prev; /** @brief Pointer to prev header. NULL means start of heap */
     uint32_t sz; /** @brief Block size in bytes */
     bool free;   /** @brief True if the block is not being used */
+
+    /** @brief Next free block in the same bin. Only valid if free */
+    Block* free_next;
+
+    /** @brief Previous free block in the same bin. Only valid if free */
+    Block* free_prev;
 };
 
 /**
- * @var blk_cursor
- * @brief First block that heap_alloc will try to allocate.
- * @details Initialized in src/kernel/alloc.c
+ * @enum heap_policy
+ * @brief Method used by heap_alloc() for finding a free block.
  */
-extern Block* blk_cursor;
+enum heap_policy {
+    HEAP_POLICY_BINS      = 0, /**< @brief Segregated free lists (Default) */
+    HEAP_POLICY_FIRST_FIT = 1, /**< @brief Walk all blocks from the start */
+};
 
 /**
  * @brief Initializes the heap headers for the allocation functions.
+ * @details The heap memory itself is not cleared, so heap_alloc() can return
+ * non-zero bytes. Use heap_calloc() for zeroed memory.
  */
 void heap_init(void);
 
@@ -65,6 +83,14 @@ void heap_free(void* ptr);
  */
 void* heap_calloc(size_t item_n, size_t item_sz, size_t align);
 
+/**
+ * @brief Change the method used by heap_alloc() for finding free blocks.
+ * @details Both policies share the same blocks and free lists, so it can be
+ * changed at any time. Mainly used for comparing them (See heap_bench command).
+ * @param[in] policy New allocation policy.
+ */
+void heap_set_policy(enum heap_policy policy);
+
 /**
  * @brief Prints the information for all the alloc block headers.
  */
@@ -3,6 +3,7 @@
 #define KERNEL_IDT_H_ 1
 
 #include <stdint.h>
+#include <stdbool.h>
 
 /**
  * @def P_BIT
@@ -112,6 +113,56 @@ typedef struct {
     idt_entry* base;
 } __attribute__((packed)) idt_descriptor;
 
+/**
+ * @def EFLAGS_IF
+ * @brief Interrupt flag of the EFLAGS register.
+ */
+#define EFLAGS_IF (1 << 9)
+
+/**
+ * @brief Save the EFLAGS register and disable interrupts.
+ * @details Used for short critical sections that can be called with interrupts
+ * enabled or disabled. See irq_restore().
+ * @return Previous value of EFLAGS.
+ */
+static inline uint32_t irq_save(void) {
+    uint32_t eflags;
+    asm volatile("pushfd\n\t"
+                 "pop %0\n\t"
+                 "cli"
+                 : "=r"(eflags)
+                 :
+                 : "memory");
+    return eflags;
+}
+
+/**
+ * @brief Restore the EFLAGS register (and the interrupt flag) from
+ * irq_save().
+ * @param[in] eflags Value returned by irq_save().
+ */
+static inline void irq_restore(uint32_t eflags) {
+    asm volatile("push %0\n\t"
+                 "popfd"
+                 :
+                 : "r"(eflags)
+                 : "memory", "cc");
+}
+
+/**
+ * @brief Check if interrupts are enabled.
+ * @details They are disabled in interrupt handlers and inside irq_save()
+ * sections.
+ * @return True if the interrupt flag of EFLAGS is set.
+ */
+static inline bool irq_enabled(void) {
+    uint32_t eflags;
+    asm volatile("pushfd\n\t"
+                 "pop %0"
+                 : "=r"(eflags));
+    return eflags & EFLAGS_IF;
+}
+
 /**
  * @brief Initialize the idt and the idt descriptor
  * @details Defined in src/kernel/idt.c
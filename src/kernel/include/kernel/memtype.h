@@ -0,0 +1,75 @@
+#ifndef KERNEL_MEMTYPE_H_
+#define KERNEL_MEMTYPE_H_ 1
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/**
+ * @enum memtype_method
+ * @brief Method used by memtype_set_wc() for making a region write-combining.
+ */
+enum memtype_method {
+    MEMTYPE_NONE = 0, /**< @brief Not supported, region is unchanged */
+    MEMTYPE_PAT  = 1, /**< @brief Page attributes, selecting PAT entry 1 */
+    MEMTYPE_MTRR = 2, /**< @brief Variable range MTRR */
+};
+
+/**
+ * @enum memtype_msrs
+ * @brief Model Specific Registers used for memory types.
+ * @details See Intel SDM Vol. 3, Chapters 11.11 and 11.12
+ */
+enum memtype_msrs {
+    MSR_MTRR_CAP       = 0x0FE,
+    MSR_MTRR_PHYSBASE0 = 0x200, /**< @brief PHYSBASEn is 0x200 + 2n */
+    MSR_MTRR_PHYSMASK0 = 0x201, /**< @brief PHYSMASKn is 0x201 + 2n */
+    MSR_PAT            = 0x277,
+    MSR_MTRR_DEF_TYPE  = 0x2FF,
+};
+
+/**
+ * @enum memtype_types
+ * @brief Memory types used in the PAT entries and the MTRRs.
+ */
+enum memtype_types {
+    MEMTYPE_UC  = 0x00, /**< @brief Uncacheable */
+    MEMTYPE_WC  = 0x01, /**< @brief Write-combining */
+    MEMTYPE_WT  = 0x04, /**< @brief Write-through */
+    MEMTYPE_WP  = 0x05, /**< @brief Write-protected */
+    MEMTYPE_WB  = 0x06, /**< @brief Write-back */
+    MEMTYPE_UCM = 0x07, /**< @brief Uncacheable, can be overridden by MTRRs */
+};
+
+/**
+ * @brief Detect PAT and MTRR support, and reprogram the PAT if possible.
+ * @details PAT entry 1 (PWT set in the page entry) is changed from WT to WC.
+ * Nothing else in the kernel uses PWT, so no existing mapping changes.
+ */
+void memtype_init(void);
+
+/**
+ * @brief Make a physical region write-combining.
+ * @details Uses the PAT if available. Otherwise, tries to use free variable
+ * MTRRs. Each one covers a power of 2 size aligned to that size, so the region
+ * is split in several of them, and nothing outside of its pages is changed. If
+ * there are not enough free MTRRs, the region is unchanged.
+ * @param[in] addr Start of the region. Identity mapped.
+ * @param[in] size Size in bytes of the region.
+ * @return Method that was used, or MEMTYPE_NONE if it was not possible.
+ */
+enum memtype_method memtype_set_wc(void* addr, uint32_t size);
+
+/**
+ * @brief Undo memtype_set_wc() for a region.
+ * @details Used for comparing both memory types. See fb_bench command.
+ * @param[in] addr Start of the region.
+ * @param[in] size Size in bytes of the region.
+ */
+void memtype_set_default(void* addr, uint32_t size);
+
+/**
+ * @brief Get the name of a memtype_method.
+ */
+const char* memtype_method_str(enum memtype_method method);
+
+#endif /* KERNEL_MEMTYPE_H_ */
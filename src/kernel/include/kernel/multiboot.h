@@ -4,6 +4,41 @@
 
 #include <stdint.h>
 
+/**
+ * @enum multiboot_flags
+ * @brief Bits of Multiboot.flags, set if the bootloader filled the fields.
+ */
+enum multiboot_flags {
+    MULTIBOOT_FLAG_MEM  = 0x0001, /**< @brief mem_lower and mem_upper */
+    MULTIBOOT_FLAG_MMAP = 0x0040, /**< @brief mmap_length and mmap_addr */
+    MULTIBOOT_FLAG_FB   = 0x1000, /**< @brief framebuffer_* fields */
+};
+
+/**
+ * @enum multiboot_mmap_types
+ * @brief Possible values for Multiboot_mmap.type
+ */
+enum multiboot_mmap_types {
+    MULTIBOOT_MMAP_AVAILABLE = 1, /**< @brief RAM we can use */
+    MULTIBOOT_MMAP_RESERVED  = 2,
+    MULTIBOOT_MMAP_ACPI      = 3, /**< @brief Reclaimable ACPI information */
+    MULTIBOOT_MMAP_NVS       = 4, /**< @brief Preserved on hibernation */
+    MULTIBOOT_MMAP_BADRAM    = 5,
+};
+
+/**
+ * @struct Multiboot_mmap
+ * @brief Entry of the memory map returned by the bootloader.
+ * @details The `size` field doesn't include itself, so the next entry is at
+ * `(uint32_t)entry + entry->size + sizeof(entry->size)`.
+ */
+typedef struct {
+    uint32_t size; /**< @brief Size of the rest of the entry */
+    uint64_t addr; /**< @brief Start of the memory region */
+    uint64_t len;  /**< @brief Size in bytes of the memory region */
+    uint32_t type; /**< @brief See multiboot_mmap_types enum */
+} Multiboot_mmap __attribute__((packed));
+
 /**
  * @struct Multiboot
  * @brief Multiboot information structure returned by the bootloader.
@@ -58,7 +93,13 @@ typedef struct {
     uint8_t framebuffer_bpp;  /* Bits per pixel */
     uint8_t framebuffer_type; /* See fb_types enum in framebuffer.h */
 
-    /* color_info depends on the fb type */
+    /* color_info depends on the fb type. For FB_TYPE_RGB: */
+    uint8_t framebuffer_red_field_position;
+    uint8_t framebuffer_red_mask_size;
+    uint8_t framebuffer_green_field_position;
+    uint8_t framebuffer_green_mask_size;
+    uint8_t framebuffer_blue_field_position;
+    uint8_t framebuffer_blue_mask_size;
 } Multiboot __attribute__((packed));
 
 #endif /* KERNEL_MULTIBOOT_H_ */
@@ -3,12 +3,59 @@
 #define KERNEL_MULTITASK_H_ 1
 
 #include <stdint.h>
+#include <stdbool.h>
+#include <kernel/slab.h>
+
+/**
+ * @def MT_STACK_SZ
+ * @brief Size in bytes of the stack of each task.
+ */
+#define MT_STACK_SZ 0x4000
+
+/**
+ * @def MT_FXDATA_SZ
+ * @brief Size in bytes needed by fxsave for storing the FPU/SSE registers.
+ */
+#define MT_FXDATA_SZ 512
+
+/**
+ * @def MT_QUANTUM_DEFAULT
+ * @brief Default number of PIT ticks (ms) a task can run before being
+ * preempted. See mt_set_quantum().
+ */
+#define MT_QUANTUM_DEFAULT 10
+
+/**
+ * @def MT_PRIO_LEVELS
+ * @brief Number of levels of the multi-level feedback queue.
+ * @details Level 0 has the highest priority, and the time slice doubles on
+ * each level. Also the number of valid priorities, see mt_setprio().
+ */
+#define MT_PRIO_LEVELS 4
+
+/**
+ * @def MT_BOOST_TICKS
+ * @brief Ticks (ms) between each priority boost.
+ * @details All tasks are moved to the highest level allowed by their priority,
+ * so the ones in the lower levels don't starve.
+ */
+#define MT_BOOST_TICKS 1000
+
+/**
+ * @enum mt_task_state
+ * @brief Values of Ctx.state. Same as TASK_* in src/kernel/structs.asm
+ */
+enum mt_task_state {
+    TASK_READY   = 0, /**< @brief Running or waiting in the ring */
+    TASK_DEAD    = 1, /**< @brief Exited, waiting to be freed */
+    TASK_BLOCKED = 2, /**< @brief Removed from the ring, see mt_block() */
+};
 
 typedef struct Ctx Ctx;
 
 /**
  * @struct Task context struct
- * @details We could add more stuff like parent task and priority
+ * @details We could add more stuff like parent task
  *
  * @todo Rename to something less generic like Task or TaskCtx, since the fbc
  * also uses fbc_ctx.
@@ -16,13 +63,19 @@ typedef struct Ctx Ctx;
  * capitalized or all lowercase with "_t" subfix.
  */
 struct Ctx {
-    Ctx* next;       /**< @brief Pointer to next task */
-    Ctx* prev;       /**< @brief Pointer to next task */
-    uint32_t stack;  /**< @brief Pointer to the allocated stack for the task */
-    uint32_t esp;    /**< @brief Stack top */
-    uint32_t cr3;    /**< @brief cr3 register (page directory) */
-    uint32_t fxdata; /**< @brief 512 bytes needed for fxsave to store FPU/SSE */
-    char* name;      /**< @brief Task name */
+    Ctx* next;         /**< @brief Pointer to next task */
+    Ctx* prev;         /**< @brief Pointer to next task */
+    uint32_t stack;    /**< @brief Pointer to the allocated stack */
+    uint32_t esp;      /**< @brief Stack top */
+    uint32_t cr3;      /**< @brief cr3 register (page directory) */
+    uint32_t fxdata;   /**< @brief 512 bytes used by fxsave to store FPU/SSE */
+    char* name;        /**< @brief Task name */
+    uint32_t state;    /**< @brief See mt_task_state enum */
+    uint32_t quantum;  /**< @brief Ticks left in the current time slice */
+    void* data;        /**< @brief Free to use by the creator of the task */
+    uint32_t priority; /**< @brief Highest MLFQ level it can reach */
+    uint32_t level;    /**< @brief Current MLFQ level, 0 is the highest */
+    Ctx* wait_next;    /**< @brief Next task in the same wait queue */
 };
 
 typedef struct fpu_data_t {
@@ -100,6 +153,43 @@ typedef struct Tss {
  */
 extern Ctx* mt_current_task;
 
+/**
+ * @var mt_fpu_owner
+ * @brief Task whose FPU/SSE state is loaded in the registers, or NULL.
+ * @details The registers are only saved and restored when another task uses
+ * them (lazy FPU switching). See exc_7 in src/kernel/idt.asm. Defined in
+ * src/kernel/multitask.asm
+ */
+extern Ctx* mt_fpu_owner;
+
+/**
+ * @var mt_fpu_traps
+ * @brief Number of times the FPU/SSE state was swapped by exc_7.
+ * @details Defined in src/kernel/multitask.asm
+ */
+extern uint32_t mt_fpu_traps;
+
+/**
+ * @var mt_ctx_cache
+ * @brief Object cache for the Ctx structs of the tasks.
+ * @details Defined in src/kernel/multitask.c
+ */
+extern kmem_cache* mt_ctx_cache;
+
+/**
+ * @var mt_stack_cache
+ * @brief Object cache for the stacks of the tasks. See MT_STACK_SZ.
+ * @details Defined in src/kernel/multitask.c
+ */
+extern kmem_cache* mt_stack_cache;
+
+/**
+ * @var mt_fxdata_cache
+ * @brief Object cache for the fxsave data of the tasks. See MT_FXDATA_SZ.
+ * @details Defined in src/kernel/multitask.c
+ */
+extern kmem_cache* mt_fxdata_cache;
+
 /**
  * @brief Returns a pointer to the current task.
  * @details Defined in: src/kernel/gdt.asm
@@ -114,26 +204,44 @@ Tss* tss_getptr(void);
  */
 void mt_init(void);
 
+/**
+ * @brief Create the object caches used by mt_newtask().
+ * @details Called by mt_init(). Defined in src/kernel/multitask.c
+ */
+void mt_init_caches(void);
+
+/**
+ * @brief Constructor of the objects in mt_fxdata_cache.
+ * @details Sets the default FPU and SSE control values, so a new task doesn't
+ * inherit them. Also used to reset the data before returning it to the cache.
+ * Defined in src/kernel/multitask.c
+ * @param[out] obj Pointer to the MT_FXDATA_SZ bytes to initialize.
+ */
+void mt_fxdata_ctor(void* obj);
+
 /**
  * @brief Allocates and creates a new task with a `name` and `entry` point.
- * @details Defined in src/kernel/multitask.asm
+ * @details The task is inserted after the current one, and it will start
+ * running when the scheduler reaches it. If `entry` returns, the task calls
+ * mt_exit(). Defined in src/kernel/multitask.asm
  * @param[in] name The name of the new task.
  * @param[in] entry The entry point of the new task.
  * @return Pointer to the new task's context struct (Ctx).
  */
-Ctx* mt_newtask(const char* name, void* entry)
-  __attribute__((warn_unused_result));
+Ctx* mt_newtask(const char* name, void* entry);
 
 /**
  * @brief Switch to task `next`
- * @details Defined in src/kernel/multitask.asm
+ * @details The FPU/SSE registers are not switched, CR0.TS is set instead if
+ * `next` is not mt_fpu_owner. Defined in src/kernel/multitask.asm
  * @param[in] next New task context to switch to.
  */
 void mt_switch(Ctx* next);
 
 /**
  * @brief Frees the stack and ends the task passed as parameter.
- * @details The task should not be the current working task.
+ * @details The task should not be the current working task. For ending the
+ * current task, use mt_exit().
  * @param[out] task Task to kill.
  */
 void mt_endtask(Ctx* task);
@@ -147,13 +255,139 @@ Ctx* mt_gettask(void);
 
 /**
  * @brief Fill the specified fpu_data_t with the current FPU data from fxsave.
- * @details It allocates 512 bytes for fxsave, and it is not optimized. It
+ * @details It uses an object from mt_fxdata_cache for fxsave. It
  * should only be used for specific debugging. The caller should declare the
  * fpu_data_t. Defined in src/kernel/multitask.asm
  * @param[out] dst Pointer to the allocated fpu_data_t that will be filled.
  */
 void mt_get_fpu_data(fpu_data_t* dst);
 
+/**
+ * @brief Give the rest of the time slice of the current task to the next one.
+ * @details The task is moved to a higher MLFQ level, since it didn't use its
+ * whole time slice. Defined in src/kernel/multitask.c
+ * @return False if there is no other task to switch to, or if preemption is
+ * disabled.
+ */
+bool mt_yield(void);
+
+/**
+ * @brief Called by the PIT interrupt on each tick.
+ * @details Decrements the time slice of the current task, and switches to the
+ * next one when it runs out (moving the task to a lower MLFQ level) or when a
+ * task with more priority is ready. Defined in src/kernel/multitask.c
+ */
+void mt_sched_tick(void);
+
+/**
+ * @brief End the current task.
+ * @details The task is marked as dead and freed by the scheduler from another
+ * task. Called when the entry point of a task returns. Defined in
+ * src/kernel/multitask.c
+ */
+void mt_exit(void) __attribute__((noreturn));
+
+/**
+ * @brief Remove the current task from the ring until mt_unblock() is called.
+ * @details Should be called with interrupts disabled, after adding the task to
+ * the structure that will wake it up (e.g. a wait_queue), and with preemption
+ * enabled. Panics otherwise, since the mt_preempt_disable() count is global and
+ * would also apply to the other tasks. Returns when the task runs again, with
+ * interrupts still disabled. Defined in src/kernel/multitask.c
+ */
+void mt_block(void);
+
+/**
+ * @brief Make a task blocked with mt_block() ready again.
+ * @details It's inserted after the current task, and it will preempt it if it
+ * has more priority. Can be called from IRQs. Defined in
+ * src/kernel/multitask.c
+ * @param[inout] task Blocked task.
+ */
+void mt_unblock(Ctx* task);
+
+/**
+ * @brief Block the current task for `ms` milliseconds.
+ * @details The task is woken up by a one-shot kernel timer, see
+ * src/kernel/timer.c. Defined in src/kernel/multitask.c
+ * @param[in] ms Milliseconds (PIT ticks) to sleep.
+ * @return False if the task can't block (multitasking is not initialized,
+ * preemption is disabled or there are no free timers), and nothing was done.
+ */
+bool mt_sleep(uint32_t ms);
+
+/**
+ * @brief Create the task that runs when all the others are blocked.
+ * @details Called by mt_init(). Defined in src/kernel/multitask.c
+ */
+void mt_init_idle(void);
+
+/**
+ * @brief Set the priority of a task.
+ * @details The task will never be in a MLFQ level higher than its priority.
+ * New tasks inherit the priority of their creator. Defined in
+ * src/kernel/multitask.c
+ * @param[inout] task Task to modify.
+ * @param[in] prio From 0 (highest) to MT_PRIO_LEVELS - 1 (lowest).
+ */
+void mt_setprio(Ctx* task, uint32_t prio);
+
+/**
+ * @brief Enable or disable the tickless idle mode.
+ * @details When enabled, the idle task stops the periodic PIT interrupts until
+ * the next kernel timer, instead of waking up on every tick. See pit_oneshot().
+ * Enabled by default. Defined in src/kernel/multitask.c
+ */
+void mt_set_tickless(bool enabled);
+
+/**
+ * @brief Check if the tickless idle mode is enabled.
+ * @details Defined in src/kernel/multitask.c
+ */
+bool mt_get_tickless(void);
+
+/**
+ * @brief Number of interrupts that woke up the idle task since boot.
+ * @details Defined in src/kernel/multitask.c
+ */
+uint32_t mt_get_idle_wakeups(void);
+
+/**
+ * @brief Number of ticks the idle task spent halted since boot.
+ * @details Defined in src/kernel/multitask.c
+ */
+uint64_t mt_get_idle_ticks(void);
+
+/**
+ * @brief Set the time slice of the tasks, in PIT ticks (ms).
+ * @details Used from the next time slice of each task. This is the time slice
+ * of the highest MLFQ level. Defined in
+ * src/kernel/multitask.c
+ * @param[in] ticks New quantum. Zero disables preemption.
+ */
+void mt_set_quantum(uint32_t ticks);
+
+/**
+ * @brief Get the time slice set with mt_set_quantum().
+ * @details Defined in src/kernel/multitask.c
+ */
+uint32_t mt_get_quantum(void);
+
+/**
+ * @brief Don't preempt the current task until mt_preempt_enable().
+ * @details Used for code that modifies global state which is not protected in
+ * any other way (e.g. the heap). Calls can be nested. Defined in
+ * src/kernel/multitask.c
+ */
+void mt_preempt_disable(void);
+
+/**
+ * @brief Undo a call to mt_preempt_disable().
+ * @details If the time slice ran out while preemption was disabled, the
+ * current task yields. Defined in src/kernel/multitask.c
+ */
+void mt_preempt_enable(void);
+
 /**
  * @brief Print the list of tasks starting with the current one.
  * @details Defined in src/kernel/multitask.c
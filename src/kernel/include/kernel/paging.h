@@ -3,13 +3,107 @@
 #define KERNEL_PAGING_H_ 1
 
 #include <stdint.h>
+#include <stdbool.h>
+
+#define DIR_ENTRIES   1024 /* Array size */
+#define TABLE_ENTRIES 1024 /* Array size*/
+#define PAGE_SIZE     4096 /* KiB */
+
+/**
+ * @enum page_dir_flags
+ * @brief Bits for the page directory entries.
+ */
+enum page_dir_flags {
+    PAGEDIR_PRESENT   = 0x01,
+    PAGEDIR_READWRITE = 0x02,
+    PAGEDIR_USER      = 0x04, /* If clear, only supervisor can access page */
+    PAGEDIR_PWT       = 0x08,
+    PAGEDIR_PCD       = 0x10,
+    PAGEDIR_ACCESSED  = 0x20,
+    PAGEDIR_AVL0      = 0x40, /* Unused */
+    PAGEDIR_PAGESZ    = 0x80, /* If set, pages are 4MiB. Otherwise, 4KiB */
+    /* Bits 09..11 of entry are available */
+    /* Bits 12..31 of entry are bits 12..31 of the page frame address */
+};
+
+/**
+ * @enum page_tab_flags
+ * @brief Bits for the page table entries.
+ */
+enum page_tab_flags {
+    PAGETAB_PRESENT   = 0x001,
+    PAGETAB_READWRITE = 0x002,
+    PAGETAB_USER      = 0x004,
+    PAGETAB_PWT       = 0x008,
+    PAGETAB_PCD       = 0x010,
+    PAGETAB_ACCESSED  = 0x020,
+    PAGETAB_DIRTY     = 0x040, /* It has been written to */
+    PAGETAB_PAT       = 0x080, /* Page attribute table */
+    PAGETAB_GLOBAL    = 0x100,
+    /* Bits 09..11 of entry are available */
+    /* Bits 12..31 of entry are bits 12..31 of the page address */
+};
 
 /**
  * @brief Initialize the page directory and first table, call paging_load() and
  * paging_enable()
+ * @details If ENABLE_PSE is defined and the CPU supports it, the memory is
+ * mapped with 4MiB pages, and only the regions that need different permissions
+ * (.rodata) use 4KiB page tables. The page tables are allocated with
+ * frame_alloc(), so frame_init() should be called first.
  */
 void paging_init(void);
 
+/**
+ * @brief Map the page of `vaddr` to the physical frame of `paddr`.
+ * @details If there is no page table for `vaddr`, a new one is allocated with
+ * frame_alloc(). The TLB entry for `vaddr` is invalidated.
+ * @param[in] vaddr Virtual address of the page. Will be aligned down.
+ * @param[in] paddr Physical address of the frame. Will be aligned down.
+ * @param[in] flags Bits from the page_tab_flags enum. PAGETAB_PRESENT is
+ * always added.
+ * @return False if the page table could not be allocated.
+ */
+bool paging_map(void* vaddr, uint32_t paddr, uint32_t flags);
+
+/**
+ * @brief Remove the mapping of the page of `vaddr`.
+ * @details Accessing the page after this will cause a page fault. The frame is
+ * not freed.
+ * @param[in] vaddr Virtual address of the page. Will be aligned down.
+ */
+void paging_unmap(void* vaddr);
+
+/**
+ * @brief Change the cache bits of the pages in a region.
+ * @details The memory type of each page is selected from the PAT with the PAT,
+ * PCD and PWT bits. 4MiB pages fully inside the region are kept, the rest are
+ * split. See src/kernel/memtype.c
+ * @param[in] vaddr Start of the region.
+ * @param[in] size Size in bytes of the region.
+ * @param[in] flags Combination of PAGETAB_PWT, PAGETAB_PCD and PAGETAB_PAT.
+ * Other bits are ignored.
+ * @return False if part of the region is not mapped, or if a page table could
+ * not be allocated.
+ */
+bool paging_set_cache(void* vaddr, uint32_t size, uint32_t flags);
+
+/**
+ * @brief Allocate `n` physically contiguous pages.
+ * @details The pages are identity mapped, present and writable.
+ * @param[in] n Number of pages.
+ * @return Pointer to the first page, or NULL if there is not enough memory.
+ */
+void* paging_alloc_pages(uint32_t n) __attribute__((warn_unused_result));
+
+/**
+ * @brief Free `n` pages returned by paging_alloc_pages().
+ * @details Will ignore NULL.
+ * @param[in] ptr Pointer returned by paging_alloc_pages().
+ * @param[in] n Number of pages used in the allocation.
+ */
+void paging_free_pages(void* ptr, uint32_t n);
+
 /**
  * @brief Display layout of current pages in memory.
  */
@@ -30,4 +124,12 @@ void paging_load(uint32_t* page_dir);
  */
 void paging_enable(void);
 
+/**
+ * @brief Enables 4MiB pages.
+ * @details Sets CR4.PSE[bit 4]. Should only be called if the CPU supports PSE.
+ *
+ * Defined in src/kernel/paging.asm
+ */
+void paging_enable_pse(void);
+
 #endif /* KERNEL_PAGING_H_ */
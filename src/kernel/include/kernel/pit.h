@@ -3,6 +3,7 @@
 #define KERNEL_PIT_H_ 1
 
 #include <stdint.h>
+#include <stdbool.h>
 
 /**
  * @def PIT_BASE_FREQ
@@ -55,6 +56,26 @@ enum pit_cmd_flags {
     PIT_FLAG_BINARY_BCD = 0x1,
 };
 
+/**
+ * @def PIT_READBACK_CHANNEL_0
+ * @brief Read-back command that latches both the status and the count of
+ * channel 0. Uses the PIT_FLAG_CHANNEL_3 bits.
+ */
+#define PIT_READBACK_CHANNEL_0 0xC2
+
+/**
+ * @def PIT_STATUS_OUT
+ * @brief Bit of the read-back status with the state of the OUT pin. In the
+ * interrupt mode, it's set once the count reaches zero.
+ */
+#define PIT_STATUS_OUT 0x80
+
+/**
+ * @def PIT_STATUS_NULL_COUNT
+ * @brief Bit of the read-back status set if the new count was not loaded yet.
+ */
+#define PIT_STATUS_NULL_COUNT 0x40
+
 /**
  * @brief Initialize the programmable interval timer with the specified
  * frequency in hz.
@@ -80,6 +101,9 @@ void pit_dec(void);
 /**
  * @brief increase the current tick count.
  * @details Called from the PIT interrupt, on: src/kernel/idt.asm
+ *
+ * If the interrupt is the end of a one-shot, adds all the ticks that passed
+ * since pit_oneshot() and goes back to the periodic interrupts.
  */
 void pit_inc(void);
 
@@ -90,6 +114,26 @@ void pit_inc(void);
  */
 void pit_set_ticks(uint64_t num);
 
+/**
+ * @brief Start measuring the ticks lost while interrupts are disabled.
+ * @details For code that needs interrupts disabled for more than a tick. Should
+ * be called with interrupts disabled. See pit_add_lost_ticks().
+ * @return Value for pit_add_lost_ticks().
+ */
+uint32_t pit_lost_ticks_start(void);
+
+/**
+ * @brief Add the ticks that IRQ 0 couldn't count while interrupts were
+ * disabled.
+ * @details Should be called before enabling interrupts again. The interrupt
+ * that stays pending in the PIC is not added, since it will be handled.
+ * Nothing is done in one-shot mode.
+ * @param[in] start Value returned by pit_lost_ticks_start().
+ * @param[in] cycles PIT cycles since pit_lost_ticks_start(), measured in some
+ * other way (e.g. with channel 2). Errors of less than half a tick are fine.
+ */
+void pit_add_lost_ticks(uint32_t start, uint32_t cycles);
+
 /**
  * @brief Returns the current PIT tick count.
  * @details Called from the sleep functions for checking if the ticks we set
@@ -98,4 +142,37 @@ void pit_set_ticks(uint64_t num);
  */
 uint64_t pit_get_ticks(void);
 
+/**
+ * @brief Returns the time since boot in PIT cycles (PIT_BASE_FREQ hz).
+ * @details Combines the tick count with the current count of channel 0, so it
+ * has a resolution of ~838ns instead of a whole tick. Used by the clocksource
+ * when there is no TSC, see src/kernel/clock.c
+ * @return PIT cycles since boot.
+ */
+uint64_t pit_get_cycles(void);
+
+/**
+ * @brief Maximum number of ticks that can be used in pit_oneshot().
+ */
+uint32_t pit_oneshot_max(void);
+
+/**
+ * @brief Stop the periodic interrupts, and generate a single one after
+ * `nticks`.
+ * @details Used by the idle task for sleeping until the next kernel timer
+ * instead of waking up on each tick. The ticks are not incremented in one-shot
+ * mode, they are reconstructed from the PIT count once it ends. Should be
+ * called with interrupts disabled.
+ * @param[in] nticks Ticks until the interrupt. Clamped to pit_oneshot_max().
+ * @return False if nothing was done, and the periodic interrupts continue.
+ */
+bool pit_oneshot(uint32_t nticks);
+
+/**
+ * @brief End the one-shot early and go back to the periodic interrupts.
+ * @details Used when another interrupt woke up the idle task. Adds the ticks
+ * that passed since pit_oneshot(). Should be called with interrupts disabled.
+ */
+void pit_oneshot_end(void);
+
 #endif /* KERNEL_PIT_H_ */
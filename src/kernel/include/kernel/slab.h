@@ -0,0 +1,80 @@
+#ifndef KERNEL_SLAB_H_
+#define KERNEL_SLAB_H_ 1
+
+#include <stdint.h>
+#include <stddef.h>
+
+/**
+ * @def SLAB_BYTES
+ * @brief Minimum size in bytes of each slab we allocate from the heap.
+ * @details Caches with objects bigger than this will use slabs of 1 object.
+ */
+#define SLAB_BYTES 0x4000
+
+/**
+ * @def SLAB_NAME_SZ
+ * @brief Max size of the name of a cache, including the null terminator.
+ */
+#define SLAB_NAME_SZ 16
+
+typedef struct kmem_cache kmem_cache;
+
+/**
+ * @struct kmem_cache
+ * @brief Cache of preconstructed objects of the same size.
+ * @details Objects are carved from slabs allocated from the heap. Each object
+ * is followed by a pointer to the next free object, so the object itself is not
+ * modified while it is in the free list and keeps its constructed state.
+ */
+struct kmem_cache {
+    kmem_cache* next;            /**< @brief Next cache in the global list */
+    char name[SLAB_NAME_SZ];     /**< @brief Name used by kmem_cache_dump() */
+    size_t obj_sz;               /**< @brief Size of each object */
+    size_t align;                /**< @brief Alignment of each object */
+    size_t stride;               /**< @brief Bytes between objects in a slab */
+    uint32_t slab_objs;          /**< @brief Number of objects per slab */
+    void (*ctor)(void* obj);     /**< @brief Constructor. Can be NULL */
+    void* free_list;             /**< @brief First free object */
+    uint32_t slabs;              /**< @brief Slabs allocated for this cache */
+    uint32_t free_objs;          /**< @brief Objects in the free list */
+};
+
+/**
+ * @brief Create a new object cache.
+ * @details The cache struct itself is allocated from the heap. Caches are never
+ * destroyed.
+ * @param[in] name Name of the cache, for debugging. Will be truncated to
+ * SLAB_NAME_SZ.
+ * @param[in] obj_sz Size in bytes of each object.
+ * @param[in] align Alignment of each object. If 0, the pointer size is used.
+ * @param[in] ctor Function called once for each object when its slab is
+ * allocated. Can be NULL.
+ * @return Pointer to the new cache.
+ */
+kmem_cache* kmem_cache_create(const char* name, size_t obj_sz, size_t align,
+                              void (*ctor)(void* obj));
+
+/**
+ * @brief Get a constructed object from the cache.
+ * @details If there are no free objects, a new slab is allocated from the heap
+ * and all of its objects are constructed.
+ * @param[inout] cache The cache to allocate from.
+ * @return Pointer to the object.
+ */
+void* kmem_cache_alloc(kmem_cache* cache) __attribute__((warn_unused_result));
+
+/**
+ * @brief Return an object to its cache.
+ * @details The object should be returned in its constructed state, since the
+ * constructor will not be called again when it's reused. Will ignore NULL.
+ * @param[inout] cache The cache the object was allocated from.
+ * @param[in] obj Pointer to the object.
+ */
+void kmem_cache_free(kmem_cache* cache, void* obj);
+
+/**
+ * @brief Print the information of all the created caches.
+ */
+void kmem_cache_dump(void);
+
+#endif /* KERNEL_SLAB_H_ */
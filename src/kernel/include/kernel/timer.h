@@ -0,0 +1,99 @@
+#ifndef KERNEL_TIMER_H_
+#define KERNEL_TIMER_H_ 1
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/**
+ * @def TIMER_MAX
+ * @brief Number of timers that can be armed at the same time.
+ * @details The timers are allocated from a static pool, so they can be added
+ * and removed from the callbacks (inside the PIT interrupt).
+ */
+#define TIMER_MAX 64
+
+/**
+ * @def TIMER_NONE
+ * @brief Returned by timer_add() on failure. Never a valid timer_id.
+ */
+#define TIMER_NONE 0
+
+/**
+ * @def TIMER_WHEEL_LEVELS
+ * @brief Levels of the hierarchical timer wheel.
+ */
+#define TIMER_WHEEL_LEVELS 4
+
+/**
+ * @def TIMER_WHEEL_BITS
+ * @brief Each level has (1 << TIMER_WHEEL_BITS) slots.
+ * @details Level N holds the timers that expire in less than
+ * 2^(TIMER_WHEEL_BITS * (N + 1)) ticks, so 4 levels of 64 slots cover 2^24 ms
+ * (more than 4 hours). Longer timers are clamped to that.
+ */
+#define TIMER_WHEEL_BITS 6
+
+/**
+ * @brief Function called when a timer expires.
+ * @details Called from the PIT interrupt with interrupts disabled, so it should
+ * be short and it can't block.
+ * @param[inout] data Pointer passed to timer_add().
+ */
+typedef void (*timer_func)(void* data);
+
+/**
+ * @brief Identifier of an armed timer.
+ * @details Includes a generation number, so an old identifier of a one-shot
+ * timer that already expired won't match a new timer.
+ */
+typedef uint32_t timer_id;
+
+/**
+ * @brief Initialize the pool of timers and the wheel.
+ */
+void timer_init(void);
+
+/**
+ * @brief Arm a kernel timer.
+ * @details Can be called from other timer callbacks. O(1).
+ * @param[in] ms Milliseconds (PIT ticks) until the timer expires.
+ * @param[in] callback Function to call when it expires.
+ * @param[in] data Argument for `callback`.
+ * @param[in] periodic If true, the timer is armed again with the same `ms`
+ * each time it expires, without drifting.
+ * @return Identifier of the timer, or TIMER_NONE if there are no free timers.
+ */
+timer_id timer_add(uint32_t ms, timer_func callback, void* data,
+                   bool periodic);
+
+/**
+ * @brief Disarm a timer.
+ * @details Can be called from timer callbacks, including the timer's own. O(1).
+ * @param[in] id Timer returned by timer_add().
+ * @return False if the timer was not armed (e.g. one-shot that expired).
+ */
+bool timer_cancel(timer_id id);
+
+/**
+ * @brief Run the timers that expired until the current PIT tick.
+ * @details Called from the PIT interrupt. Each tick costs O(1), plus moving the
+ * timers of a higher level to the lower ones once every 64 ticks, which happens
+ * at most TIMER_WHEEL_LEVELS - 1 times for each timer.
+ */
+void timer_tick(void);
+
+/**
+ * @brief Ticks until timer_tick() has something to do.
+ * @details Used by the idle task for programming a one-shot PIT interrupt.
+ * Might return earlier than the real expiration of a timer, never later.
+ * @param[in] max Value returned if nothing happens in the next `max` ticks.
+ * @return Ticks from now, or 0 if timer_tick() is late.
+ */
+uint32_t timer_next_deadline(uint32_t max);
+
+/**
+ * @brief Number of timers currently armed.
+ */
+uint32_t timer_get_armed(void);
+
+#endif /* KERNEL_TIMER_H_ */
@@ -2,6 +2,10 @@
 #ifndef KERNEL_UTIL_H_
 #define KERNEL_UTIL_H_ 1
 
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
 /**
  * @brief Dump N elements of S size from the stack
  * @details Defined in src/kernel/util.asm
@@ -40,4 +44,48 @@ void asm_enable_debug(uint32_t on_branch);
  */
 void asm_disable_debug(uint32_t on_branch);
 
+/**
+ * @brief Check if the CPU supports the Page Attribute Table (PAT).
+ * @details Defined in src/kernel/util.asm
+ * @return True if CPUID.1:EDX.PAT[bit 16] is set.
+ */
+bool is_pat_supported(void);
+
+/**
+ * @brief Check if the CPU supports Memory Type Range Registers (MTRR).
+ * @details Defined in src/kernel/util.asm
+ * @return True if CPUID.1:EDX.MTRR[bit 12] is set.
+ */
+bool is_mtrr_supported(void);
+
+/**
+ * @brief Check if the CPU supports the Time-Stamp Counter (TSC).
+ * @details Defined in src/kernel/util.asm
+ * @return True if CPUID.1:EDX.TSC[bit 4] is set.
+ */
+bool is_tsc_supported(void);
+
+/**
+ * @brief Get the number of bits of the physical addresses (MAXPHYADDR).
+ * @details Defined in src/kernel/util.asm
+ * @return CPUID.80000008H:EAX[bits 7:0], or 36 if that leaf is not supported.
+ */
+uint32_t get_phys_addr_bits(void);
+
+/**
+ * @brief Read a Model Specific Register.
+ * @details Defined in src/kernel/util.asm
+ * @param[in] msr Address of the MSR.
+ * @return Value of the MSR (EDX:EAX).
+ */
+uint64_t msr_read(uint32_t msr);
+
+/**
+ * @brief Write a Model Specific Register.
+ * @details Defined in src/kernel/util.asm
+ * @param[in] msr Address of the MSR.
+ * @param[in] val Value to write (EDX:EAX).
+ */
+void msr_write(uint32_t msr, uint64_t val);
+
 #endif /* KERNEL_UTIL_H_ */
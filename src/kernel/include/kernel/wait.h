@@ -0,0 +1,54 @@
+#ifndef KERNEL_WAIT_H_
+#define KERNEL_WAIT_H_ 1
+
+#include <stddef.h>
+#include <kernel/multitask.h>
+
+/**
+ * @def WAIT_QUEUE_INIT
+ * @brief Initializer for an empty wait_queue.
+ */
+#define WAIT_QUEUE_INIT { NULL, NULL }
+
+/**
+ * @struct wait_queue
+ * @brief FIFO list of tasks blocked until an event happens.
+ * @details The tasks are linked with Ctx.wait_next, so a task can only wait in
+ * one queue at a time.
+ */
+typedef struct wait_queue {
+    Ctx* head; /**< @brief First task to wake up */
+    Ctx* tail; /**< @brief Last task, where new ones are added */
+} wait_queue;
+
+/**
+ * @brief Block the current task until it's woken up from the queue.
+ * @details Should be called with interrupts disabled, after checking the
+ * condition the task waits for, so an IRQ can't wake the queue in between.
+ * Can't be called with preemption disabled, see mt_block(). Returns with
+ * interrupts still disabled. For example:
+ *
+ *     const uint32_t eflags = irq_save();
+ *     while (!condition)
+ *         wq_wait(&queue);
+ *     irq_restore(eflags);
+ *
+ * @param[inout] wq Queue to wait in.
+ */
+void wq_wait(wait_queue* wq);
+
+/**
+ * @brief Wake up the first task of the queue, if any.
+ * @details Can be called from IRQs.
+ * @param[inout] wq Queue to wake.
+ */
+void wq_wake_one(wait_queue* wq);
+
+/**
+ * @brief Wake up all the tasks of the queue.
+ * @details Can be called from IRQs.
+ * @param[inout] wq Queue to wake.
+ */
+void wq_wake_all(wait_queue* wq);
+
+#endif /* KERNEL_WAIT_H_ */
@@ -11,12 +11,17 @@
 #include <kernel/util.h>
 
 #include <kernel/paging.h>              /* paging_init */
+#include <kernel/frame.h>               /* frame_init */
+#include <kernel/memtype.h>             /* memtype_init, memtype_set_wc */
 #include <kernel/heap.h>                /* heap_init */
 #include <kernel/vga.h>                 /* vga_init, vga_sprint */
 #include <kernel/framebuffer.h>         /* fb_init, fb_setpx */
 #include <kernel/framebuffer_console.h> /* fbc_init */
 #include <kernel/idt.h>                 /* idt_init */
 #include <kernel/pit.h>                 /* pit_init */
+#include <kernel/timer.h>               /* timer_init */
+#include <kernel/clock.h>               /* clock_init */
+#include <kernel/boot_trace.h>          /* boot_trace_mark */
 #include <kernel/rand.h>                /* check_rand */
 #include <kernel/rtc.h>                 /* rtc_get_datetime */
 #include <kernel/pcspkr.h>              /* pcspkr_beep */
@@ -28,7 +33,8 @@
 
 #include "../apps/sh/sh.h" /* sh_main */
 
-#include "../media/logo_small.h"
+/* Generated from logo_small.h by the Makefile, see scripts/gimp2fb.py */
+#include "../media/logo_small_fb.h"
 
 #if defined(__linux__)
 #error "You are not using a cross compiler." \
@@ -140,19 +146,33 @@ bool msr_supported = true;
  * DEBUG is defined. */
 bool tsc_supported = true;
 
+/* If false, this machine doesn't support 4MiB pages, and paging_init() will
+ * use 4KiB pages for everything. PSE support is checked in src/kernel/boot.asm
+ * if ENABLE_PSE is defined. */
+bool pse_supported = true;
+
 /**
  * @brief C entry point of the kernel. Called by boot.asm
  * @param mb_info Pointer to the Multiboot information struct from the
  * bootloader.
  */
 void kernel_main(Multiboot* mb_info) {
+    /* Timestamp each stage, we print them once we have a console */
+    boot_trace_start();
+
     idt_init();
+    boot_trace_mark("idt_init");
+    frame_init(mb_info);
+    boot_trace_mark("frame_init");
     paging_init();
+    boot_trace_mark("paging_init");
     heap_init();
+    boot_trace_mark("heap_init");
 
     /* Currently unused */
     vga_init();
     vga_print("VGA terminal initialized.\n");
+    boot_trace_mark("vga_init");
 
     if (mb_info->framebuffer_type != FB_TYPE_RGB) {
         vga_setcol(VGA_COLOR_RED, VGA_COLOR_BLACK);
@@ -161,20 +181,43 @@ void kernel_main(Multiboot* mb_info) {
     }
 
     mt_init();
-
-    fb_init((uint32_t*)(uint32_t)mb_info->framebuffer_addr,
-            mb_info->framebuffer_pitch, mb_info->framebuffer_width,
-            mb_info->framebuffer_height, mb_info->framebuffer_bpp);
+    boot_trace_mark("mt_init");
+
+    /* Make the framebuffer write-combining before we start drawing to it */
+    memtype_init();
+    const enum memtype_method fb_wc =
+      memtype_set_wc((void*)(uint32_t)mb_info->framebuffer_addr,
+                     mb_info->framebuffer_pitch * mb_info->framebuffer_height);
+    boot_trace_mark("memtype_init");
+
+    const fb_format fb_fmt = {
+        .bpp    = mb_info->framebuffer_bpp,
+        .r_pos  = mb_info->framebuffer_red_field_position,
+        .r_size = mb_info->framebuffer_red_mask_size,
+        .g_pos  = mb_info->framebuffer_green_field_position,
+        .g_size = mb_info->framebuffer_green_mask_size,
+        .b_pos  = mb_info->framebuffer_blue_field_position,
+        .b_size = mb_info->framebuffer_blue_mask_size,
+    };
+
+    if (!fb_init((void*)(uint32_t)mb_info->framebuffer_addr,
+                 mb_info->framebuffer_pitch, mb_info->framebuffer_width,
+                 mb_info->framebuffer_height, &fb_fmt)) {
+        vga_setcol(VGA_COLOR_RED, VGA_COLOR_BLACK);
+        vga_print("Error. Unsupported framebuffer bits per pixel.\n");
+        abort();
+    }
     vga_print("Framebuffer initialized.\n");
+    boot_trace_mark("fb_init");
 
     /* Draw the 3 logos on top */
     const uint32_t logo_y = 3;
     const uint32_t logo_x = 3;
-    const uint32_t logo_h = fsos_logo_s.h;
-    const uint32_t logo_w = fsos_logo_s.w;
-    fb_drawimage(logo_y, logo_x + (logo_w * 0), &fsos_logo_s);
-    fb_drawimage(logo_y, logo_x + (logo_w * 1), &fsos_logo_s);
-    fb_drawimage(logo_y, logo_x + (logo_w * 2), &fsos_logo_s);
+    const uint32_t logo_h = fsos_logo_s_fb.h;
+    const uint32_t logo_w = fsos_logo_s_fb.w;
+    fb_drawimage_fb(logo_y, logo_x + (logo_w * 0), &fsos_logo_s_fb);
+    fb_drawimage_fb(logo_y, logo_x + (logo_w * 1), &fsos_logo_s_fb);
+    fb_drawimage_fb(logo_y, logo_x + (logo_w * 2), &fsos_logo_s_fb);
 
     /* Get framebuffer console pos and size and initialize it */
     const uint32_t fbc_margin = 3;
@@ -183,18 +226,42 @@ void kernel_main(Multiboot* mb_info) {
     const uint32_t fbc_h      = fb_get_height() - fbc_y - fbc_margin;
     const uint32_t fbc_w      = fb_get_width() - (fbc_margin * 2);
     fbc_init(fbc_y, fbc_x, fbc_h, fbc_w, &main_font);
+    boot_trace_mark("fbc_init");
 
     /* Once we have a framebuffer terminal, print previous messages too */
     LOAD_INFO("IDT initialized.");
+    LOAD_INFO("Frame allocator initialized.");
     LOAD_INFO("Paging initialized.");
     LOAD_INFO("Heap initialized.");
     LOAD_INFO("Multitasking initialized.");
     LOAD_INFO("Framebuffer initialized.");
+    if (fb_wc != MEMTYPE_NONE) {
+        LOAD_INFO("Framebuffer mapped as write-combining (%s).",
+                  memtype_method_str(fb_wc));
+    } else {
+        LOAD_IGNORE("Write-combining not supported for the framebuffer.");
+    }
     LOAD_INFO("Framebuffer console initialized.");
 
     /* Init PIT with 1ms interval (1/1000 of a sec) */
     pit_init(1000);
     LOAD_INFO("PIT initialized.");
+    boot_trace_mark("pit_init");
+
+    /* Kernel timers, run from the PIT interrupt */
+    timer_init();
+    LOAD_INFO("Kernel timers initialized.");
+    boot_trace_mark("timer_init");
+
+    /* Calibrate the TSC with the PIT, before anyone uses the PC speaker */
+    clock_init();
+    boot_trace_mark("clock_init");
+    if (clock_is_tsc()) {
+        LOAD_INFO("Clocksource: TSC at %ldMHz.",
+                  (uint32_t)(clock_get_freq() / 1000000));
+    } else {
+        LOAD_IGNORE("TSC not supported, using the PIT as clocksource.");
+    }
 
     if (!check_rdseed()) {
         LOAD_IGNORE("RDSEED not supported.");
@@ -203,6 +270,13 @@ void kernel_main(Multiboot* mb_info) {
     if (!check_rdrand()) {
         LOAD_IGNORE("RDRAND not supported.");
     }
+    boot_trace_mark("rand checks");
+
+#if defined(ENABLE_PSE)
+    if (!pse_supported) {
+        LOAD_IGNORE("PSE not supported, using 4KiB pages.");
+    }
+#endif
 
     if (!sse_supported) {
         LOAD_ERROR("SSE/SSE2 not supported on this machine. Please re-compile "
@@ -225,13 +299,27 @@ void kernel_main(Multiboot* mb_info) {
     kb_setlayout(&us_layout);
     kb_getchar_init();
     LOAD_INFO("Keyboard initialized.");
+    boot_trace_mark("kb_init");
+
+    if (clock_is_tsc()) {
+        uint64_t boot_ns = 0;
+        for (uint32_t i = 0; i < boot_trace_count(); i++)
+            boot_ns += boot_trace_ns(i);
+
+        /* Each stage is shown by the boot_trace command */
+        LOAD_INFO("Kernel initialized in %ldms.",
+                  (uint32_t)(boot_ns / 1000000));
+    }
     putchar('\n');
 
     LOAD_INFO("System info:");
     SYSTEM_INFO("Kernel:\t\t", "%p - %p", &_start, &_bss_end);
-    SYSTEM_INFO("Memory:\t\t", "%ldMiB", mb_info->mem_upper / 1024);
-    SYSTEM_INFO("Resolution:\t", "%ldx%ld", mb_info->framebuffer_width,
-                mb_info->framebuffer_height);
+    SYSTEM_INFO("Memory:\t\t", "%ldMiB (%ldMiB free)",
+                mb_info->mem_upper / 1024,
+                frame_get_free() / (0x100000 / FRAME_SIZE));
+    SYSTEM_INFO("Resolution:\t", "%ldx%ld (%ld bpp)",
+                mb_info->framebuffer_width, mb_info->framebuffer_height,
+                fb_get_bpp());
     SYSTEM_INFO("Font:\t\t", main_font.name);
 
     /* "00/00/00 - 00:00:00" */
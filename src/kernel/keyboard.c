@@ -5,6 +5,9 @@
 #include <stdlib.h>
 #include <kernel/keyboard.h>
 #include <kernel/io.h>
+#include <kernel/wait.h>
+#include <kernel/idt.h>                 /* irq_save, irq_restore */
+#include <kernel/framebuffer_console.h> /* fbc_flush, fbc_scroll_view */
 
 /**
  * @brief Keyboard source
@@ -91,6 +94,11 @@ static bool wait_for_eol = true;
  */
 static volatile bool getting_char = false;
 
+/**
+ * @brief Tasks blocked in kb_getchar(), woken when getchar_buf is filled.
+ */
+static wait_queue getchar_wq = WAIT_QUEUE_INIT;
+
 /**
  * @name Buffers for the getchar functions.
  * @details Since kb_handler only reads 8 bit chars, we don't need bigger
@@ -121,6 +129,25 @@ static inline void check_special(bool released, uint8_t key) {
     }
 }
 
+/**
+ * @brief Scroll the console if \p key is PgUp or PgDn. Used with shift held.
+ * @details Half a screen each time, see fbc_scroll_view().
+ * @param key Key to be checked
+ * @return True if the key was used for scrolling
+ */
+static inline bool check_scrollback(uint8_t key) {
+    const int32_t rows = fbc_get_ctx()->ch_h / 2;
+
+    if (key == cur_layout->special[KB_SPECIAL_IDX_PAGE_UP])
+        fbc_scroll_view(rows);
+    else if (key == cur_layout->special[KB_SPECIAL_IDX_PAGE_DOWN])
+        fbc_scroll_view(-rows);
+    else
+        return false;
+
+    return true;
+}
+
 /**
  * @brief Returns the shift or normal keyboard layout depending if the shift is
  * pressed or not.
@@ -157,6 +184,10 @@ void kb_handler(void) {
     /* Check if we should toggle global variables for caps, etc. */
     check_special(released, key);
 
+    /* Shift+PgUp and Shift+PgDn are only used for the console scrollback */
+    if (!released && shift_held && check_scrollback(key))
+        KB_HANDLER_RETURN();
+
     /* Check if we need to use an alternative layout when using shift, ctrl,
      * etc. */
     const unsigned char* final_layout = get_layout();
@@ -180,11 +211,15 @@ void kb_handler(void) {
     if (!getting_char)
         KB_HANDLER_RETURN();
 
+    /* Go back to the last rows of the console when typing */
+    fbc_reset_view();
+
     /* If this variable is not set, kb_raw has been called. kb_getchar will need
      * to return each character inmediately, so we don't use the line buffer. */
     if (!wait_for_eol) {
         /* getchar_buf_pos will always be 0. See kb_getchar comment */
         getchar_buf[getchar_buf_pos++] = final_key;
+        wq_wake_all(&getchar_wq);
 
         /* We don't use line buffer, we just print here and return */
         if (print_chars)
@@ -209,6 +244,7 @@ void kb_handler(void) {
 
         getchar_buf_pos      = 0; /* Not needed */
         getchar_line_buf_pos = 0;
+        wq_wake_all(&getchar_wq);
 
         putchar(final_key);
     } else if (final_key == '\b') {
@@ -283,13 +319,26 @@ void kb_getchar_init(void) {
 }
 
 int kb_getchar(void) {
+    /* Show what the program printed before waiting for the user */
+    fbc_flush();
+
     /* Tell the keyboard handler to store the key presses */
     getting_char = true;
 
-    /* Wait until we read a valid char */
-    volatile int8_t* tmp = &getchar_buf[getchar_buf_pos];
-    while (*tmp == EOF)
-        ;
+    /* Wait until we read a valid char. The task is blocked until kb_handler
+     * fills the buffer, which also keeps it in the high MLFQ levels. Interrupts
+     * are disabled so the char can't arrive between the check and the wait. */
+    volatile int8_t* tmp  = &getchar_buf[getchar_buf_pos];
+    const uint32_t eflags = irq_save();
+    while (*tmp == EOF) {
+        if (mt_current_task != NULL)
+            wq_wait(&getchar_wq);
+        else
+            asm("sti\n\t"
+                "hlt\n\t"
+                "cli");
+    }
+    irq_restore(eflags);
 
     int c                        = getchar_buf[getchar_buf_pos];
     getchar_buf[getchar_buf_pos] = EOF;
@@ -0,0 +1,223 @@
+/**
+ * @brief Memory types (caching) of physical regions with the PAT and MTRRs.
+ *
+ * See Intel SDM Vol. 3, Chapter 11.11 (MTRRs) and Chapter 11.12 (PAT).
+ *
+ * @file
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <kernel/memtype.h>
+#include <kernel/idt.h> /* irq_save, irq_restore */
+#include <kernel/paging.h>
+#include <kernel/util.h>
+
+/** @brief Valid bit of the PHYSMASKn registers */
+#define MTRR_MASK_VALID (1ULL << 11)
+
+/** @brief Enable bit of the MTRR_DEF_TYPE register */
+#define MTRR_DEF_ENABLE (1ULL << 11)
+
+/** @brief Write-combining support bit of the MTRR_CAP register */
+#define MTRR_CAP_WC (1ULL << 10)
+
+/** @brief Size of the smallest range that a variable MTRR can cover */
+#define MTRR_MIN_RANGE 0x1000
+
+/** @brief Variable MTRRs that fit in used_mtrrs */
+#define MTRR_MAX_VAR 32
+
+static bool pat_supported  = false;
+static bool mtrr_supported = false;
+
+/**
+ * @brief Address bits used in the PHYSBASEn and PHYSMASKn registers.
+ * @details From MAXPHYADDR, see memtype_init(). Setting the reserved bits above
+ * it is not allowed.
+ */
+static uint64_t mtrr_addr_mask = 0;
+
+/** @brief Bit N is set if variable MTRR N is used by memtype_set_wc() */
+static uint32_t used_mtrrs = 0;
+
+/*----------------------------------------------------------------------------*/
+
+static inline uint32_t get_cr0(void) {
+    uint32_t ret;
+    asm volatile("mov %0, cr0" : "=r"(ret));
+    return ret;
+}
+
+static inline void set_cr0(uint32_t val) {
+    asm volatile("mov cr0, %0" : : "r"(val) : "memory");
+}
+
+static inline void flush_tlb(void) {
+    asm volatile("mov eax, cr3\n\t"
+                 "mov cr3, eax"
+                 :
+                 :
+                 : "eax", "memory");
+}
+
+/**
+ * @brief Write a variable MTRR pair following the steps of the SDM.
+ * @details See Vol. 3, Chapter 11.11.7.2 (MemTypeSet)
+ */
+static void mtrr_write(int idx, uint64_t base, uint64_t mask) {
+    const uint32_t eflags = irq_save();
+
+    /* Enter no-fill cache mode: Set CR0.CD[bit 30], clear CR0.NW[bit 29] */
+    const uint32_t old_cr0 = get_cr0();
+    set_cr0((old_cr0 | (1 << 30)) & ~(1 << 29));
+    asm volatile("wbinvd" : : : "memory");
+    flush_tlb();
+
+    /* Disable the MTRRs while we change them */
+    const uint64_t def_type = msr_read(MSR_MTRR_DEF_TYPE);
+    msr_write(MSR_MTRR_DEF_TYPE, def_type & ~MTRR_DEF_ENABLE);
+
+    msr_write(MSR_MTRR_PHYSBASE0 + idx * 2, base);
+    msr_write(MSR_MTRR_PHYSMASK0 + idx * 2, mask);
+
+    asm volatile("wbinvd" : : : "memory");
+    flush_tlb();
+
+    msr_write(MSR_MTRR_DEF_TYPE, def_type);
+    set_cr0(old_cr0);
+
+    irq_restore(eflags);
+}
+
+/**
+ * @brief Size of the biggest range that a variable MTRR can cover from `base`
+ * without going past `end`.
+ * @details The size of the range should be a power of 2, and the base should
+ * be aligned to it. Both `base` and `end` should be aligned to MTRR_MIN_RANGE.
+ */
+static uint64_t mtrr_range_at(uint64_t base, uint64_t end) {
+    /* Biggest power of 2 that the base is aligned to: its lowest set bit */
+    uint64_t range = (base == 0) ? (1ULL << 32) : (base & -base);
+    while (range > end - base)
+        range >>= 1;
+
+    return range;
+}
+
+/**
+ * @brief Use free variable MTRRs for making a region write-combining.
+ * @details The region is split in ranges that a single MTRR can cover, so only
+ * its pages are changed. Either all the ranges are set, or none of them.
+ * @return True if the region could be covered.
+ */
+static bool mtrr_set_wc(uint32_t addr, uint32_t size) {
+    const uint64_t cap = msr_read(MSR_MTRR_CAP);
+    if (!(cap & MTRR_CAP_WC) || size == 0)
+        return false;
+
+    /* The pages of the region */
+    const uint64_t start = addr & ~(uint64_t)(MTRR_MIN_RANGE - 1);
+    const uint64_t end   = ((uint64_t)addr + size + MTRR_MIN_RANGE - 1) &
+                         ~(uint64_t)(MTRR_MIN_RANGE - 1);
+
+    /* Find the free variable MTRRs. VCNT is in bits 0..7 of MTRR_CAP */
+    int vcnt = cap & 0xFF;
+    if (vcnt > MTRR_MAX_VAR)
+        vcnt = MTRR_MAX_VAR;
+
+    uint32_t free_mtrrs = 0;
+    int free_count      = 0;
+    for (int i = 0; i < vcnt; i++) {
+        if (!(msr_read(MSR_MTRR_PHYSMASK0 + i * 2) & MTRR_MASK_VALID)) {
+            free_mtrrs |= 1U << i;
+            free_count++;
+        }
+    }
+
+    /* Count the ranges first, so we don't leave the region half done */
+    int needed = 0;
+    for (uint64_t base = start; base < end; base += mtrr_range_at(base, end))
+        needed++;
+
+    if (needed > free_count)
+        return false;
+
+    int i = 0;
+    for (uint64_t base = start; base < end;) {
+        const uint64_t range = mtrr_range_at(base, end);
+
+        while (!(free_mtrrs & (1U << i)))
+            i++;
+
+        mtrr_write(i, base | MEMTYPE_WC,
+                   (~(range - 1) & mtrr_addr_mask) | MTRR_MASK_VALID);
+        used_mtrrs |= 1U << i;
+
+        i++;
+        base += range;
+    }
+
+    return true;
+}
+
+/*----------------------------------------------------------------------------*/
+
+void memtype_init(void) {
+    pat_supported  = is_pat_supported();
+    mtrr_supported = is_mtrr_supported();
+
+    /* Bits MAXPHYADDR..63 of the MTRRs are reserved */
+    mtrr_addr_mask = ((1ULL << get_phys_addr_bits()) - 1) &
+                     ~(uint64_t)(MTRR_MIN_RANGE - 1);
+
+    if (!pat_supported)
+        return;
+
+    /* Each byte of the PAT MSR is an entry, selected by the PAT, PCD and PWT
+     * bits of the page (in that order). The default entry 1 is WT, replace it
+     * with WC. */
+    uint64_t pat = msr_read(MSR_PAT);
+    pat &= ~(0xFFULL << 8);
+    pat |= (uint64_t)MEMTYPE_WC << 8;
+
+    asm volatile("wbinvd" : : : "memory");
+    msr_write(MSR_PAT, pat);
+    asm volatile("wbinvd" : : : "memory");
+    flush_tlb();
+}
+
+enum memtype_method memtype_set_wc(void* addr, uint32_t size) {
+    /* PAT entry 1 is selected with PWT, see memtype_init() */
+    if (pat_supported && paging_set_cache(addr, size, PAGETAB_PWT))
+        return MEMTYPE_PAT;
+
+    if (mtrr_supported && mtrr_set_wc((uint32_t)addr, size))
+        return MEMTYPE_MTRR;
+
+    return MEMTYPE_NONE;
+}
+
+void memtype_set_default(void* addr, uint32_t size) {
+    if (pat_supported)
+        paging_set_cache(addr, size, 0);
+
+    for (int i = 0; i < MTRR_MAX_VAR; i++)
+        if (used_mtrrs & (1U << i))
+            mtrr_write(i, 0, 0);
+
+    used_mtrrs = 0;
+}
+
+const char* memtype_method_str(enum memtype_method method) {
+    switch (method) {
+        case MEMTYPE_PAT:
+            return "PAT";
+        case MEMTYPE_MTRR:
+            return "MTRR";
+        case MEMTYPE_NONE:
+        default:
+            return "None";
+    }
+}
@@ -5,15 +5,30 @@ section .bss
     global mt_current_task
     mt_current_task: resd 1
 
+    ; Task whose FPU/SSE state is currently loaded in the registers, or NULL.
+    ; See mt_switch and exc_7 (src/kernel/idt.asm)
+    global mt_fpu_owner
+    mt_fpu_owner: resd 1
+
+    ; Number of times exc_7 had to restore the FPU/SSE state of a task
+    global mt_fpu_traps
+    mt_fpu_traps: resd 1
+
     first_ctx:              ; Reserve the bytes, filled in mt_init
         istruc ctx_t
-            at ctx_t.next,   resd 1
-            at ctx_t.prev,   resd 1
-            at ctx_t.stack,  resd 1
-            at ctx_t.esp,    resd 1
-            at ctx_t.cr3,    resd 1
-            at ctx_t.fxdata, resd 1
-            at ctx_t.name,   resd 1
+            at ctx_t.next,      resd 1
+            at ctx_t.prev,      resd 1
+            at ctx_t.stack,     resd 1
+            at ctx_t.esp,       resd 1
+            at ctx_t.cr3,       resd 1
+            at ctx_t.fxdata,    resd 1
+            at ctx_t.name,      resd 1
+            at ctx_t.state,     resd 1
+            at ctx_t.quantum,   resd 1
+            at ctx_t.data,      resd 1
+            at ctx_t.priority,  resd 1
+            at ctx_t.level,     resd 1
+            at ctx_t.wait_next, resd 1
         iend
 
     ; 512 bytes needed by fxsave. Reserved here instead of heap.
@@ -25,10 +40,17 @@ section .data
 
 section .text
     extern stack_bottom         ; src/kernel/boot.asm
-    extern memcpy:function      ; src/libk/string.c
-    extern heap_alloc:function  ; src/kernel/heap.c
-    extern heap_calloc:function ; src/kernel/heap.c
-    extern free:function        ; src/libk/stdlib.c
+    extern memcpy:function              ; src/libk/string.c
+    extern kmem_cache_alloc:function    ; src/kernel/slab.c
+    extern kmem_cache_free:function     ; src/kernel/slab.c
+    extern mt_init_caches:function      ; src/kernel/multitask.c
+    extern mt_fxdata_ctor:function      ; src/kernel/multitask.c
+    extern mt_ctx_cache                 ; src/kernel/multitask.c
+    extern mt_stack_cache               ; src/kernel/multitask.c
+    extern mt_fxdata_cache              ; src/kernel/multitask.c
+    extern mt_quantum                   ; src/kernel/multitask.c
+    extern mt_exit:function             ; src/kernel/multitask.c
+    extern mt_init_idle:function        ; src/kernel/multitask.c
 
 ; void mt_init(void);
 ; Initialize multitasking. Creates the first task for the kernel.
@@ -37,6 +59,9 @@ mt_init:
     push    ebp
     mov     ebp, esp
 
+    ; Create the object caches used by mt_newtask
+    call    mt_init_caches
+
     ; .next and .next of first task is itself.
     mov     [first_ctx + ctx_t.next], dword first_ctx
     mov     [first_ctx + ctx_t.prev], dword first_ctx
@@ -54,12 +79,32 @@ mt_init:
     ; 512 bytes aligned to 16 bytes in .bss for fxsave. See mt_newtask
     mov     [first_ctx + ctx_t.fxdata], dword first_fxdata
 
+    ; The FPU/SSE registers are being used by this task, and CR0.TS is clear
+    mov     [mt_fpu_owner], dword first_ctx
+
     ; "kernel_main"
     mov     [first_ctx + ctx_t.name],  dword first_task_name
 
+    ; Ready to be scheduled, with a full time slice
+    mov     [first_ctx + ctx_t.state], dword TASK_READY
+    mov     eax, [mt_quantum]
+    mov     [first_ctx + ctx_t.quantum], eax
+    mov     [first_ctx + ctx_t.data], dword 0
+
+    ; Highest priority
+    mov     [first_ctx + ctx_t.priority], dword 0
+    mov     [first_ctx + ctx_t.level], dword 0
+
+    ; Not in any wait queue
+    mov     [first_ctx + ctx_t.wait_next], dword 0
+
     ; Address of the struct we just filled
     mov     [mt_current_task], dword first_ctx
 
+    ; Create the task that runs when the others are blocked. Needs a valid
+    ; mt_current_task.
+    call    mt_init_idle
+
     mov     esp, ebp
     pop     ebp
     ret
@@ -71,74 +116,71 @@ global mt_newtask:function
 mt_newtask:
     push    ebp
     mov     ebp, esp
+    push    ebx
 
     ; NOTE: General register usage:
-    ;   - eax: Pointer to the ctx_t we allocate at the start.
+    ;   - ebx: Pointer to the ctx_t we allocate at the start. Preserved across
+    ;          calls, unlike eax.
     ;   - ecx: Temporary register for values with short life.
-    ;   - edx: Pointer to the allocated stack, or to the allocated fxdata.
+    ;   - edx: Pointer to the allocated stack.
 
-    push    dword 8             ; Align to 8 bytes
-    push    dword ctx_t_size    ; Size of the ctx_t struct
-    call    heap_alloc          ; Allocate a ctx_t struct on the heap
-    add     esp, 8              ; Remove 2 dwords we just pushed
+    push    dword [mt_ctx_cache]    ; Cache of ctx_t structs
+    call    kmem_cache_alloc        ; Get a ctx_t struct from the cache
+    add     esp, 4                  ; Remove dword we just pushed
+    mov     ebx, eax
 
     mov     ecx, [ebp + 8]          ; First argument
-    mov     [eax + ctx_t.name], ecx ; Program name (char*), first arg
+    mov     [ebx + ctx_t.name], ecx ; Program name (char*), first arg
 
     mov     ecx, cr3
-    mov     [eax + ctx_t.cr3], ecx  ; Use same CR3 as caller (parent)
-
-    ; Insert new task next to the current one in the list.
-    ;   1. Move the current task's address (edx) to the new task's (eax) "prev"
-    ;      pointer.
-    ;   2. Move the current task's "next" pointer (ecx) to the new task's "next"
-    ;      pointer.
-    ;   3. Overwrite the current task's "next" with the pointer of this new
-    ;      task.
-    ;   4. Overwrite the "prev" pointer of the current task's "next" (ecx) with
-    ;      the new task's address (eax).
-    ;   5. Restore ecx.
-    ;
-    ;      [cur_task] -> [new_task] -> [cur_task.next]
-    ;         | ^         | ^  ^ |         ^ |
-    ;         | |---(1)---| |  | |---(2)---| |
-    ;         |-----(3)-----|  |-----(4)-----|
-    ;
-    mov     edx, [mt_current_task]          ; edx = &cur
-    mov     ecx, [edx + ctx_t.next]         ; ecx = cur.next
-    mov     [eax + ctx_t.prev], edx         ; new.prev = &cur
-    mov     [eax + ctx_t.next], ecx         ; new.next = cur.next
-    mov     [edx + ctx_t.next], eax         ; cur.next = &new
-    mov     [ecx + ctx_t.prev], eax         ; cur.next.prev = &new
-
-    push    eax             ; Preserve eax (allocated Ctx*)
-
-    push    dword 16        ; Align to 16 bytes
-    push    dword 0x4000    ; 16KiB stack for the new task
-    call    heap_alloc
-    mov     edx, eax        ; Save new stack address to edx
-    add     esp, 8          ; Remove 2 dwords we just pushed
-
-    pop     eax             ; Restore old Ctx* from first malloc
+    mov     [ebx + ctx_t.cr3], ecx  ; Use same CR3 as caller (parent)
+
+    ; Same priority as the parent, starting at the highest level it allows
+    mov     edx, [mt_current_task]
+    mov     ecx, [edx + ctx_t.priority]
+    mov     [ebx + ctx_t.priority], ecx
+    mov     [ebx + ctx_t.level], ecx
+
+    ; Ready to be scheduled, with a full time slice of that level. The time
+    ; slice doubles on each level, see mt_level_quantum in multitask.c
+    mov     [ebx + ctx_t.state], dword TASK_READY
+    mov     eax, [mt_quantum]
+    shl     eax, cl
+    mov     [ebx + ctx_t.quantum], eax
+    mov     [ebx + ctx_t.data], dword 0
+    mov     [ebx + ctx_t.wait_next], dword 0
+
+    push    dword [mt_stack_cache]  ; 16KiB stack for the new task
+    call    kmem_cache_alloc
+    mov     edx, eax                ; Save new stack address to edx
+    add     esp, 4                  ; Remove dword we just pushed
 
     ; Address of stack we just allocated. Store so we can free it in mt_endtask
-    mov     [eax + ctx_t.stack], edx
+    mov     [ebx + ctx_t.stack], edx
 
     ; Now edx points to the end of the allocated memory, which is the bottom of
-    ; the stack in x86 (pushed items are in lower addresses). We subtract 4 to
-    ; not overflow. See issue #12
-    add     edx, 0x4000 - 4
+    ; the stack in x86 (pushed items are in lower addresses). The stack is
+    ; aligned to 16 bytes, and the System V ABI wants (esp + 4) to be aligned
+    ; to 16 bytes when entering a function, so the return address of the entry
+    ; point is at (end - 20).
+    add     edx, 0x4000 - 20
 
     ; Fill new allocated stack for new task. From bottom to top, needed by
     ; mt_switch and System V ABI:
-    ;   - eip (return address of the task/entry point)
+    ;   - Return address of the entry point (mt_exit), for tasks that return
+    ;   - eip (entry point of the task, used by the "ret" of mt_switch)
+    ;   - eflags (interrupts enabled, restored by the "popfd" of mt_switch)
     ;   - edi
     ;   - esi
     ;   - ebp
     ;   - ebx
+    mov     [edx], dword mt_exit        ; *stack_ptr = mt_exit;
+    sub     edx, 4                      ; stack_ptr--;
     mov     ecx, [ebp + 12]             ; tmp = second_arg;
     mov     [edx], ecx                  ; *stack_ptr = eip;   // Entry point
     sub     edx, 4                      ; stack_ptr--;
+    mov     [edx], dword 0x00000202     ; *stack_ptr = eflags; // IF, bit 1
+    sub     edx, 4                      ; stack_ptr--;
     mov     [edx], dword 0x00000000     ; *stack_ptr = edi;
     sub     edx, 4                      ; stack_ptr--;
     mov     [edx], dword 0x00000000     ; *stack_ptr = esi;
@@ -147,32 +189,49 @@ mt_newtask:
     sub     edx, 4                      ; stack_ptr--;
     mov     [edx], dword 0x00000000     ; *stack_ptr = ebx;
 
-    mov     [eax + ctx_t.esp], edx      ; Save the address at the top of the
+    mov     [ebx + ctx_t.esp], edx      ; Save the address at the top of the
                                         ; allocated stack
 
-    ; Allocate 512 bytes needed by the fxsave instruction for preserving the FPU
-    ; and SSE registers
-    push    eax
-
-    push    dword 16                        ; Need to be 16-bit aligned
-    push    dword 1                         ; sizeof(byte)
-    push    dword 512                       ; 512 bytes for fxsave
-    call    heap_calloc
-    mov     edx, eax                        ; Save allocated bytes to edx
-    add     esp, 12                         ; Remove 3 dwords we just pushed
-
-    pop     eax
-    mov     [eax + ctx_t.fxdata], edx       ; Save in ctx struct
+    ; Get the 512 bytes needed by the fxsave instruction for preserving the FPU
+    ; and SSE registers. They are already initialized by the constructor of the
+    ; cache (mt_fxdata_ctor)
+    push    dword [mt_fxdata_cache]
+    call    kmem_cache_alloc
+    add     esp, 4                          ; Remove dword we just pushed
+    mov     [ebx + ctx_t.fxdata], eax       ; Save in ctx struct
+
+    ; Insert new task next to the current one in the list. We do it once the
+    ; task is fully initialized, and with interrupts disabled, since the
+    ; scheduler could switch to it from the PIT interrupt.
+    ;   1. Move the current task's address (edx) to the new task's (ebx) "prev"
+    ;      pointer.
+    ;   2. Move the current task's "next" pointer (ecx) to the new task's "next"
+    ;      pointer.
+    ;   3. Overwrite the current task's "next" with the pointer of this new
+    ;      task.
+    ;   4. Overwrite the "prev" pointer of the current task's "next" (ecx) with
+    ;      the new task's address (ebx).
+    ;
+    ;      [cur_task] -> [new_task] -> [cur_task.next]
+    ;         | ^         | ^  ^ |         ^ |
+    ;         | |---(1)---| |  | |---(2)---| |
+    ;         |-----(3)-----|  |-----(4)-----|
+    ;
+    pushfd                                  ; Preserve the interrupt flag
+    cli
+    mov     edx, [mt_current_task]          ; edx = &cur
+    mov     ecx, [edx + ctx_t.next]         ; ecx = cur.next
+    mov     [ebx + ctx_t.prev], edx         ; new.prev = &cur
+    mov     [ebx + ctx_t.next], ecx         ; new.next = cur.next
+    mov     [edx + ctx_t.next], ebx         ; cur.next = &new
+    mov     [ecx + ctx_t.prev], ebx         ; cur.next.prev = &new
+    popfd
 
-    ; Initialize the fxdata we just allocated by:
-    ;   - Setting edx.fcw to 0x037F (See Intel manual Vol. 1, Chapter 8.1.5)
-    ;   - Masking bits 7..12 of the MXCSR register (Vol. 1, Figure 10-3)
-    ;   - Setting the default MXCSR_MASK (Vol. 1, Chapter 11.6.6)
-    mov     [edx + fpu_data_t.fcw],   dword 0b0000001101111111
-    mov     [edx + fpu_data_t.mxcsr], dword 0b0001111110000000
-    mov     [edx + fpu_data_t.mxcsr_mask], dword 0x0000FFFF
+    ; Return the new Ctx*
+    mov     eax, ebx
 
     ; Exit the mt_newtask function
+    pop     ebx
     mov     esp, ebp
     pop     ebp
     ret
@@ -181,7 +240,8 @@ mt_newtask:
 ; Switch to task "next".
 global mt_switch:function
 mt_switch:
-    cli             ; Clear interrupts
+    pushfd          ; Save the interrupt flag of the current task, since we
+    cli             ; might be called from an interrupt. Clear interrupts.
 
     push    edi     ; edi will be the current task
     push    esi     ; esi will be the first argument (new ctx)
@@ -199,20 +259,27 @@ mt_switch:
     mov     edi, [mt_current_task]
     mov     [edi + ctx_t.esp], esp
 
-    ; Save the SSE, MMX and FPU registers. fxsave requires a 16byte-aligned
-    ; address to 512 bytes. Although this "dereference" looks weird, it's the
-    ; same as lgdt (src/kernel/gdt.asm)
-    mov     eax, [edi + ctx_t.fxdata]
-    fxsave  [eax]
-
     ; Now we are done storing the current task, we can switch to the next task.
-    ; We store the first argument in esi. We pushed 4 elements + 1 return
-    ; address, of size 4 (dword). We set it as the current ctx.
-    mov     esi, [esp + 5 * 4]
+    ; We store the first argument in esi. We pushed 4 elements + eflags + 1
+    ; return address, of size 4 (dword). We set it as the current ctx.
+    mov     esi, [esp + 6 * 4]
     mov     [mt_current_task], esi
 
-    mov     eax, [esi + ctx_t.fxdata]   ; Restore SSE/MMX/FPU registers saved by
-    fxrstor [eax]                       ; fxsave on ctx_t.fxdata
+    ; The SSE, MMX and FPU registers are not saved here, since most tasks don't
+    ; use them. If the next task doesn't own the registers, set CR0.TS so the
+    ; first instruction that uses them raises #NM, and exc_7 (idt.asm) swaps
+    ; them. Writing to CR0 is slow, so only do it if TS changes.
+    mov     ecx, cr0
+    mov     eax, ecx
+    or      eax, CR0_TS                 ; Set TS by default
+    cmp     esi, [mt_fpu_owner]
+    jne     .ts_ready
+    and     eax, ~CR0_TS                ; Clear TS, it's the owner
+.ts_ready:
+    cmp     eax, ecx
+    je      .ts_loaded
+    mov     cr0, eax
+.ts_loaded:
 
     mov     esp, [esi + ctx_t.esp]  ; Load all fields from next task
     mov     eax, [esi + ctx_t.cr3]  ; Save new cr3 to eax for comparing
@@ -229,7 +296,7 @@ mt_switch:
     pop     esi
     pop     edi
 
-    sti             ; Enable interrupts again
+    popfd           ; Restore the interrupt flag of the new task
 
     ret
 
@@ -243,6 +310,10 @@ mt_endtask:
 
     mov     eax, [esp + 8]              ; eax is the first arg, Ctx*
 
+    ; The scheduler might be iterating the list from the PIT interrupt
+    pushfd
+    cli
+
     ; First, remove the Ctx* from the linked list. Make the previous item's
     ; "next" point to the "next" pointer of the task we want to free, and then
     ; make the next item's "prev" point to the "prev" pointer of the task we
@@ -259,25 +330,43 @@ mt_endtask:
     mov     [ecx + ctx_t.next], edx     ; arg->prev->next = arg->next
     mov     [edx + ctx_t.prev], ecx     ; arg->next->prev = arg->prev
 
-    ; Free the stack, fxdata and Ctx struct we allocated for the task. First we
-    ; preserve eax in edx because the first "free" (for the stack) will overwrite it
-    ; when returning.
-    push    eax
+    ; The FPU/SSE registers of the task are not needed anymore, so exc_7 doesn't
+    ; have to save them
+    cmp     eax, [mt_fpu_owner]
+    jne     .not_owner
+    mov     [mt_fpu_owner], dword 0
+.not_owner:
+
+    popfd
 
-    push    dword [eax + ctx_t.stack]   ; Address of the allocated stack
-    call    free                        ; Free the task's stack
-    add     esp, 4                      ; Remove stack dword we just pushed
+    ; Return the stack, fxdata and Ctx struct of the task to their caches.
+    ; We use ebx to preserve the Ctx* across calls, since the called functions
+    ; will overwrite eax.
+    push    ebx
+    mov     ebx, eax
 
-    pop     eax                         ; Restore eax since it was overwritten
-    mov     edx, [eax + ctx_t.fxdata]   ; Save fxdata address in edx
-    push    eax                         ; Push eax (Ctx*) again
+    push    dword [ebx + ctx_t.stack]   ; Address of the allocated stack
+    push    dword [mt_stack_cache]
+    call    kmem_cache_free             ; Free the task's stack
+    add     esp, 8                      ; Remove 2 dwords we just pushed
 
-    push    edx                         ; Free 512 bytes of fxdata
-    call    free
+    ; Objects should be returned to the cache in their constructed state, so
+    ; reset the FPU/SSE data that the task modified.
+    push    dword [ebx + ctx_t.fxdata]
+    call    mt_fxdata_ctor
     add     esp, 4                      ; Remove fxdata dword we just pushed
 
-    call    free        ; Free the Ctx struct itself, eax we pushed before
-                        ; freeing fxdata
+    push    dword [ebx + ctx_t.fxdata]  ; Free 512 bytes of fxdata
+    push    dword [mt_fxdata_cache]
+    call    kmem_cache_free
+    add     esp, 8                      ; Remove 2 dwords we just pushed
+
+    push    ebx                         ; Free the Ctx struct itself
+    push    dword [mt_ctx_cache]
+    call    kmem_cache_free
+    add     esp, 8                      ; Remove 2 dwords we just pushed
+
+    pop     ebx
 
     mov     esp, ebp
     pop     ebp
@@ -301,24 +390,33 @@ mt_get_fpu_data:
 
     mov     ebx, [ebp + 12]     ; 1st arg = ebp + ebx + ret
 
-    push    dword 16            ; Need to be 16-bit aligned
-    push    dword 1             ; sizeof(byte)
-    push    dword 512           ; 512 bytes for fxsave
-    call    heap_calloc
-    add     esp, 12             ; Remove 3 dwords we just pushed
+    push    dword [mt_fxdata_cache] ; 512 bytes aligned to 16 for fxsave
+    call    kmem_cache_alloc
+    add     esp, 4                  ; Remove dword we just pushed
 
-    fxsave  [eax]               ; Fill 512 bytes we just allocated
+    ; Fill the 512 bytes we just allocated. The constructed state is restored
+    ; with mt_fxdata_ctor before returning it to the cache.
+    fxsave  [eax]
 
-    push    eax                 ; Preserve and use as parameter for free below
+    push    esi                 ; Preserve esi, used for the fxsave data
+    mov     esi, eax
 
     push    dword fpu_data_t_size   ; Size
-    push    eax                     ; Source
+    push    esi                     ; Source
     push    ebx                     ; Destination
     call    memcpy
     add     esp, 12                 ; Remove 3 dwords we just pushed
 
-    call    free                ; Free the 512 bytes we allocated for fxsave
-    add     esp, 4              ; Remove eax (Pushed before call to memcpy)
+    push    esi
+    call    mt_fxdata_ctor      ; Reset the fxsave data
+    add     esp, 4              ; Remove dword we just pushed
+
+    push    esi
+    push    dword [mt_fxdata_cache]
+    call    kmem_cache_free     ; Return the 512 bytes to the cache
+    add     esp, 8              ; Remove 2 dwords we just pushed
+
+    pop     esi
 
     mov     esp, ebp
     pop     ebp
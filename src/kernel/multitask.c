@@ -1,11 +1,461 @@
 
 #include <stdint.h>
+#include <stdbool.h>
 #include <stdio.h>
+#include <stdlib.h> /* panic_line */
+#include <string.h> /* memset */
 #include <kernel/multitask.h>
+#include <kernel/slab.h>
+#include <kernel/idt.h> /* irq_save, irq_restore */
+#include <kernel/pit.h> /* pit_oneshot */
+#include <kernel/timer.h>
+
+kmem_cache* mt_ctx_cache    = NULL;
+kmem_cache* mt_stack_cache  = NULL;
+kmem_cache* mt_fxdata_cache = NULL;
+
+/** @brief Time slice of each task in ticks. Also used from mt_newtask() */
+uint32_t mt_quantum = MT_QUANTUM_DEFAULT;
+
+/** @brief Nesting level of mt_preempt_disable(). Read from the PIT interrupt */
+static volatile uint32_t preempt_count = 0;
+
+/** @brief Set by the PIT interrupt if the time slice ran out while preemption
+ * was disabled */
+static volatile bool need_resched = false;
+
+/** @brief Ticks since the last call to mt_boost(). See MT_BOOST_TICKS */
+static uint32_t boost_ticks = 0;
+
+/** @brief Number of tasks removed from the ring with mt_block() */
+static uint32_t blocked_count = 0;
+
+/** @brief Task that runs when all the others are blocked. See mt_init_idle() */
+static Ctx* idle_task = NULL;
+
+/** @brief Stop the periodic PIT interrupts when idle. See mt_set_tickless() */
+static bool tickless = true;
+
+/** @brief Number of times the idle task was woken up by an interrupt */
+static uint32_t idle_wakeups = 0;
+
+/** @brief Ticks spent halted in the idle task */
+static uint64_t idle_ticks = 0;
+
+/*----------------------------------------------------------------------------*/
+
+/**
+ * @brief Length of the time slice of the tasks in a MLFQ level.
+ * @details Lower levels get longer slices, since they are CPU-bound and they
+ * will be preempted by the higher ones anyway.
+ */
+static inline uint32_t mt_level_quantum(uint32_t level) {
+    return mt_quantum << level;
+}
+
+/**
+ * @brief Insert `task` after `pos` in the ring.
+ * @details Should be called with interrupts disabled. Same as the insertion of
+ * mt_newtask().
+ */
+static inline void ring_insert_after(Ctx* pos, Ctx* task) {
+    task->prev      = pos;
+    task->next      = pos->next;
+    pos->next->prev = task;
+    pos->next       = task;
+}
+
+/**
+ * @brief Remove `task` from the ring.
+ * @details Should be called with interrupts disabled. Same as the removal of
+ * mt_endtask().
+ */
+static inline void ring_remove(Ctx* task) {
+    task->prev->next = task->next;
+    task->next->prev = task->prev;
+}
+
+/**
+ * @brief Timer callback of mt_sleep().
+ * @param[inout] data The sleeping task.
+ */
+static void sleep_timer_func(void* data) {
+    mt_unblock((Ctx*)data);
+}
+
+/**
+ * @brief Entry point of the idle task.
+ * @details Has a lower priority than any other task, so it only runs when they
+ * are all blocked.
+ */
+static void idle_entry(void) {
+    for (;;) {
+        const uint64_t start = pit_get_ticks();
+        asm volatile("cli");
+
+        /* If there is nothing else in the ring, only an interrupt can give us
+         * work, so we don't need the PIT until the next timer expires */
+        if (tickless && idle_task->next == idle_task) {
+            const uint32_t sleep = timer_next_deadline(pit_oneshot_max());
+            if (sleep > 1)
+                pit_oneshot(sleep);
+        }
+
+        /* STI enables the interrupts after the next instruction, so they can't
+         * arrive before the HLT */
+        asm volatile("sti\n\t"
+                     "hlt\n\t"
+                     "cli"
+                     :
+                     :
+                     : "memory");
+
+        /* Woken up by some other interrupt, go back to the periodic ticks */
+        pit_oneshot_end();
+        asm volatile("sti");
+
+        idle_wakeups++;
+        idle_ticks += pit_get_ticks() - start;
+
+        /* An interrupt might have woken up a task */
+        mt_yield();
+    }
+}
+
+/**
+ * @brief Move all the tasks back to the highest level allowed by their
+ * priority, so CPU-bound tasks in the lower levels don't starve.
+ */
+static void mt_boost(void) {
+    Ctx* cur = mt_current_task;
+    do {
+        cur->level   = cur->priority;
+        cur->quantum = mt_level_quantum(cur->level);
+        cur          = cur->next;
+    } while (cur != mt_current_task);
+}
+
+/**
+ * @brief Returns true if there is a ready task in a higher level than the
+ * current one.
+ */
+static bool mt_better_ready(void) {
+    const uint32_t level = mt_current_task->level;
+
+    for (Ctx* cur = mt_current_task->next; cur != mt_current_task;
+         cur      = cur->next)
+        if (cur->state == TASK_READY && cur->level < level)
+            return true;
+
+    return false;
+}
+
+/**
+ * @brief Find the next task to run.
+ * @details Returns the first ready task of the highest level, starting after
+ * the current one, so tasks of the same level run in round-robin. Dead tasks
+ * after the current one are freed on the way.
+ * @param[in] skip_cur If true, the current task is only returned if there is no
+ * other ready task.
+ * @return Next task to run, may be the current one.
+ */
+static Ctx* mt_pick_next(bool skip_cur) {
+    Ctx* cur  = mt_current_task;
+    Ctx* best = NULL;
+
+    Ctx* next = cur->next;
+    while (next != cur) {
+        /* The current task can't be freed here since we are using its stack,
+         * it will be freed when the scheduler runs again from another task. */
+        if (next->state == TASK_DEAD) {
+            Ctx* dead = next;
+            next      = next->next;
+            mt_endtask(dead);
+            continue;
+        }
+
+        if (best == NULL || next->level < best->level)
+            best = next;
+
+        next = next->next;
+    }
+
+    if (best == NULL)
+        return cur;
+
+    /* The current task is checked last, so it loses the ties */
+    if (!skip_cur && cur->state == TASK_READY && cur->level < best->level)
+        return cur;
+
+    return best;
+}
+
+/**
+ * @brief Update the MLFQ level of the current task, and switch to the next
+ * one.
+ * @details Should be called with interrupts disabled.
+ *
+ * Tasks that use their whole time slice are moved to a lower level, and tasks
+ * that give up the CPU before (e.g. waiting for input) are moved to a higher
+ * one, never above their priority.
+ * @param[in] yielding True if the task is giving up the CPU voluntarily.
+ * @return False if there was no task to switch to.
+ */
+static bool mt_schedule(bool yielding) {
+    Ctx* cur = mt_current_task;
+
+    need_resched = false;
+
+    if (mt_quantum > 0 && cur->quantum == 0) {
+        if (cur->level < MT_PRIO_LEVELS - 1)
+            cur->level++;
+
+        cur->quantum = mt_level_quantum(cur->level);
+    } else if (yielding) {
+        if (cur->level > cur->priority)
+            cur->level--;
+
+        cur->quantum = mt_level_quantum(cur->level);
+    }
+
+    Ctx* next = mt_pick_next(yielding);
+    if (next == cur)
+        return false;
+
+    /* We don't need the ring of a blocked task anymore, we already know the
+     * next task. The task is inserted again by mt_unblock(). */
+    if (cur->state == TASK_BLOCKED)
+        ring_remove(cur);
+
+    mt_switch(next);
+    return true;
+}
+
+static const char* state_str(uint32_t state) {
+    switch (state) {
+        case TASK_READY:
+            return "ready";
+        case TASK_DEAD:
+            return "dead";
+        case TASK_BLOCKED:
+            return "blocked";
+        default:
+            return "unknown";
+    }
+}
+
+/*----------------------------------------------------------------------------*/
+
+void mt_fxdata_ctor(void* obj) {
+    fpu_data_t* fxdata = obj;
+
+    memset(obj, 0, MT_FXDATA_SZ);
+
+    /* Initialize the fxdata by:
+     *   - Setting the FCW to 0x037F (See Intel manual Vol. 1, Chapter 8.1.5)
+     *   - Masking bits 7..12 of the MXCSR register (Vol. 1, Figure 10-3)
+     *   - Setting the default MXCSR_MASK (Vol. 1, Chapter 11.6.6) */
+    fxdata->fcw        = 0x037F;
+    fxdata->mxcsr      = 0x1F80;
+    fxdata->mxcsr_mask = 0x0000FFFF;
+}
+
+void mt_init_caches(void) {
+    mt_ctx_cache    = kmem_cache_create("task_ctx", sizeof(Ctx), 8, NULL);
+    mt_stack_cache  = kmem_cache_create("task_stack", MT_STACK_SZ, 16, NULL);
+    mt_fxdata_cache = kmem_cache_create("task_fxdata", MT_FXDATA_SZ, 16,
+                                        mt_fxdata_ctor);
+}
+
+bool mt_yield(void) {
+    if (mt_current_task == NULL || preempt_count > 0)
+        return false;
+
+    const uint32_t eflags = irq_save();
+    const bool ret        = mt_schedule(true);
+    irq_restore(eflags);
+
+    return ret;
+}
+
+void mt_sched_tick(void) {
+    if (mt_current_task == NULL)
+        return;
+
+    /* Preemption is disabled with mt_set_quantum() */
+    if (mt_quantum == 0)
+        return;
+
+    if (++boost_ticks >= MT_BOOST_TICKS) {
+        boost_ticks = 0;
+        mt_boost();
+    }
+
+    if (mt_current_task->quantum > 0)
+        mt_current_task->quantum--;
+
+    /* Keep running until the time slice ends, or until a task with more
+     * priority is ready */
+    if (mt_current_task->quantum > 0 && !mt_better_ready())
+        return;
+
+    /* Don't switch in the middle of a critical section, the task will switch
+     * from mt_preempt_enable() */
+    if (preempt_count > 0) {
+        need_resched = true;
+        return;
+    }
+
+    /* We are inside the interrupt, so they are already disabled. The task
+     * will return here once it's scheduled again. */
+    mt_schedule(false);
+}
+
+void mt_exit(void) {
+    asm volatile("cli");
+
+    /* Tasks are never switched with preemption disabled, so if the count is
+     * not zero, it belongs to this task */
+    preempt_count = 0;
+
+    mt_current_task->state = TASK_DEAD;
+    mt_schedule(true);
+
+    /* Unreachable unless this was the only task */
+    for (;;)
+        asm volatile("hlt");
+}
+
+void mt_block(void) {
+    /* The count is global, so the other tasks would run without preemption
+     * until we are woken up */
+    if (preempt_count > 0)
+        panic_line("Blocking with preemption disabled");
+
+    mt_current_task->state = TASK_BLOCKED;
+    blocked_count++;
+
+    /* Counts as a yield, so tasks waiting for I/O stay in the high levels */
+    mt_schedule(true);
+}
+
+void mt_unblock(Ctx* task) {
+    const uint32_t eflags = irq_save();
+
+    if (task->state == TASK_BLOCKED) {
+        task->state = TASK_READY;
+        blocked_count--;
+
+        /* If it has more priority, the PIT will switch to it on the next tick,
+         * or mt_preempt_enable() before that */
+        ring_insert_after(mt_current_task, task);
+        if (task->level < mt_current_task->level)
+            need_resched = true;
+    }
+
+    irq_restore(eflags);
+}
+
+bool mt_sleep(uint32_t ms) {
+    if (mt_current_task == NULL || preempt_count > 0)
+        return false;
+
+    if (ms == 0) {
+        mt_yield();
+        return true;
+    }
+
+    const uint32_t eflags = irq_save();
+
+    /* Interrupts are disabled, so the timer can't expire before we block.
+     * 1 tick is 1ms, see kernel_main */
+    if (timer_add(ms, sleep_timer_func, mt_current_task, false) ==
+        TIMER_NONE) {
+        irq_restore(eflags);
+        return false;
+    }
+
+    mt_block();
+
+    irq_restore(eflags);
+    return true;
+}
+
+void mt_init_idle(void) {
+    idle_task = mt_newtask("idle", idle_entry);
+
+    /* Below the lowest level of the other tasks */
+    idle_task->priority = MT_PRIO_LEVELS;
+    idle_task->level    = MT_PRIO_LEVELS;
+}
+
+void mt_set_tickless(bool enabled) {
+    tickless = enabled;
+}
+
+bool mt_get_tickless(void) {
+    return tickless;
+}
+
+uint32_t mt_get_idle_wakeups(void) {
+    return idle_wakeups;
+}
+
+uint64_t mt_get_idle_ticks(void) {
+    return idle_ticks;
+}
+
+void mt_setprio(Ctx* task, uint32_t prio) {
+    if (prio >= MT_PRIO_LEVELS)
+        prio = MT_PRIO_LEVELS - 1;
+
+    const uint32_t eflags = irq_save();
+
+    task->priority = prio;
+    task->level    = prio;
+    task->quantum  = mt_level_quantum(prio);
+
+    /* If the current task lowered its priority, let the others run */
+    const bool should_yield = task == mt_current_task && mt_better_ready();
+
+    irq_restore(eflags);
+
+    if (should_yield)
+        mt_yield();
+}
+
+void mt_set_quantum(uint32_t ticks) {
+    mt_quantum = ticks;
+}
+
+uint32_t mt_get_quantum(void) {
+    return mt_quantum;
+}
+
+void mt_preempt_disable(void) {
+    preempt_count++;
+}
+
+void mt_preempt_enable(void) {
+    if (preempt_count > 0)
+        preempt_count--;
+
+    if (preempt_count == 0 && need_resched) {
+        /* If interrupts are disabled, we might be inside an IRQ handler that
+         * didn't send the EOI yet. The PIT will switch on the next tick. */
+        const uint32_t eflags = irq_save();
+        if (eflags & EFLAGS_IF)
+            mt_schedule(false);
+        irq_restore(eflags);
+    }
+}
 
 void mt_dump_tasks(void) {
     puts("Dumping task list:");
 
+    /* Make sure no task is freed while we iterate the list */
+    mt_preempt_disable();
+
     /* 0 will be the current one, not the first task we created */
     int i = 0;
 
@@ -13,17 +463,25 @@ void mt_dump_tasks(void) {
 
     /* We at least want to print one */
     printf("[%d] %s | ctx: %p | prev: %p | next: %p | stack: 0x%lX | esp: "
-           "0x%lX | cr3: 0x%lX | fxdata: 0x%lX\n",
+           "0x%lX | cr3: 0x%lX | fxdata: 0x%lX | state: %s | prio: %ld | "
+           "level: %ld\n",
            i++, first_ctx->name, first_ctx, first_ctx->prev, first_ctx->next,
-           first_ctx->stack, first_ctx->esp, first_ctx->cr3, first_ctx->fxdata);
+           first_ctx->stack, first_ctx->esp, first_ctx->cr3, first_ctx->fxdata,
+           state_str(first_ctx->state), first_ctx->priority, first_ctx->level);
 
     for (Ctx* cur_ctx = first_ctx->next; cur_ctx != first_ctx;
          cur_ctx      = cur_ctx->next, i++) {
         printf("[%d] %s | ctx: %p | prev: %p | next: %p | stack: 0x%lX | esp: "
-               "0x%lX | cr3: 0x%lX | fxdata: 0x%lX\n",
+               "0x%lX | cr3: 0x%lX | fxdata: 0x%lX | state: %s | prio: %ld | "
+               "level: %ld\n",
                i, cur_ctx->name, cur_ctx, cur_ctx->prev, cur_ctx->next,
-               cur_ctx->stack, cur_ctx->esp, cur_ctx->cr3, cur_ctx->fxdata);
+               cur_ctx->stack, cur_ctx->esp, cur_ctx->cr3, cur_ctx->fxdata,
+               state_str(cur_ctx->state), cur_ctx->priority, cur_ctx->level);
     }
+
+    if (blocked_count > 0)
+        printf("Blocked tasks (not in the list): %ld\n", blocked_count);
+    mt_preempt_enable();
 }
 
 void mt_print_fpu_data(fpu_data_t* p) {
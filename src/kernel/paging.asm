@@ -31,3 +31,18 @@ paging_enable:
     pop     ebp
     ret
 
+; void paging_enable_pse(void);
+global paging_enable_pse:function
+paging_enable_pse:
+    push    ebp
+    mov     ebp, esp
+
+    ; Enable 4MiB pages, see Vol. 3, Chapter 4.3
+    mov     eax, cr4            ; We can't work directly with cr4
+    or      eax, (1 << 4)       ; Set CR4.PSE[bit 4]. Enable 4MiB pages.
+    mov     cr4, eax            ; And move back to cr4
+
+    mov     esp, ebp
+    pop     ebp
+    ret
+
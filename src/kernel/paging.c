@@ -2,11 +2,10 @@
 #include <stdint.h>
 #include <stdbool.h>
 #include <stdio.h>
+#include <stdlib.h> /* panic_line */
+#include <string.h> /* memset */
 #include <kernel/paging.h>
-
-#define DIR_ENTRIES   1024 /* Array size */
-#define TABLE_ENTRIES 1024 /* Array size*/
-#define PAGE_SIZE     4096 /* KiB */
+#include <kernel/frame.h>
 
 /**
  * @def TABLES_MAPPED
@@ -15,40 +14,14 @@
  */
 #define TABLES_MAPPED DIR_ENTRIES
 
-/**
- * @enum page_dir_flags
- * @brief Bits for the page directory entries.
- */
-enum page_dir_flags {
-    PAGEDIR_PRESENT   = 0x01,
-    PAGEDIR_READWRITE = 0x02,
-    PAGEDIR_USER      = 0x04, /* If clear, only supervisor can access page */
-    PAGEDIR_PWT       = 0x08,
-    PAGEDIR_PCD       = 0x10,
-    PAGEDIR_ACCESSED  = 0x20,
-    PAGEDIR_AVL0      = 0x40, /* Unused */
-    PAGEDIR_PAGESZ    = 0x80, /* If set, pages are 4MiB. Otherwise, 4KiB */
-    /* Bits 09..11 of entry are available */
-    /* Bits 12..31 of entry are bits 12..31 of the page frame address */
-};
+/** @brief Index in the page directory of a virtual address */
+#define VADDR_TO_DIR(vaddr) ((uint32_t)(vaddr) >> 22)
 
-/**
- * @enum page_tab_flags
- * @brief Bits for the page table entries.
- */
-enum page_tab_flags {
-    PAGETAB_PRESENT   = 0x001,
-    PAGETAB_READWRITE = 0x002,
-    PAGETAB_USER      = 0x004,
-    PAGETAB_PWT       = 0x008,
-    PAGETAB_PCD       = 0x010,
-    PAGETAB_ACCESSED  = 0x020,
-    PAGETAB_DIRTY     = 0x040, /* It has been written to */
-    PAGETAB_PAT       = 0x080, /* Page attribute table */
-    PAGETAB_GLOBAL    = 0x100,
-    /* Bits 09..11 of entry are available */
-    /* Bits 12..31 of entry are bits 12..31 of the page address */
-};
+/** @brief Index in the page table of a virtual address */
+#define VADDR_TO_TAB(vaddr) (((uint32_t)(vaddr) >> 12) & 0x3FF)
+
+/** @brief Address bits of a page directory or page table entry */
+#define ENTRY_ADDR(entry) ((entry) & 0xFFFFF000)
 
 /* Symbols from linker script */
 extern uint8_t _text_start;
@@ -60,10 +33,105 @@ extern uint8_t _data_end;
 extern uint8_t _bss_start;
 extern uint8_t _bss_end;
 
-/* Page directory and page tables, filled and loaded in paging_init() */
+/* Page directory, filled and loaded in paging_init() */
 static uint32_t page_directory[DIR_ENTRIES] __attribute__((aligned(4096)));
-static uint32_t page_tables[DIR_ENTRIES][TABLE_ENTRIES]
-  __attribute__((aligned(4096)));
+
+#if defined(ENABLE_PSE)
+/* If false, this machine doesn't support 4MiB pages. Checked in
+ * src/kernel/boot.asm if ENABLE_PSE is defined. */
+extern bool pse_supported;
+#endif /* ENABLE_PSE */
+
+/**
+ * @brief Invalidate the TLB entry of a single page.
+ * @param[in] vaddr Virtual address inside the page.
+ */
+static inline void invlpg(uint32_t vaddr) {
+    asm volatile("invlpg [%0]" : : "r"(vaddr) : "memory");
+}
+
+/**
+ * @brief Replace a 4MiB page directory entry with a page table that maps the
+ * same memory with 4KiB pages.
+ * @details The flags of the directory entry are kept on each page. Since the
+ * whole 4MiB region changes, the TLB is flushed by reloading CR3.
+ * @param[inout] dir_entry Pointer to the 4MiB page directory entry.
+ * @return Pointer to the new page table, or NULL if we could not allocate it.
+ */
+static uint32_t* split_large_page(uint32_t* dir_entry) {
+    const uint32_t frame = frame_alloc();
+    if (frame == FRAME_NONE)
+        return NULL;
+
+    uint32_t* table = (uint32_t*)frame;
+
+    /* Bits 22..31 of a 4MiB entry are the address. The low flags (present,
+     * writable, user, write-through and cache disable) have the same position
+     * in both entries, but the PAT bit is moved from bit 12 to bit 7. */
+    const uint32_t base = *dir_entry & 0xFFC00000;
+
+    uint32_t flags = *dir_entry & (PAGEDIR_PRESENT | PAGEDIR_READWRITE |
+                                   PAGEDIR_USER | PAGEDIR_PWT | PAGEDIR_PCD);
+    if (*dir_entry & 0x1000)
+        flags |= PAGETAB_PAT;
+
+    for (uint32_t i = 0; i < TABLE_ENTRIES; i++)
+        table[i] = (base + i * PAGE_SIZE) | flags;
+
+    *dir_entry = frame | PAGEDIR_PRESENT | PAGEDIR_READWRITE;
+    paging_load(page_directory);
+
+    return table;
+}
+
+/**
+ * @brief Get the page table for a virtual address from the page directory.
+ * @details If the directory entry is not present, a new table is allocated with
+ * frame_alloc(). If it's a 4MiB page, it gets split into a table.
+ * @param[in] vaddr Virtual address.
+ * @return Pointer to the page table, or NULL if we could not allocate it.
+ */
+static uint32_t* get_table(uint32_t vaddr) {
+    uint32_t* dir_entry = &page_directory[VADDR_TO_DIR(vaddr)];
+
+    if (!(*dir_entry & PAGEDIR_PRESENT)) {
+        const uint32_t frame = frame_alloc();
+        if (frame == FRAME_NONE)
+            return NULL;
+
+        /* The frame is identity mapped, so we can clear it directly */
+        memset((void*)frame, 0, PAGE_SIZE);
+
+        *dir_entry = frame | PAGEDIR_PRESENT | PAGEDIR_READWRITE;
+    } else if (*dir_entry & PAGEDIR_PAGESZ) {
+        return split_large_page(dir_entry);
+    }
+
+    /* The tables are identity mapped, so the physical address in the directory
+     * entry can be used as a pointer */
+    return (uint32_t*)ENTRY_ADDR(*dir_entry);
+}
+
+/**
+ * @brief Check if the page of `addr` is identity mapped and writable.
+ * @details Used to avoid splitting 4MiB pages that already map `addr` as we
+ * want it.
+ */
+static bool is_identity_rw(uint32_t addr) {
+    const uint32_t dir_entry = page_directory[VADDR_TO_DIR(addr)];
+
+    if (!(dir_entry & PAGEDIR_PRESENT) || !(dir_entry & PAGEDIR_READWRITE))
+        return false;
+
+    if (dir_entry & PAGEDIR_PAGESZ)
+        return (dir_entry & 0xFFC00000) == (addr & 0xFFC00000);
+
+    const uint32_t tab_entry =
+      ((uint32_t*)ENTRY_ADDR(dir_entry))[VADDR_TO_TAB(addr)];
+
+    return (tab_entry & PAGETAB_PRESENT) && (tab_entry & PAGETAB_READWRITE) &&
+           ENTRY_ADDR(tab_entry) == ENTRY_ADDR(addr);
+}
 
 void paging_init(void) {
     /* Initialize empty page directory, will be overwritten next for mapped
@@ -71,78 +139,224 @@ void paging_init(void) {
     for (int i = 0; i < DIR_ENTRIES; i++)
         page_directory[i] = 0;
 
-    /* Initialize the page tables by doing a 1:1 mapping */
+#if defined(ENABLE_PSE)
+    if (pse_supported) {
+        /* Map each directory entry to a 4MiB page. Bits 22..31 of the entry are
+         * bits 22..31 of the address. */
+        for (uint32_t i = 0; i < TABLES_MAPPED; i++)
+            page_directory[i] = (i * TABLE_ENTRIES * PAGE_SIZE) |
+                                PAGEDIR_PRESENT | PAGEDIR_READWRITE |
+                                PAGEDIR_PAGESZ;
+
+        paging_enable_pse();
+    }
+#endif /* ENABLE_PSE */
+
+    /* Initialize the page tables by doing a 1:1 mapping. The tables are
+     * allocated by get_table(). */
     for (uint32_t i = 0; i < TABLES_MAPPED; i++) {
-        for (uint32_t j = 0; j < TABLE_ENTRIES; j++) {
-            /* For each entry of the table (i), map a new 4096 (PAGE_SIZE) page.
-             * We only care about storing bits 12..31 of the address. */
-            page_tables[i][j] = (i * TABLE_ENTRIES + j) * PAGE_SIZE;
-            page_tables[i][j] |= PAGETAB_PRESENT | PAGETAB_READWRITE;
+        if (page_directory[i] & PAGEDIR_PRESENT)
+            continue;
+
+        uint32_t* table = get_table(i * TABLE_ENTRIES * PAGE_SIZE);
+        if (table == NULL)
+            panic_line("Not enough frames for the page tables");
+
+        /* For each entry of the table (i), map a new 4096 (PAGE_SIZE) page.
+         * We only care about storing bits 12..31 of the address. */
+        for (uint32_t j = 0; j < TABLE_ENTRIES; j++)
+            table[j] = (i * TABLE_ENTRIES + j) * PAGE_SIZE | PAGETAB_PRESENT |
+                       PAGETAB_READWRITE;
+    }
+
+    /* Remove write permissions from the page where .rodata starts to the page
+     * where it ends. With 4MiB pages, only the directory entries containing
+     * .rodata are split into 4KiB tables. */
+    for (uint32_t addr = (uint32_t)&_rodata_start;
+         addr < (uint32_t)&_rodata_end; addr += PAGE_SIZE) {
+        uint32_t* table = get_table(addr);
+        if (table == NULL)
+            panic_line("Not enough frames for splitting the .rodata pages");
+
+        table[VADDR_TO_TAB(addr)] &= ~PAGETAB_READWRITE;
+    }
+
+    paging_load(page_directory);
+    paging_enable();
+}
+
+bool paging_map(void* vaddr, uint32_t paddr, uint32_t flags) {
+    uint32_t* table = get_table((uint32_t)vaddr);
+    if (table == NULL)
+        return false;
+
+    table[VADDR_TO_TAB(vaddr)] = ENTRY_ADDR(paddr) | (flags & 0xFFF) |
+                                 PAGETAB_PRESENT;
+    invlpg((uint32_t)vaddr);
+
+    return true;
+}
+
+void paging_unmap(void* vaddr) {
+    /* Not mapped by any table */
+    if (!(page_directory[VADDR_TO_DIR(vaddr)] & PAGEDIR_PRESENT))
+        return;
+
+    /* If it's a 4MiB page, split it so we only unmap this 4KiB page */
+    uint32_t* table = get_table((uint32_t)vaddr);
+    if (table == NULL)
+        return;
+
+    table[VADDR_TO_TAB(vaddr)] = 0;
+    invlpg((uint32_t)vaddr);
+}
+
+bool paging_set_cache(void* vaddr, uint32_t size, uint32_t flags) {
+    flags &= PAGETAB_PWT | PAGETAB_PCD | PAGETAB_PAT;
+
+    /* In 4MiB directory entries, the PAT bit is bit 12 instead of bit 7 */
+    const uint32_t dir_flags = (flags & (PAGETAB_PWT | PAGETAB_PCD)) |
+                               ((flags & PAGETAB_PAT) ? 0x1000 : 0);
+
+    /* 64 bits so we don't overflow at the end of the address space */
+    uint64_t addr      = (uint32_t)vaddr & 0xFFFFF000;
+    const uint64_t end = (uint64_t)(uint32_t)vaddr + size;
+
+    while (addr < end) {
+        uint32_t* dir_entry = &page_directory[VADDR_TO_DIR(addr)];
+
+        if (!(*dir_entry & PAGEDIR_PRESENT))
+            return false;
+
+        /* If the whole 4MiB page is inside the region, change the directory
+         * entry instead of splitting it */
+        if ((*dir_entry & PAGEDIR_PAGESZ) && (addr & 0x3FFFFF) == 0 &&
+            end - addr >= TABLE_ENTRIES * PAGE_SIZE) {
+            *dir_entry &= ~(PAGEDIR_PWT | PAGEDIR_PCD | 0x1000);
+            *dir_entry |= dir_flags;
+            invlpg(addr);
+
+            addr += TABLE_ENTRIES * PAGE_SIZE;
+            continue;
         }
 
-        /* Bits 12..31 of the entry are bits 12..31 of the address, no need to
-         * shift */
-        page_directory[i] = (uint32_t)&page_tables[i][0];
-        page_directory[i] |= PAGEDIR_PRESENT | PAGEDIR_READWRITE;
+        uint32_t* table = get_table(addr);
+        if (table == NULL)
+            return false;
+
+        uint32_t* entry = &table[VADDR_TO_TAB(addr)];
+        *entry &= ~(PAGETAB_PWT | PAGETAB_PCD | PAGETAB_PAT);
+        *entry |= flags;
+        invlpg(addr);
+
+        addr += PAGE_SIZE;
     }
 
-    /* Frame number where the .rodata section starts */
-    const uint32_t rodata_start_idx = (uint32_t)&_rodata_start >> 12;
+    return true;
+}
 
-    /* Frame number where the .rodata section ends. Minus 1 because it should be
-     * the start of the next section. */
-    const uint32_t rodata_end_idx = ((uint32_t)&_rodata_end >> 12) - 1;
+void* paging_alloc_pages(uint32_t n) {
+    const uint32_t paddr = frame_alloc_contig(n);
+    if (paddr == FRAME_NONE)
+        return NULL;
 
-    /* Convert to 1D array */
-    uint32_t* page_frames = (uint32_t*)page_tables;
+    /* Pages are identity mapped, but make sure they are present and writable
+     * in case they were unmapped before */
+    for (uint32_t i = 0; i < n; i++) {
+        const uint32_t addr = paddr + i * PAGE_SIZE;
 
-    /* Remove write permissions from the page frame where .rodata start to the
-     * page frame where it ends (included) */
-    for (uint32_t i = rodata_start_idx; i <= rodata_end_idx; i++)
-        page_frames[i] &= ~PAGETAB_READWRITE;
+        if (is_identity_rw(addr))
+            continue;
 
-    paging_load(page_directory);
-    paging_enable();
+        if (!paging_map((void*)addr, addr, PAGETAB_READWRITE)) {
+            frame_free(paddr, n);
+            return NULL;
+        }
+    }
+
+    return (void*)paddr;
 }
 
-void paging_show_map(void) {
-    typedef struct {
-        uint32_t dir_i, tab_i;
-        uint64_t paddr;
-        uint64_t vaddr;
-        uint16_t flags;
-    } table_entry;
+void paging_free_pages(void* ptr, uint32_t n) {
+    if (ptr == NULL)
+        return;
 
+    frame_free((uint32_t)ptr, n);
+}
+
+/**
+ * @brief Print a single entry for paging_show_map()
+ * @param[in] dir_i Index in the page directory.
+ * @param[in] tab_i Index in the page table. Zero for 4MiB pages.
+ * @param[in] entry Page table entry, or page directory entry for 4MiB pages.
+ */
+static void print_map_entry(uint32_t dir_i, uint32_t tab_i, uint32_t entry) {
     /* AVL, Global, Page atribute table, Dirty, Accessed, Cache disable,
      * Write-through, User (0 means supervisor), Writable, Present */
-    static const char* flags_str = "---GPDACWUWP";
+    static const char* tab_flags_str = "---GPDACWUWP";
+
+    /* Same, but Page size instead of PAT and no Dirty bit */
+    static const char* dir_flags_str = "----S-ACWUWP";
+
+    const bool large = (tab_i == 0 && (page_directory[dir_i] & PAGEDIR_PAGESZ));
+    const char* flags_str = large ? dir_flags_str : tab_flags_str;
 
-    /* Used to compare the current and last address' flags */
-    table_entry last_entry = { 0, 0, 0, 0, 0 };
+    /* Address stored in the entry without the flag bits, and the virtual
+     * address from the directory and table indexes */
+    const uint64_t paddr = entry & (large ? 0xFFC00000 : 0xFFFFF000);
+    const uint64_t vaddr =
+      dir_i * TABLE_ENTRIES * PAGE_SIZE + tab_i * PAGE_SIZE;
+
+    printf("[%4ld, %4ld] paddr: 0x%08llX | vaddr: 0x%08llX | flags: ", dir_i,
+           tab_i, paddr, vaddr);
+
+    /* Display flags */
+    for (int k = 11; k >= 0; k--) {
+        if ((entry >> k) & 1)
+            putchar(flags_str[11 - k]);
+        else
+            putchar('-');
+    }
+
+    if (large)
+        printf(" (4MiB)");
+
+    putchar('\n');
+}
+
+void paging_show_map(void) {
+    /* Directory and table indexes, and value of the last entry we iterated */
+    uint32_t last_dir_i = 0, last_tab_i = 0, last_entry = 0;
+
+    /* Flags of the last entry. Bit 12 is set for 4MiB pages, so they are not
+     * grouped with 4KiB pages with the same flags. */
+    uint32_t last_flags = 0;
 
     /* Used to print "..." only once per group of entries with the same flags */
     bool printed_dots = false;
 
-    table_entry e = { 0, 0, 0, 0, 0 };
+    for (uint32_t dir_i = 0; dir_i < DIR_ENTRIES; dir_i++) {
+        const uint32_t dir_entry = page_directory[dir_i];
 
-    /* Iterate page_tables array */
-    for (e.dir_i = 0; e.dir_i < DIR_ENTRIES; e.dir_i++) {
-        for (e.tab_i = 0; e.tab_i < TABLE_ENTRIES; e.tab_i++) {
-            /* Get address stored at current pos and remove flag bits*/
-            e.paddr = page_tables[e.dir_i][e.tab_i] & 0xFFFFF000;
+        /* For 4MiB pages and missing tables, we only have the directory
+         * entry */
+        const bool has_table = (dir_entry & PAGEDIR_PRESENT) &&
+                               !(dir_entry & PAGEDIR_PAGESZ);
+        const uint32_t* table = (uint32_t*)ENTRY_ADDR(dir_entry);
+        const uint32_t entries = has_table ? TABLE_ENTRIES : 1;
 
-            /* Same operation we use for identity mapping (1:1) */
-            e.vaddr = e.dir_i * TABLE_ENTRIES * PAGE_SIZE + e.tab_i * PAGE_SIZE;
-
-            /* Get flag bits from current entry */
-            e.flags = page_tables[e.dir_i][e.tab_i] & 0x00000FFF;
+        for (uint32_t tab_i = 0; tab_i < entries; tab_i++) {
+            const uint32_t entry = has_table ? table[tab_i] : dir_entry;
+            const uint32_t flags = (entry & 0xFFF) | (has_table ? 0 : 0x1000);
 
             /* If we have the same 2 flags in a row, display "..." */
-            if (e.flags == last_entry.flags) {
+            if (flags == last_flags) {
                 if (!printed_dots)
                     puts("...");
 
-                last_entry   = e;
+                last_dir_i   = dir_i;
+                last_tab_i   = tab_i;
+                last_entry   = entry;
                 printed_dots = true;
 
                 continue;
@@ -150,38 +364,16 @@ void paging_show_map(void) {
 
             /* If we found a different entry, and we just printed dots, print
              * the last one as well */
-            if (printed_dots) {
-                printf("[%4ld, %4ld] paddr: 0x%08llX | vaddr: 0x%08llX | "
-                       "flags: ",
-                       last_entry.dir_i, last_entry.tab_i, last_entry.paddr,
-                       last_entry.vaddr);
-
-                /* Display flags */
-                for (int k = 11; k >= 0; k--) {
-                    if ((last_entry.flags >> k) & 1)
-                        putchar(flags_str[11 - k]);
-                    else
-                        putchar('-');
-                }
-
-                putchar('\n');
-            }
+            if (printed_dots)
+                print_map_entry(last_dir_i, last_tab_i, last_entry);
 
-            last_entry   = e;
+            last_dir_i   = dir_i;
+            last_tab_i   = tab_i;
+            last_entry   = entry;
+            last_flags   = flags;
             printed_dots = false;
 
-            printf("[%4ld, %4ld] paddr: 0x%08llX | vaddr: 0x%08llX | flags: ",
-                   e.dir_i, e.tab_i, e.paddr, e.vaddr);
-
-            /* Display flags */
-            for (int k = 11; k >= 0; k--) {
-                if ((e.flags >> k) & 1)
-                    putchar(flags_str[11 - k]);
-                else
-                    putchar('-');
-            }
-
-            putchar('\n');
+            print_map_entry(dir_i, tab_i, entry);
         }
     }
 }
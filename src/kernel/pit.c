@@ -7,33 +7,106 @@
  * @file
  */
 
+#include <stdbool.h>
 #include <kernel/pit.h>
 #include <kernel/io.h>
+#include <kernel/idt.h> /* irq_save, irq_restore */
 
-void pit_init(uint32_t freq) {
-    /* freq should be how many HZs it should wait between sending interrupt. We
-     * pass the frequency per second to convert it to HZ (by dividing how many
-     * HZs are in a sec) */
-    freq = PIT_INTERVAL_TO_FREQ(freq);
+/** @brief PIT cycles between each periodic interrupt (tick). See pit_init() */
+static uint32_t tick_cycles = 0;
+
+/** @brief True while channel 0 is in one-shot mode. See pit_oneshot() */
+static bool oneshot = false;
 
+/** @brief Initial count of the current one-shot */
+static uint16_t oneshot_count = 0;
+
+/** @brief PIT cycles that passed in one-shot mode without completing a tick.
+ * Added to the next one-shot, so the ticks don't drift. */
+static uint32_t cycles_rem = 0;
+
+/*----------------------------------------------------------------------------*/
+
+/**
+ * @brief Program channel 0 for generating an interrupt every `tick_cycles`.
+ */
+static void set_periodic(void) {
     /* Select mode/cmd and flags */
     io_outb(PIT_CHANNEL_CMD, PIT_FLAG_CHANNEL_0 | PIT_FLAG_ACCESS_LOHI |
                                PIT_FLAG_MODE_RATE | PIT_FLAG_BINARY_OFF);
 
     /* Set reload values to the current ms */
-    io_outb(PIT_CHANNEL_0, (uint8_t)(freq & 0xFF));
-    io_outb(PIT_CHANNEL_0, (uint8_t)((freq & 0xFF00) >> 8));
+    io_outb(PIT_CHANNEL_0, (uint8_t)(tick_cycles & 0xFF));
+    io_outb(PIT_CHANNEL_0, (uint8_t)((tick_cycles & 0xFF00) >> 8));
+}
+
+/**
+ * @brief Check if the PIT interrupt (IRQ 0) is waiting in the IRR of the master
+ * PIC, because interrupts are disabled.
+ */
+static inline bool irq0_pending(void) {
+    io_outb(0x20, 0x0A);
+    return io_inb(0x20) & 1;
+}
+
+/**
+ * @brief Read the progress of the current one-shot.
+ * @details Should be called with interrupts disabled.
+ * @param[out] elapsed PIT cycles since the one-shot was programmed.
+ * @return True if the one-shot already reached zero, so its interrupt is
+ * pending or being handled.
+ */
+static bool oneshot_read(uint32_t* elapsed) {
+    /* Latch the status and the count of channel 0 at the same time */
+    io_outb(PIT_CHANNEL_CMD, PIT_READBACK_CHANNEL_0);
+    const uint8_t status = io_inb(PIT_CHANNEL_0);
+    uint16_t count       = io_inb(PIT_CHANNEL_0);
+    count |= io_inb(PIT_CHANNEL_0) << 8;
+
+    if (status & PIT_STATUS_OUT) {
+        *elapsed = oneshot_count;
+        return true;
+    }
+
+    /* The count was not loaded yet */
+    if (status & PIT_STATUS_NULL_COUNT || count > oneshot_count)
+        *elapsed = 0;
+    else
+        *elapsed = oneshot_count - count;
+
+    return false;
+}
+
+/**
+ * @brief PIT cycles since channel 0 was last reloaded, in periodic mode.
+ */
+static inline uint32_t tick_elapsed(void) {
+    /* Mode 2 counts down from tick_cycles */
+    const uint16_t count = pit_read_count(PIT_CHANNEL_0, PIT_FLAG_CHANNEL_0);
+    return (count <= tick_cycles) ? tick_cycles - count : 0;
+}
+
+/*----------------------------------------------------------------------------*/
+
+void pit_init(uint32_t freq) {
+    /* freq should be how many HZs it should wait between sending interrupt. We
+     * pass the frequency per second to convert it to HZ (by dividing how many
+     * HZs are in a sec) */
+    tick_cycles = PIT_INTERVAL_TO_FREQ(freq);
+    oneshot     = false;
+
+    set_periodic();
 }
 
 uint16_t pit_read_count(enum pit_io_ports channel_port,
                         enum pit_cmd_flags channel_flag) {
     uint16_t ret = 0;
 
-    asm("cli");                             /* Disable interrupts */
+    const uint32_t eflags = irq_save();     /* Disable interrupts */
     io_outb(PIT_CHANNEL_CMD, channel_flag); /* Select current channel */
     ret = io_inb(channel_port);             /* Low byte */
     ret |= io_inb(channel_port) << 8;       /* High byte */
-    asm("sti");                             /* Re-enable interrupts */
+    irq_restore(eflags);                    /* Restore interrupts */
 
     return ret;
 }
@@ -48,6 +121,16 @@ uint16_t pit_read_count(enum pit_io_ports channel_port,
  */
 static uint64_t ticks = 0;
 
+/**
+ * @brief Add the ticks that passed in one-shot mode.
+ * @details Should be called with interrupts disabled.
+ */
+static inline void add_cycles(uint32_t cycles) {
+    cycles_rem += cycles;
+    ticks += cycles_rem / tick_cycles;
+    cycles_rem %= tick_cycles;
+}
+
 void pit_dec(void) {
     if (ticks > 0)
         ticks--;
@@ -58,7 +141,20 @@ void pit_dec(void) {
 }
 
 void pit_inc(void) {
-    ticks++;
+    if (oneshot) {
+        /* End of the one-shot programmed by the idle task. Add all the ticks we
+         * skipped and go back to the periodic interrupts. If it didn't expire,
+         * this is a periodic interrupt that was raised while programming the
+         * one-shot, and pit_oneshot() already counted it. */
+        uint32_t elapsed;
+        if (oneshot_read(&elapsed)) {
+            oneshot = false;
+            add_cycles(oneshot_count);
+            set_periodic();
+        }
+    } else {
+        ticks++;
+    }
 
     /* Tell CPU that it's okay to resume interrupts. See:
      * https://wiki.osdev.org/Interrupts#From_the_OS.27s_perspective */
@@ -69,6 +165,125 @@ void pit_set_ticks(uint64_t num) {
     ticks = num;
 }
 
+uint32_t pit_lost_ticks_start(void) {
+    return (oneshot || tick_cycles == 0) ? 0 : tick_elapsed();
+}
+
+void pit_add_lost_ticks(uint32_t start, uint32_t cycles) {
+    if (oneshot || tick_cycles == 0)
+        return;
+
+    /* Channel 0 was reloaded once for each tick that passed. Rounded, since
+     * `cycles` doesn't include the instructions around the measurement. */
+    const int64_t total = (int64_t)start + cycles - tick_elapsed();
+    if (total <= 0)
+        return;
+
+    const uint64_t reloads = (total + tick_cycles / 2) / tick_cycles;
+
+    /* The PIC keeps one of the interrupts pending, and pit_inc() counts it
+     * once interrupts are enabled */
+    if (reloads > 1)
+        ticks += reloads - 1;
+}
+
 uint64_t pit_get_ticks(void) {
-    return ticks;
+    if (!oneshot)
+        return ticks;
+
+    /* The ticks are not updated in one-shot mode, so calculate them from the
+     * PIT count. Only happens in the interrupts that woke up the idle task. */
+    const uint32_t eflags = irq_save();
+
+    uint64_t ret = ticks;
+    if (oneshot) {
+        uint32_t elapsed;
+        oneshot_read(&elapsed);
+        ret += (cycles_rem + elapsed) / tick_cycles;
+    }
+
+    irq_restore(eflags);
+    return ret;
+}
+
+uint64_t pit_get_cycles(void) {
+    const uint32_t eflags = irq_save();
+
+    /* Cycles of the completed ticks, plus the ones that were left from the last
+     * one-shot. See add_cycles() */
+    uint64_t ret = ticks * tick_cycles + cycles_rem;
+
+    uint32_t elapsed;
+    if (oneshot) {
+        oneshot_read(&elapsed);
+    } else {
+        /* Mode 2 counts down from tick_cycles */
+        const uint16_t count =
+          pit_read_count(PIT_CHANNEL_0, PIT_FLAG_CHANNEL_0);
+        elapsed = (count <= tick_cycles) ? tick_cycles - count : 0;
+
+        /* The counter was reloaded, but the interrupt that increments the
+         * ticks is waiting for us to enable interrupts. Only if the count is
+         * high, because the interrupt might have been raised after reading
+         * it. */
+        if (count > tick_cycles / 2 && irq0_pending())
+            elapsed += tick_cycles;
+    }
+
+    irq_restore(eflags);
+    return ret + elapsed;
+}
+
+uint32_t pit_oneshot_max(void) {
+    return (tick_cycles > 0) ? 0xFFFF / tick_cycles : 0;
+}
+
+bool pit_oneshot(uint32_t nticks) {
+    if (oneshot || tick_cycles == 0)
+        return false;
+
+    /* If the next periodic interrupt is already pending in the PIC, its tick
+     * would be lost, since pit_inc() would ignore it */
+    if (irq0_pending())
+        return false;
+
+    /* The count is 16 bits, so the caller might wake up earlier */
+    const uint32_t max = pit_oneshot_max();
+    if (nticks > max)
+        nticks = max;
+    if (nticks == 0)
+        return false;
+
+    /* The current period is cut short, keep the part that already passed.
+     * Mode 2 counts down from tick_cycles. */
+    io_outb(PIT_CHANNEL_CMD, PIT_FLAG_CHANNEL_0 | PIT_FLAG_ACCESS_COUNT);
+    uint16_t cur = io_inb(PIT_CHANNEL_0);
+    cur |= io_inb(PIT_CHANNEL_0) << 8;
+    if (cur <= tick_cycles)
+        add_cycles(tick_cycles - cur);
+
+    const uint16_t count = nticks * tick_cycles;
+
+    io_outb(PIT_CHANNEL_CMD, PIT_FLAG_CHANNEL_0 | PIT_FLAG_ACCESS_LOHI |
+                               PIT_FLAG_MODE_INT | PIT_FLAG_BINARY_OFF);
+    io_outb(PIT_CHANNEL_0, (uint8_t)(count & 0xFF));
+    io_outb(PIT_CHANNEL_0, (uint8_t)((count & 0xFF00) >> 8));
+
+    oneshot_count = count;
+    oneshot       = true;
+    return true;
+}
+
+void pit_oneshot_end(void) {
+    if (!oneshot)
+        return;
+
+    /* If it already expired, the interrupt will call pit_inc() */
+    uint32_t elapsed;
+    if (oneshot_read(&elapsed))
+        return;
+
+    oneshot = false;
+    add_cycles(elapsed);
+    set_periodic();
 }
@@ -0,0 +1,131 @@
+/**
+ * @brief Object caches for fixed-size kernel structures.
+ *
+ * Based on the slab allocator described by Jeff Bonwick ("The Slab Allocator:
+ * An Object-Caching Kernel Memory Allocator"), without the per-slab reference
+ * counting since we never give slabs back to the heap.
+ *
+ * @file
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <kernel/heap.h>
+#include <kernel/slab.h>
+#include <kernel/multitask.h> /* mt_preempt_disable, mt_preempt_enable */
+
+/**
+ * @brief Returns the address where the free list pointer of `obj` is stored.
+ * @details The pointer is stored after the object, not inside it, so it
+ * doesn't overwrite the constructed state.
+ */
+#define OBJ_TO_LINK(cache, obj) ((void**)((uint32_t)(obj) + (cache)->obj_sz))
+
+/** @brief First cache in the list of created caches. Used for dumping. */
+static kmem_cache* caches = NULL;
+
+/*----------------------------------------------------------------------------*/
+
+/**
+ * @brief Allocate a new slab from the heap and add its objects to the free
+ * list of the cache.
+ * @param[inout] cache Cache to grow.
+ */
+static void cache_grow(kmem_cache* cache) {
+    uint8_t* slab = heap_alloc(cache->slab_objs * cache->stride, cache->align);
+
+    /* Construct each object and push it to the free list. Iterate from the
+     * end so the objects are returned in ascending address order. */
+    for (int i = cache->slab_objs - 1; i >= 0; i--) {
+        void* obj = &slab[i * cache->stride];
+
+        if (cache->ctor != NULL)
+            cache->ctor(obj);
+
+        *OBJ_TO_LINK(cache, obj) = cache->free_list;
+        cache->free_list         = obj;
+    }
+
+    cache->slabs++;
+    cache->free_objs += cache->slab_objs;
+}
+
+/*----------------------------------------------------------------------------*/
+
+kmem_cache* kmem_cache_create(const char* name, size_t obj_sz, size_t align,
+                              void (*ctor)(void* obj)) {
+    if (align < sizeof(void*))
+        align = sizeof(void*);
+
+    kmem_cache* cache = heap_alloc(sizeof(kmem_cache), sizeof(void*));
+
+    int i;
+    for (i = 0; i < SLAB_NAME_SZ - 1 && name[i] != '\0'; i++)
+        cache->name[i] = name[i];
+    cache->name[i] = '\0';
+
+    /* Object + free list pointer, rounded up so the next object is aligned.
+     * The pointer right after the object is aligned because align is at least
+     * the pointer size. */
+    obj_sz = (obj_sz + sizeof(void*) - 1) & ~(sizeof(void*) - 1);
+
+    cache->obj_sz = obj_sz;
+    cache->align  = align;
+    cache->stride = (obj_sz + sizeof(void*) + align - 1) & ~(align - 1);
+
+    cache->slab_objs = SLAB_BYTES / cache->stride;
+    if (cache->slab_objs == 0)
+        cache->slab_objs = 1;
+
+    cache->ctor      = ctor;
+    cache->free_list = NULL;
+    cache->slabs     = 0;
+    cache->free_objs = 0;
+
+    /* Add to the list of caches */
+    cache->next = caches;
+    caches      = cache;
+
+    return cache;
+}
+
+void* kmem_cache_alloc(kmem_cache* cache) {
+    mt_preempt_disable();
+
+    if (cache->free_list == NULL)
+        cache_grow(cache);
+
+    void* obj        = cache->free_list;
+    cache->free_list = *OBJ_TO_LINK(cache, obj);
+    cache->free_objs--;
+
+    mt_preempt_enable();
+
+    return obj;
+}
+
+void kmem_cache_free(kmem_cache* cache, void* obj) {
+    if (obj == NULL)
+        return;
+
+    mt_preempt_disable();
+
+    *OBJ_TO_LINK(cache, obj) = cache->free_list;
+    cache->free_list         = obj;
+    cache->free_objs++;
+
+    mt_preempt_enable();
+}
+
+void kmem_cache_dump(void) {
+    puts("            Name | Obj sz | Stride | Slabs |  Used | Free");
+
+    for (kmem_cache* cache = caches; cache != NULL; cache = cache->next) {
+        const uint32_t total = cache->slabs * cache->slab_objs;
+
+        printf("%16s | %6ld | %6ld | %5ld | %5ld | %ld\n", cache->name,
+               cache->obj_sz, cache->stride, cache->slabs,
+               total - cache->free_objs, cache->free_objs);
+    }
+}
@@ -93,6 +93,20 @@ struc ctx_t
     .fxdata:    resd 1          ; 512 bytes needed for fxsave to store fpu/sse
                                 ; registers. Aligned to 16 bytes.
     .name:      resd 1          ; char* to the task name
+    .state:     resd 1          ; See TASK_* below
+    .quantum:   resd 1          ; Ticks left in the current time slice
+    .data:      resd 1          ; void* for the creator of the task
+    .priority:  resd 1          ; Highest MLFQ level the task can reach
+    .level:     resd 1          ; Current MLFQ level, 0 is the highest
+    .wait_next: resd 1          ; Next task in the same wait queue
 endstruc
 
+; Task Switched bit of CR0. See mt_switch in multitask.asm
+%define CR0_TS (1 << 3)
+
+; Values of ctx_t.state. See mt_task_state enum in multitask.h
+%define TASK_READY   0
+%define TASK_DEAD    1
+%define TASK_BLOCKED 2
+
 %endif ; STRUCTS_ASM
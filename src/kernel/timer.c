@@ -0,0 +1,314 @@
+/**
+ * @brief Kernel timers using a hierarchical timer wheel.
+ *
+ * Based on the timing wheels described by George Varghese and Tony Lauck
+ * ("Hashed and Hierarchical Timing Wheels"), with the cascading of the old
+ * Linux timers. Each level has 64 slots, and each slot is a list of the timers
+ * that expire in the range of ticks covered by that slot.
+ *
+ * @file
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <kernel/timer.h>
+#include <kernel/pit.h>
+#include <kernel/idt.h> /* irq_save, irq_restore */
+
+/** @brief Number of slots of each level */
+#define SLOTS (1 << TIMER_WHEEL_BITS)
+
+/** @brief Mask for getting the slot from the bits of a tick */
+#define SLOT_MASK (SLOTS - 1)
+
+/** @brief Slot of `tick` in `level` */
+#define SLOT_IDX(tick, level) \
+    (((tick) >> ((level) * TIMER_WHEEL_BITS)) & SLOT_MASK)
+
+/** @brief Ticks covered by the whole wheel */
+#define WHEEL_RANGE (1ULL << (TIMER_WHEEL_LEVELS * TIMER_WHEEL_BITS))
+
+/** @brief Bits of the timer_id used for the index in the pool, plus 1 */
+#define ID_IDX_BITS 8
+
+typedef struct ktimer ktimer;
+
+/**
+ * @struct ktimer
+ * @brief Kernel timer. Allocated from the static pool.
+ */
+struct ktimer {
+    ktimer* next;       /**< @brief Next timer in the slot or free list */
+    ktimer** pprev;     /**< @brief Pointer to the pointer to this timer */
+    uint64_t expires;   /**< @brief Tick when the timer expires */
+    uint32_t period;    /**< @brief Ticks between each call, or 0 */
+    timer_func func;    /**< @brief Callback */
+    void* data;         /**< @brief Argument of the callback */
+    uint32_t gen;       /**< @brief Incremented on each allocation */
+    bool armed;         /**< @brief True if it's in the wheel */
+};
+
+static ktimer pool[TIMER_MAX];
+
+/** @brief First free timer of the pool, linked with ktimer.next */
+static ktimer* free_timers = NULL;
+
+/** @brief The slots of all the levels */
+static ktimer* wheel[TIMER_WHEEL_LEVELS][SLOTS];
+
+/** @brief Next tick that will be processed by timer_tick() */
+static uint64_t wheel_tick = 0;
+
+static uint32_t armed_count = 0;
+
+/*----------------------------------------------------------------------------*/
+
+static inline timer_id get_id(const ktimer* t) {
+    return (t->gen << ID_IDX_BITS) | ((t - pool) + 1);
+}
+
+/**
+ * @brief Returns the timer with the identifier `id`, or NULL if it's not
+ * valid anymore.
+ */
+static inline ktimer* from_id(timer_id id) {
+    const uint32_t idx = (id & ((1 << ID_IDX_BITS) - 1)) - 1;
+    if (idx >= TIMER_MAX)
+        return NULL;
+
+    ktimer* t = &pool[idx];
+    return (get_id(t) == id) ? t : NULL;
+}
+
+static inline void list_add(ktimer** head, ktimer* t) {
+    t->next = *head;
+    if (t->next != NULL)
+        t->next->pprev = &t->next;
+
+    t->pprev = head;
+    *head    = t;
+}
+
+static inline void list_del(ktimer* t) {
+    *t->pprev = t->next;
+    if (t->next != NULL)
+        t->next->pprev = t->pprev;
+}
+
+/**
+ * @brief Add a timer to the slot of the level that covers its expiration.
+ * @details Should be called with interrupts disabled.
+ */
+static void wheel_insert(ktimer* t) {
+    /* Already expired, run it on the next tick */
+    if (t->expires < wheel_tick) {
+        list_add(&wheel[0][SLOT_IDX(wheel_tick, 0)], t);
+        return;
+    }
+
+    /* Clamp the timers that don't fit in the wheel */
+    if (t->expires - wheel_tick >= WHEEL_RANGE)
+        t->expires = wheel_tick + WHEEL_RANGE - 1;
+
+    const uint64_t delta = t->expires - wheel_tick;
+
+    /* First level whose range contains the delta */
+    int level = 0;
+    while (level < TIMER_WHEEL_LEVELS - 1 &&
+           delta >= (1ULL << ((level + 1) * TIMER_WHEEL_BITS)))
+        level++;
+
+    list_add(&wheel[level][SLOT_IDX(t->expires, level)], t);
+}
+
+/**
+ * @brief Move the timers of a slot to the lower levels.
+ * @details Now that wheel_tick reached that slot, they expire in less ticks
+ * than the ones covered by the level.
+ * @return The index of the slot, so the caller knows if it should also cascade
+ * the next level.
+ */
+static uint32_t cascade(int level) {
+    const uint32_t idx = SLOT_IDX(wheel_tick, level);
+
+    ktimer* t         = wheel[level][idx];
+    wheel[level][idx] = NULL;
+
+    while (t != NULL) {
+        ktimer* next = t->next;
+        wheel_insert(t);
+        t = next;
+    }
+
+    return idx;
+}
+
+/**
+ * @brief Check if timer_tick() would move timers to the lower levels at `tick`.
+ * @details Same conditions as the loop of timer_tick().
+ */
+static bool cascade_pending(uint64_t tick) {
+    for (int level = 1; level < TIMER_WHEEL_LEVELS; level++) {
+        if (SLOT_IDX(tick, level - 1) != 0)
+            break;
+
+        if (wheel[level][SLOT_IDX(tick, level)] != NULL)
+            return true;
+    }
+
+    return false;
+}
+
+/**
+ * @brief Return a timer to the pool.
+ * @details Should be called with interrupts disabled.
+ */
+static inline void timer_release(ktimer* t) {
+    t->armed    = false;
+    t->next     = free_timers;
+    free_timers = t;
+    armed_count--;
+}
+
+/*----------------------------------------------------------------------------*/
+
+void timer_init(void) {
+    free_timers = NULL;
+    for (int i = TIMER_MAX - 1; i >= 0; i--) {
+        pool[i].next  = free_timers;
+        pool[i].armed = false;
+        free_timers   = &pool[i];
+    }
+
+    wheel_tick  = pit_get_ticks();
+    armed_count = 0;
+}
+
+timer_id timer_add(uint32_t ms, timer_func callback, void* data,
+                   bool periodic) {
+    if (ms == 0)
+        ms = 1;
+
+    const uint32_t eflags = irq_save();
+
+    ktimer* t = free_timers;
+    if (t == NULL) {
+        irq_restore(eflags);
+        return TIMER_NONE;
+    }
+    free_timers = t->next;
+
+    /* The generation can't be 0, so the id is never TIMER_NONE */
+    t->gen = (t->gen + 1) & (0xFFFFFFFF >> ID_IDX_BITS);
+    if (t->gen == 0)
+        t->gen = 1;
+
+    t->expires = pit_get_ticks() + ms;
+    t->period  = periodic ? ms : 0;
+    t->func    = callback;
+    t->data    = data;
+    t->armed   = true;
+    armed_count++;
+
+    wheel_insert(t);
+    const timer_id ret = get_id(t);
+
+    irq_restore(eflags);
+    return ret;
+}
+
+bool timer_cancel(timer_id id) {
+    const uint32_t eflags = irq_save();
+
+    ktimer* t = from_id(id);
+    if (t == NULL || !t->armed) {
+        irq_restore(eflags);
+        return false;
+    }
+
+    list_del(t);
+    timer_release(t);
+
+    irq_restore(eflags);
+    return true;
+}
+
+void timer_tick(void) {
+    if (armed_count == 0) {
+        /* Nothing to run, just move the wheel */
+        wheel_tick = pit_get_ticks() + 1;
+        return;
+    }
+
+    /* Process each tick until the current one, in case we missed some */
+    const uint64_t now = pit_get_ticks();
+    while (wheel_tick <= now) {
+        const uint32_t idx = SLOT_IDX(wheel_tick, 0);
+
+        /* When the first level wraps around, refill it from the next slot of
+         * the second level, and so on */
+        for (int level = 1; level < TIMER_WHEEL_LEVELS; level++)
+            if (SLOT_IDX(wheel_tick, level - 1) != 0 || cascade(level) != 0)
+                break;
+
+        /* Take the whole list, callbacks might add timers to this slot. The
+         * list is still valid for list_del(), in case a callback cancels one
+         * of the timers. */
+        ktimer* expired = wheel[0][idx];
+        wheel[0][idx]   = NULL;
+        if (expired != NULL)
+            expired->pprev = &expired;
+
+        wheel_tick++;
+
+        while (expired != NULL) {
+            ktimer* t = expired;
+            list_del(t);
+
+            /* Not in any list. Make list_del() safe if the callback cancels
+             * this timer. */
+            t->next  = NULL;
+            t->pprev = &t->next;
+
+            if (t->period > 0) {
+                /* Based on the old expiration, so the period doesn't drift */
+                t->expires += t->period;
+                wheel_insert(t);
+            }
+
+            const timer_id id = get_id(t);
+            t->func(t->data);
+
+            /* One-shot timers are released after the callback, unless it
+             * cancelled them (and maybe allocated them again) */
+            if (t->period == 0 && t->armed && get_id(t) == id)
+                timer_release(t);
+        }
+    }
+}
+
+uint32_t timer_next_deadline(uint32_t max) {
+    const uint32_t eflags = irq_save();
+    const uint64_t now    = pit_get_ticks();
+    uint32_t ret          = max;
+
+    /* The level 0 slots only have timers that expire in that exact tick. The
+     * timers of the other levels are only checked when they would cascade, so
+     * the result might be earlier than their real expiration. */
+    if (armed_count > 0) {
+        for (uint64_t tick = wheel_tick; tick < now + max; tick++) {
+            if (wheel[0][SLOT_IDX(tick, 0)] != NULL || cascade_pending(tick)) {
+                ret = (tick > now) ? tick - now : 0;
+                break;
+            }
+        }
+    }
+
+    irq_restore(eflags);
+    return ret;
+}
+
+uint32_t timer_get_armed(void) {
+    return armed_count;
+}
@@ -190,6 +190,78 @@ is_msr_supported:
     pop     ebx
     ret
 
+; bool is_pse_supported(void);
+global is_pse_supported:function
+is_pse_supported:
+    push    ebx                 ; Store registers used by CPUID (Except return)
+    push    ecx
+    push    edx
+
+    ; See Vol.3, Chapter 4.1.4
+    mov     eax, 0x1            ; Request function 1 of CPUID
+    cpuid
+    test    edx, 1 << 3         ; CPUID.1:EDX.PSE[bit 3] == 1?
+    jnz     .enabled            ; If 1, return true
+    mov     eax, 0              ; Not enabled, return false
+    jmp     .done
+
+.enabled:
+    mov     eax, 1
+
+.done:
+    pop     edx                 ; Restore registers used by CPUID
+    pop     ecx
+    pop     ebx
+    ret
+
+; bool is_pat_supported(void);
+global is_pat_supported:function
+is_pat_supported:
+    push    ebx                 ; Store registers used by CPUID (Except return)
+    push    ecx
+    push    edx
+
+    ; See Vol.3, Chapter 11.12.1
+    mov     eax, 0x1            ; Request function 1 of CPUID
+    cpuid
+    test    edx, 1 << 16        ; CPUID.1:EDX.PAT[bit 16] == 1?
+    jnz     .enabled            ; If 1, return true
+    mov     eax, 0              ; Not enabled, return false
+    jmp     .done
+
+.enabled:
+    mov     eax, 1
+
+.done:
+    pop     edx                 ; Restore registers used by CPUID
+    pop     ecx
+    pop     ebx
+    ret
+
+; bool is_mtrr_supported(void);
+global is_mtrr_supported:function
+is_mtrr_supported:
+    push    ebx                 ; Store registers used by CPUID (Except return)
+    push    ecx
+    push    edx
+
+    ; See Vol.3, Chapter 11.11.1
+    mov     eax, 0x1            ; Request function 1 of CPUID
+    cpuid
+    test    edx, 1 << 12        ; CPUID.1:EDX.MTRR[bit 12] == 1?
+    jnz     .enabled            ; If 1, return true
+    mov     eax, 0              ; Not enabled, return false
+    jmp     .done
+
+.enabled:
+    mov     eax, 1
+
+.done:
+    pop     edx                 ; Restore registers used by CPUID
+    pop     ecx
+    pop     ebx
+    ret
+
 ; bool is_tsc_supported(void);
 global is_tsc_supported:function
 is_tsc_supported:
@@ -213,3 +285,58 @@ is_tsc_supported:
     pop     ecx
     pop     ebx
     ret
+
+; uint32_t get_phys_addr_bits(void);
+global get_phys_addr_bits:function
+get_phys_addr_bits:
+    push    ebx                 ; Store registers used by CPUID (Except return)
+    push    ecx
+    push    edx
+
+    ; See Vol.3, Chapter 11.11.3
+    mov     eax, 0x80000000     ; Request the highest extended function
+    cpuid
+    cmp     eax, 0x80000008     ; Is function 0x80000008 supported?
+    jb      .default
+
+    mov     eax, 0x80000008     ; Request function 0x80000008 of CPUID
+    cpuid
+    and     eax, 0xFF           ; MAXPHYADDR is in bits 0..7
+    jmp     .done
+
+.default:
+    mov     eax, 36             ; Default for CPUs with MTRRs and PAE
+
+.done:
+    pop     edx                 ; Restore registers used by CPUID
+    pop     ecx
+    pop     ebx
+    ret
+
+; uint64_t msr_read(uint32_t msr);
+global msr_read:function
+msr_read:
+    push    ebp
+    mov     ebp, esp
+
+    mov     ecx, [ebp + 8]      ; First arg: MSR address
+    rdmsr                       ; Read MSR into EDX:EAX, our uint64_t return
+
+    mov     esp, ebp
+    pop     ebp
+    ret
+
+; void msr_write(uint32_t msr, uint64_t val);
+global msr_write:function
+msr_write:
+    push    ebp
+    mov     ebp, esp
+
+    mov     ecx, [ebp + 8]      ; First arg: MSR address
+    mov     eax, [ebp + 12]     ; Low dword of the second arg
+    mov     edx, [ebp + 16]     ; High dword of the second arg
+    wrmsr                       ; Write EDX:EAX into the MSR
+
+    mov     esp, ebp
+    pop     ebp
+    ret
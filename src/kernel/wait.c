@@ -0,0 +1,65 @@
+/**
+ * @brief Wait queues for blocking tasks until an event happens.
+ *
+ * @file
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <kernel/wait.h>
+#include <kernel/multitask.h>
+#include <kernel/idt.h> /* irq_save, irq_restore */
+
+/**
+ * @brief Remove the first task of the queue.
+ * @details Should be called with interrupts disabled.
+ * @return The task, or NULL if the queue is empty.
+ */
+static inline Ctx* wq_pop(wait_queue* wq) {
+    Ctx* task = wq->head;
+    if (task == NULL)
+        return NULL;
+
+    wq->head = task->wait_next;
+    if (wq->head == NULL)
+        wq->tail = NULL;
+
+    task->wait_next = NULL;
+    return task;
+}
+
+/*----------------------------------------------------------------------------*/
+
+void wq_wait(wait_queue* wq) {
+    Ctx* cur       = mt_current_task;
+    cur->wait_next = NULL;
+
+    if (wq->tail != NULL)
+        wq->tail->wait_next = cur;
+    else
+        wq->head = cur;
+
+    wq->tail = cur;
+
+    mt_block();
+}
+
+void wq_wake_one(wait_queue* wq) {
+    const uint32_t eflags = irq_save();
+
+    Ctx* task = wq_pop(wq);
+    if (task != NULL)
+        mt_unblock(task);
+
+    irq_restore(eflags);
+}
+
+void wq_wake_all(wait_queue* wq) {
+    const uint32_t eflags = irq_save();
+
+    Ctx* task;
+    while ((task = wq_pop(wq)) != NULL)
+        mt_unblock(task);
+
+    irq_restore(eflags);
+}
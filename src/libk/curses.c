@@ -10,10 +10,22 @@
 #include <kernel/color.h>
 #include <kernel/framebuffer_console.h>
 #include <kernel/keyboard.h>
+#include <kernel/slab.h>
+
+/** @brief Object cache for the WINDOW structs. Created by initscr() */
+static kmem_cache* win_cache = NULL;
+
+/** @brief Object cache for the fbc_ctx of each WINDOW. Created by initscr() */
+static kmem_cache* ctx_cache = NULL;
 
 WINDOW* initscr(void) {
+    if (win_cache == NULL) {
+        win_cache = kmem_cache_create("curses_win", sizeof(WINDOW), 0, NULL);
+        ctx_cache = kmem_cache_create("curses_fbc", sizeof(fbc_ctx), 0, NULL);
+    }
+
     fbc_ctx* cur = fbc_get_ctx();
-    WINDOW* win  = malloc(sizeof(WINDOW));
+    WINDOW* win  = kmem_cache_alloc(win_cache);
 
     /* If we didn't initialize stdscr, use it */
     if (stdscr == NULL)
@@ -21,12 +33,18 @@ WINDOW* initscr(void) {
 
     /* Fill the curses window with the new and old contexts */
     win->old_ctx = cur;
-    win->ctx     = malloc(sizeof(fbc_ctx));
+    win->ctx     = kmem_cache_alloc(ctx_cache);
     win->pairs   = NULL; /* Initialized by start_color */
 
     /* Fill the new framebuffer console context */
     win->ctx->fbc = malloc(cur->ch_h * cur->ch_w * sizeof(fbc_entry));
 
+    /* Curses windows don't need scrollback, only the rows of the screen */
+    win->ctx->lines = cur->ch_h;
+    win->ctx->head  = 0;
+    win->ctx->view  = 0;
+    win->ctx->hist  = 0;
+
     win->ctx->y = cur->y;
     win->ctx->x = cur->x;
     win->ctx->h = cur->h;
@@ -43,6 +61,10 @@ WINDOW* initscr(void) {
     win->ctx->cur_y = 0;
     win->ctx->cur_x = 0;
 
+    /* The context might be reused from the cache, so don't rely on it being
+     * zero-initialized */
+    win->ctx->should_shift = false;
+
     /* Switch to the new fbc context */
     fbc_change_ctx(win->ctx);
     fbc_clear();
@@ -67,8 +89,9 @@ int endwin(void) {
         free(stdscr->pairs);
 
     free(stdscr->ctx->fbc); /* Free the framebuffer console array */
-    free(stdscr->ctx);      /* Free the framebuffer console context */
-    free(stdscr);           /* Free the curses window struct */
+
+    kmem_cache_free(ctx_cache, stdscr->ctx); /* Framebuffer console context */
+    kmem_cache_free(win_cache, stdscr);      /* Curses window struct */
 
     /* So next call to initscr uses stdscr */
     stdscr = NULL;
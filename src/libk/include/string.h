@@ -3,15 +3,83 @@
 #define STRING_H_ 1
 
 #include <stddef.h>
+#include <stdint.h>
 
 /**
  * @brief Get the length of the specified string.
- * @details Does not include the NULL terminator.
+ * @details Does not include the NULL terminator. Checks a word at a time once
+ * the pointer is aligned.
  * @param[in] str String for getting the length.
  * @return Length of `str`.
  */
 size_t strlen(const char* str) __attribute__((pure)) __attribute__((nonnull));
 
+/**
+ * @brief Find the first occurrence of a character in a string.
+ * @details Checks a word at a time once the pointer is aligned.
+ * @param[in] str String to search.
+ * @param[in] c Character to find. Can be the null terminator.
+ * @return Pointer to the character inside `str`, or NULL if not found.
+ */
+char* strchr(const char* str, int c) __attribute__((pure))
+  __attribute__((nonnull));
+
+/**
+ * @brief Length of the first part of `str` made only of characters in
+ * `accept`.
+ */
+size_t strspn(const char* str, const char* accept) __attribute__((pure))
+  __attribute__((nonnull));
+
+/**
+ * @brief Length of the first part of `str` without characters of `reject`.
+ */
+size_t strcspn(const char* str, const char* reject) __attribute__((pure))
+  __attribute__((nonnull));
+
+/**
+ * @brief Copy the string `src`, including the null terminator, into `dst`.
+ * @return The `dst` argument.
+ */
+char* strcpy(char* restrict dst, const char* restrict src)
+  __attribute__((nonnull));
+
+/**
+ * @brief Copy at most `sz` characters of `src` into `dst`.
+ * @details If `src` is shorter, the rest of `dst` is filled with null bytes. If
+ * it's longer, `dst` won't be null terminated.
+ * @return The `dst` argument.
+ */
+char* strncpy(char* restrict dst, const char* restrict src, size_t sz)
+  __attribute__((nonnull));
+
+/**
+ * @brief Append the string `src` to the end of `dst`.
+ * @return The `dst` argument.
+ */
+char* strcat(char* restrict dst, const char* restrict src)
+  __attribute__((nonnull));
+
+/**
+ * @brief Split a string into tokens.
+ * @details The first call receives the string, and the next ones NULL. The
+ * delimiters after each token are replaced with null terminators. Not
+ * reentrant, tasks should use strtok_r().
+ * @param[inout] str String to split, or NULL to continue with the last one.
+ * @param[in] delim Characters that separate the tokens.
+ * @return Next token, or NULL if there are no more.
+ */
+char* strtok(char* str, const char* delim);
+
+/**
+ * @brief Reentrant version of strtok().
+ * @param[inout] str String to split, or NULL to continue with `saveptr`.
+ * @param[in] delim Characters that separate the tokens.
+ * @param[inout] saveptr Position for the next call.
+ * @return Next token, or NULL if there are no more.
+ */
+char* strtok_r(char* str, const char* delim, char** saveptr);
+
 /**
  * @brief Reverse string in place.
  * @details Doesnt allocate memory.
@@ -41,6 +109,16 @@ int memcmp(const void* a, const void* b, size_t sz) __attribute__((nonnull));
  */
 void* memset(void* ptr, int val, size_t sz) __attribute__((nonnull));
 
+/**
+ * @brief Set `n` dwords of `ptr` to `val`.
+ * @details Not standard. Used for filling pixels, see fb_drawrect_fast().
+ * @param[out] ptr Memory location to change.
+ * @param[in] val New value for the dwords.
+ * @param[in] n Number of dwords (not bytes) to overwrite.
+ * @return The `ptr` argument.
+ */
+void* memset32(void* ptr, uint32_t val, size_t n) __attribute__((nonnull));
+
 /**
  * @brief Copy `sz` bytes of `src` into `dst`.
  * @param[out] dst Destination address.
@@ -51,6 +129,77 @@ void* memset(void* ptr, int val, size_t sz) __attribute__((nonnull));
 void* memcpy(void* restrict dst, const void* restrict src, size_t sz)
   __attribute__((nonnull));
 
+/**
+ * @brief Copy `sz` bytes of `src` into `dst`. The regions can overlap.
+ * @param[out] dst Destination address.
+ * @param[in] src Source address.
+ * @param[in] sz Number of bytes to copy from `src` to `dst`.
+ * @return The `dst` argument.
+ */
+void* memmove(void* dst, const void* src, size_t sz) __attribute__((nonnull));
+
+/**
+ * @brief Copy `sz` bytes of `src` into `dst` with "rep movsd".
+ * @details Used by memcpy() for medium sizes. Defined in src/libk/string.asm
+ */
+void* memcpy_rep(void* restrict dst, const void* restrict src, size_t sz)
+  __attribute__((nonnull));
+
+/**
+ * @brief Same as memcpy_rep(), but copying from the end.
+ * @details Used by memmove() when `dst` overlaps the end of `src`. Defined in
+ * src/libk/string.asm
+ */
+void* memcpy_rep_back(void* dst, const void* src, size_t sz)
+  __attribute__((nonnull));
+
+/**
+ * @brief Set `sz` bytes of `ptr` to `value` with "rep stosd".
+ * @details Used by memset() for medium sizes. Defined in src/libk/string.asm
+ */
+void* memset_rep(void* ptr, int val, size_t sz) __attribute__((nonnull));
+
+/**
+ * @brief Set `n` dwords of `ptr` to `val` with "rep stosd".
+ * @details Used by memset32() for medium sizes. Defined in src/libk/string.asm
+ */
+void* memset32_rep(void* ptr, uint32_t val, size_t n) __attribute__((nonnull));
+
+/**
+ * @brief Copy `sz` bytes of `src` into `dst` with SSE2 registers.
+ * @details Used by memcpy() for big sizes, if SSE is supported. Sizes over 1MiB
+ * use non-temporal stores. Only defined with ENABLE_SSE, in
+ * src/libk/string.asm
+ */
+void* memcpy_sse2(void* restrict dst, const void* restrict src, size_t sz)
+  __attribute__((nonnull));
+
+/**
+ * @brief Set `sz` bytes of `ptr` to `value` with SSE2 registers.
+ * @details Used by memset() for big sizes, if SSE is supported. Sizes over 1MiB
+ * use non-temporal stores. Only defined with ENABLE_SSE, in
+ * src/libk/string.asm
+ */
+void* memset_sse2(void* ptr, int val, size_t sz) __attribute__((nonnull));
+
+/**
+ * @brief Set `n` dwords of `ptr` to `val` with SSE2 registers.
+ * @details Used by memset32() for big sizes, if SSE is supported. The `ptr`
+ * should be aligned to 4 bytes. Sizes over 1MiB use non-temporal stores. Only
+ * defined with ENABLE_SSE, in src/libk/string.asm
+ */
+void* memset32_sse2(void* ptr, uint32_t val, size_t n)
+  __attribute__((nonnull));
+
+/**
+ * @brief Compare the first `sz` bytes of 2 memory locations with SSE2
+ * registers.
+ * @details Used by memcmp() for big sizes, if SSE is supported. Only defined
+ * with ENABLE_SSE, in src/libk/string.asm
+ */
+int memcmp_sse2(const void* a, const void* b, size_t sz)
+  __attribute__((nonnull));
+
 /**
  * @brief Compare 2 strings.
  * @param[in] a First string to compare.
@@ -62,4 +211,13 @@ void* memcpy(void* restrict dst, const void* restrict src, size_t sz)
  */
 int strcmp(const char* a, const char* b);
 
+/**
+ * @brief Compare at most `sz` characters of 2 strings.
+ * @param[in] a First string to compare.
+ * @param[in] b Second string to compare.
+ * @param[in] sz Maximum number of characters to compare.
+ * @return Same as strcmp().
+ */
+int strncmp(const char* a, const char* b, size_t sz);
+
 #endif /* STRING_H_ */
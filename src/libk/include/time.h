@@ -24,16 +24,23 @@ void sleep(uint32_t sec);
 void sleep_ms(uint64_t ms);
 
 /**
- * @brief Start the PIT timer.
- * @details Calling multiple times resets the count.
+ * @brief Start the timer.
+ * @details Calling multiple times resets the count. Uses the clocksource, see
+ * src/kernel/clock.c
  */
 void timer_start(void);
 
 /**
- * @brief Get the ticks (ms) since we called timer_start()
- * @details Each tick should be 1 ms, see pit_init() call from kernel.c
- * @return Ticks since we called timer_start()
+ * @brief Get the milliseconds since we called timer_start()
+ * @return Milliseconds since we called timer_start()
  */
 uint64_t timer_stop(void);
 
+/**
+ * @brief Get the nanoseconds since we called timer_start()
+ * @details The resolution depends on the clocksource, see clock_ns().
+ * @return Nanoseconds since we called timer_start()
+ */
+uint64_t timer_stop_ns(void);
+
 #endif /* TIME_H_ */
@@ -103,6 +103,9 @@ void panic(const char* func, unsigned int line, const char* fmt, ...) {
 
     va_end(va);
 
+    /* We are not going to return, draw the message now */
+    fbc_flush();
+
     asm volatile("hlt");
 
     for (;;)
@@ -113,6 +116,7 @@ void panic(const char* func, unsigned int line, const char* fmt, ...) {
 
 void abort(void) {
     puts("\nkernel panic: abort");
+    fbc_flush();
 
     asm volatile("hlt");
 
@@ -0,0 +1,373 @@
+; Optimized versions of the memory functions. The C functions in string.c
+; select one of them depending on the size and on SSE support.
+
+; Sizes from which memcpy_sse2 and memset_sse2 use non-temporal stores, so
+; big copies don't evict everything else from the cache.
+%define NT_THRESHOLD (1024 * 1024)
+
+section .text
+
+; void* memcpy_rep(void* dst, const void* src, size_t sz);
+; Copy 4 bytes at a time with "rep movsd", and the rest with "rep movsb".
+global memcpy_rep:function
+memcpy_rep:
+    push    esi
+    push    edi
+
+    mov     edi, [esp + 12]     ; First arg, dst
+    mov     esi, [esp + 16]     ; Second arg, src
+    mov     ecx, [esp + 20]     ; Third arg, sz
+    mov     edx, ecx
+
+    shr     ecx, 2              ; Number of dwords
+    rep movsd
+    mov     ecx, edx
+    and     ecx, 3              ; Remaining bytes
+    rep movsb
+
+    mov     eax, [esp + 12]     ; Return dst
+    pop     edi
+    pop     esi
+    ret
+
+; void* memcpy_rep_back(void* dst, const void* src, size_t sz);
+; Same as memcpy_rep, but starting from the end with the direction flag set.
+; Used by memmove when dst overlaps the end of src.
+global memcpy_rep_back:function
+memcpy_rep_back:
+    push    esi
+    push    edi
+
+    mov     edi, [esp + 12]     ; First arg, dst
+    mov     esi, [esp + 16]     ; Second arg, src
+    mov     ecx, [esp + 20]     ; Third arg, sz
+    mov     edx, ecx
+
+    lea     edi, [edi + ecx - 1] ; Last byte of each region
+    lea     esi, [esi + ecx - 1]
+
+    std                         ; Decrement esi and edi
+    and     ecx, 3              ; Bytes that don't fill the last dword
+    rep movsb
+    sub     edi, 3              ; Start of the last dword
+    sub     esi, 3
+    mov     ecx, edx
+    shr     ecx, 2              ; Number of dwords
+    rep movsd
+    cld                         ; The ABI expects it cleared
+
+    mov     eax, [esp + 12]     ; Return dst
+    pop     edi
+    pop     esi
+    ret
+
+; void* memset_rep(void* ptr, int val, size_t sz);
+; Fill 4 bytes at a time with "rep stosd", and the rest with "rep stosb".
+global memset_rep:function
+memset_rep:
+    push    edi
+
+    mov     edi, [esp + 8]      ; First arg, ptr
+    movzx   eax, byte [esp + 12] ; Second arg, val. Only the low byte is used
+    mov     ecx, [esp + 16]     ; Third arg, sz
+    mov     edx, ecx
+
+    imul    eax, eax, 0x01010101 ; Repeat the byte in the whole dword
+    shr     ecx, 2              ; Number of dwords
+    rep stosd
+    mov     ecx, edx
+    and     ecx, 3              ; Remaining bytes
+    rep stosb
+
+    mov     eax, [esp + 8]      ; Return ptr
+    pop     edi
+    ret
+
+; void* memset32_rep(void* ptr, uint32_t val, size_t n);
+; Fill n dwords with "rep stosd".
+global memset32_rep:function
+memset32_rep:
+    push    edi
+
+    mov     edi, [esp + 8]      ; First arg, ptr
+    mov     eax, [esp + 12]     ; Second arg, val
+    mov     ecx, [esp + 16]     ; Third arg, n
+    rep stosd
+
+    mov     eax, [esp + 8]      ; Return ptr
+    pop     edi
+    ret
+
+%ifdef ENABLE_SSE
+
+; void* memcpy_sse2(void* dst, const void* src, size_t sz);
+; Copy 64 bytes at a time with SSE2 registers, after aligning dst to 16 bytes.
+; The loads are aligned too if src has the same alignment as dst.
+global memcpy_sse2:function
+memcpy_sse2:
+    push    esi
+    push    edi
+
+    mov     edi, [esp + 12]     ; First arg, dst
+    mov     esi, [esp + 16]     ; Second arg, src
+    mov     edx, [esp + 20]     ; Third arg, sz
+
+    ; Copy bytes until dst is aligned: ecx = min((-dst) & 15, sz)
+    mov     ecx, edi
+    neg     ecx
+    and     ecx, 15
+    cmp     ecx, edx
+    jbe     .align
+    mov     ecx, edx
+.align:
+    sub     edx, ecx
+    rep movsb
+
+    mov     ecx, edx
+    shr     ecx, 6              ; Number of 64 byte blocks
+    jz      .tail
+
+    cmp     edx, NT_THRESHOLD
+    jae     .nt_loop
+    test    esi, 15
+    jnz     .unaligned_loop
+
+.aligned_loop:
+    movdqa  xmm0, [esi]
+    movdqa  xmm1, [esi + 16]
+    movdqa  xmm2, [esi + 32]
+    movdqa  xmm3, [esi + 48]
+    movdqa  [edi], xmm0
+    movdqa  [edi + 16], xmm1
+    movdqa  [edi + 32], xmm2
+    movdqa  [edi + 48], xmm3
+    add     esi, 64
+    add     edi, 64
+    dec     ecx
+    jnz     .aligned_loop
+    jmp     .tail
+
+.unaligned_loop:
+    movdqu  xmm0, [esi]
+    movdqu  xmm1, [esi + 16]
+    movdqu  xmm2, [esi + 32]
+    movdqu  xmm3, [esi + 48]
+    movdqa  [edi], xmm0
+    movdqa  [edi + 16], xmm1
+    movdqa  [edi + 32], xmm2
+    movdqa  [edi + 48], xmm3
+    add     esi, 64
+    add     edi, 64
+    dec     ecx
+    jnz     .unaligned_loop
+    jmp     .tail
+
+.nt_loop:
+    movdqu  xmm0, [esi]
+    movdqu  xmm1, [esi + 16]
+    movdqu  xmm2, [esi + 32]
+    movdqu  xmm3, [esi + 48]
+    movntdq [edi], xmm0         ; Bypass the cache
+    movntdq [edi + 16], xmm1
+    movntdq [edi + 32], xmm2
+    movntdq [edi + 48], xmm3
+    add     esi, 64
+    add     edi, 64
+    dec     ecx
+    jnz     .nt_loop
+    sfence                      ; Order the non-temporal stores
+
+.tail:
+    mov     ecx, edx
+    and     ecx, 63             ; Remaining bytes
+    rep movsb
+
+    mov     eax, [esp + 12]     ; Return dst
+    pop     edi
+    pop     esi
+    ret
+
+; void* memset_sse2(void* ptr, int val, size_t sz);
+; Fill 64 bytes at a time with SSE2 registers, after aligning ptr to 16 bytes.
+global memset_sse2:function
+memset_sse2:
+    push    edi
+
+    mov     edi, [esp + 8]      ; First arg, ptr
+    movzx   eax, byte [esp + 12] ; Second arg, val. Only the low byte is used
+    mov     edx, [esp + 16]     ; Third arg, sz
+
+    imul    eax, eax, 0x01010101 ; Repeat the byte in the whole dword
+    movd    xmm0, eax
+    pshufd  xmm0, xmm0, 0       ; And in the whole xmm0
+
+    ; Fill bytes until ptr is aligned: ecx = min((-ptr) & 15, sz)
+    mov     ecx, edi
+    neg     ecx
+    and     ecx, 15
+    cmp     ecx, edx
+    jbe     .align
+    mov     ecx, edx
+.align:
+    sub     edx, ecx
+    rep stosb
+
+    mov     ecx, edx
+    shr     ecx, 6              ; Number of 64 byte blocks
+    jz      .tail
+
+    cmp     edx, NT_THRESHOLD
+    jae     .nt_loop
+
+.loop:
+    movdqa  [edi], xmm0
+    movdqa  [edi + 16], xmm0
+    movdqa  [edi + 32], xmm0
+    movdqa  [edi + 48], xmm0
+    add     edi, 64
+    dec     ecx
+    jnz     .loop
+    jmp     .tail
+
+.nt_loop:
+    movntdq [edi], xmm0         ; Bypass the cache
+    movntdq [edi + 16], xmm0
+    movntdq [edi + 32], xmm0
+    movntdq [edi + 48], xmm0
+    add     edi, 64
+    dec     ecx
+    jnz     .nt_loop
+    sfence                      ; Order the non-temporal stores
+
+.tail:
+    mov     ecx, edx
+    and     ecx, 63             ; Remaining bytes
+    rep stosb
+
+    mov     eax, [esp + 8]      ; Return ptr
+    pop     edi
+    ret
+
+; void* memset32_sse2(void* ptr, uint32_t val, size_t n);
+; Fill 16 dwords at a time with SSE2 registers, after aligning ptr to 16 bytes.
+; The ptr should be aligned to 4 bytes, so the dwords can align it.
+global memset32_sse2:function
+memset32_sse2:
+    push    edi
+
+    mov     edi, [esp + 8]      ; First arg, ptr
+    mov     eax, [esp + 12]     ; Second arg, val
+    mov     edx, [esp + 16]     ; Third arg, n
+
+    movd    xmm0, eax
+    pshufd  xmm0, xmm0, 0       ; Repeat the dword in the whole xmm0
+
+    ; Fill dwords until ptr is aligned: ecx = min(((-ptr) & 15) / 4, n)
+    mov     ecx, edi
+    neg     ecx
+    and     ecx, 15
+    shr     ecx, 2
+    cmp     ecx, edx
+    jbe     .align
+    mov     ecx, edx
+.align:
+    sub     edx, ecx
+    rep stosd
+
+    mov     ecx, edx
+    shr     ecx, 4              ; Number of 64 byte blocks
+    jz      .tail
+
+    cmp     edx, NT_THRESHOLD / 4
+    jae     .nt_loop
+
+.loop:
+    movdqa  [edi], xmm0
+    movdqa  [edi + 16], xmm0
+    movdqa  [edi + 32], xmm0
+    movdqa  [edi + 48], xmm0
+    add     edi, 64
+    dec     ecx
+    jnz     .loop
+    jmp     .tail
+
+.nt_loop:
+    movntdq [edi], xmm0         ; Bypass the cache
+    movntdq [edi + 16], xmm0
+    movntdq [edi + 32], xmm0
+    movntdq [edi + 48], xmm0
+    add     edi, 64
+    dec     ecx
+    jnz     .nt_loop
+    sfence                      ; Order the non-temporal stores
+
+.tail:
+    mov     ecx, edx
+    and     ecx, 15             ; Remaining dwords
+    rep stosd
+
+    mov     eax, [esp + 8]      ; Return ptr
+    pop     edi
+    ret
+
+; int memcmp_sse2(const void* a, const void* b, size_t sz);
+; Compare 16 bytes at a time. Once a block doesn't match, the mask of
+; pcmpeqb tells us the first byte that is different.
+global memcmp_sse2:function
+memcmp_sse2:
+    push    esi
+    push    edi
+
+    mov     esi, [esp + 12]     ; First arg, a
+    mov     edi, [esp + 16]     ; Second arg, b
+    mov     ecx, [esp + 20]     ; Third arg, sz
+
+.loop:
+    cmp     ecx, 16
+    jb      .tail
+    movdqu  xmm0, [esi]
+    movdqu  xmm1, [edi]
+    pcmpeqb xmm0, xmm1          ; Set to 0xFF the bytes that match
+    pmovmskb eax, xmm0          ; One bit for each byte
+    xor     eax, 0xFFFF         ; Now only the bytes that don't match
+    jnz     .found
+    add     esi, 16
+    add     edi, 16
+    sub     ecx, 16
+    jmp     .loop
+
+.found:
+    bsf     eax, eax            ; Index of the first mismatch
+    movzx   edx, byte [esi + eax]
+    movzx   eax, byte [edi + eax]
+    jmp     .compare
+
+.tail:
+    test    ecx, ecx
+    jz      .equal
+.tail_loop:
+    movzx   edx, byte [esi]
+    movzx   eax, byte [edi]
+    cmp     edx, eax
+    jne     .compare
+    inc     esi
+    inc     edi
+    dec     ecx
+    jnz     .tail_loop
+
+.equal:
+    xor     eax, eax            ; Return 0
+    jmp     .done
+
+.compare:
+    cmp     edx, eax            ; Doesn't match, *a > *b?
+    mov     eax, 1              ; Doesn't change the flags
+    ja      .done               ; Return 1
+    mov     eax, -1             ; Return -1
+
+.done:
+    pop     edi
+    pop     esi
+    ret
+
+%endif ; ENABLE_SSE
@@ -1,15 +1,84 @@
 
 #include <stdint.h>
+#include <stdbool.h>
 #include <stddef.h>
 #include <string.h>
 
+/* Sizes from which each method is used, see the mem_bench command. Smaller
+ * sizes use the byte loops. */
+#define MEM_REP_THRESHOLD 64
+#define MEM_SSE_THRESHOLD 512
+
+/* Interrupt flag of EFLAGS */
+#define EFLAGS_IF (1 << 9)
+
+/* Used for comparing 4 bytes at a time without breaking strict aliasing */
+typedef uint32_t __attribute__((may_alias)) alias_u32;
+
+/* Word with all the bytes set to 0x01 and 0x80. See has_zero() */
+#define ONES  0x01010101
+#define HIGHS 0x80808080
+
+/* True if the pointer is not aligned to a word */
+#define UNALIGNED(p) ((uint32_t)(p) & (sizeof(uint32_t) - 1))
+
+#ifdef ENABLE_SSE
+/* Defined in src/kernel/kernel.c, checked in src/kernel/boot.asm */
+extern bool sse_supported;
+#endif
+
+/**
+ * @brief Check if the SSE2 version of a memory function should be used.
+ * @details Interrupt handlers run with interrupts disabled, and they can't use
+ * the SSE registers because they belong to the interrupted task (see the lazy
+ * FPU switching in src/kernel/idt.asm), so we also check the IF flag.
+ */
+static inline bool use_sse(size_t sz) {
+#ifdef ENABLE_SSE
+    if (sz < MEM_SSE_THRESHOLD || !sse_supported)
+        return false;
+
+    uint32_t eflags;
+    asm volatile("pushfd\n\t"
+                 "pop %0"
+                 : "=r"(eflags));
+    return eflags & EFLAGS_IF;
+#else
+    (void)sz;
+    return false;
+#endif
+}
+
+/**
+ * @brief Check if any of the bytes of a word is zero.
+ * @details Subtracting 1 from a zero byte borrows into its high bit, and
+ * "& ~w" ignores the bytes that already had the high bit set. See "Determine if
+ * a word has a zero byte" in Sean Eron Anderson's Bit Twiddling Hacks.
+ */
+static inline bool has_zero(uint32_t w) {
+    return (w - ONES) & ~w & HIGHS;
+}
+
+/*----------------------------------------------------------------------------*/
+
 size_t strlen(const char* str) {
-    size_t ret = 0;
+    const char* p = str;
 
-    while (str[ret] != '\0')
-        ret++;
+    /* Check bytes until the pointer is aligned. Aligned words never cross into
+     * the next page, so we can read past the terminator safely. */
+    for (; UNALIGNED(p); p++)
+        if (*p == '\0')
+            return p - str;
 
-    return ret;
+    const alias_u32* w = (const alias_u32*)p;
+    while (!has_zero(*w))
+        w++;
+
+    /* Find the terminator inside the last word */
+    for (p = (const char*)w; *p != '\0'; p++)
+        ;
+
+    return p - str;
 }
 
 char* strrev(char* str) {
@@ -35,10 +104,112 @@ char* strrev(char* str) {
     return str;
 }
 
+char* strchr(const char* str, int c) {
+    const char ch = (char)c;
+    const char* p = str;
+
+    for (; UNALIGNED(p); p++) {
+        if (*p == ch)
+            return (char*)p;
+        if (*p == '\0')
+            return NULL;
+    }
+
+    /* Bytes that match `ch` are zero after the XOR */
+    const uint32_t mask = (uint8_t)ch * ONES;
+
+    const alias_u32* w = (const alias_u32*)p;
+    while (!has_zero(*w) && !has_zero(*w ^ mask))
+        w++;
+
+    for (p = (const char*)w;; p++) {
+        if (*p == ch)
+            return (char*)p;
+        if (*p == '\0')
+            return NULL;
+    }
+}
+
+size_t strspn(const char* str, const char* accept) {
+    size_t ret = 0;
+
+    while (str[ret] != '\0' && strchr(accept, str[ret]) != NULL)
+        ret++;
+
+    return ret;
+}
+
+size_t strcspn(const char* str, const char* reject) {
+    size_t ret = 0;
+
+    while (str[ret] != '\0' && strchr(reject, str[ret]) == NULL)
+        ret++;
+
+    return ret;
+}
+
+char* strcpy(char* restrict dst, const char* restrict src) {
+    return memcpy(dst, src, strlen(src) + 1);
+}
+
+char* strncpy(char* restrict dst, const char* restrict src, size_t sz) {
+    size_t i = 0;
+
+    for (; i < sz && src[i] != '\0'; i++)
+        dst[i] = src[i];
+
+    /* Fill the rest with null bytes */
+    memset(&dst[i], '\0', sz - i);
+
+    return dst;
+}
+
+char* strcat(char* restrict dst, const char* restrict src) {
+    strcpy(&dst[strlen(dst)], src);
+    return dst;
+}
+
+char* strtok_r(char* str, const char* delim, char** saveptr) {
+    if (str == NULL)
+        str = *saveptr;
+
+    /* Skip the delimiters before the token */
+    str += strspn(str, delim);
+    if (*str == '\0') {
+        *saveptr = str;
+        return NULL;
+    }
+
+    /* Terminate the token, and continue after it on the next call */
+    char* end = str + strcspn(str, delim);
+    if (*end != '\0')
+        *end++ = '\0';
+
+    *saveptr = end;
+    return str;
+}
+
+char* strtok(char* str, const char* delim) {
+    static char* saveptr = NULL;
+    return strtok_r(str, delim, &saveptr);
+}
+
 int memcmp(const void* a, const void* b, size_t sz) {
+#ifdef ENABLE_SSE
+    if (use_sse(sz))
+        return memcmp_sse2(a, b, sz);
+#endif
+
     uint8_t* ap = (uint8_t*)a;
     uint8_t* bp = (uint8_t*)b;
 
+    /* Skip the dwords that match. The first mismatch is found below */
+    while (sz >= 4 && *(alias_u32*)ap == *(alias_u32*)bp) {
+        ap += 4;
+        bp += 4;
+        sz -= 4;
+    }
+
     while (sz-- > 0) {
         if (*ap < *bp)
             return -1;
@@ -53,6 +224,14 @@ int memcmp(const void* a, const void* b, size_t sz) {
 }
 
 void* memset(void* ptr, int val, size_t sz) {
+#ifdef ENABLE_SSE
+    if (use_sse(sz))
+        return memset_sse2(ptr, val, sz);
+#endif
+
+    if (sz >= MEM_REP_THRESHOLD)
+        return memset_rep(ptr, val, sz);
+
     uint8_t* p = (uint8_t*)ptr;
 
     while (sz-- > 0)
@@ -61,7 +240,33 @@ void* memset(void* ptr, int val, size_t sz) {
     return ptr;
 }
 
+void* memset32(void* ptr, uint32_t val, size_t n) {
+#ifdef ENABLE_SSE
+    /* The SSE2 version can only align pointers that are aligned to dwords */
+    if (!UNALIGNED(ptr) && use_sse(n * sizeof(uint32_t)))
+        return memset32_sse2(ptr, val, n);
+#endif
+
+    if (n * sizeof(uint32_t) >= MEM_REP_THRESHOLD)
+        return memset32_rep(ptr, val, n);
+
+    alias_u32* p = (alias_u32*)ptr;
+
+    while (n-- > 0)
+        *p++ = val;
+
+    return ptr;
+}
+
 void* memcpy(void* restrict dst, const void* restrict src, size_t sz) {
+#ifdef ENABLE_SSE
+    if (use_sse(sz))
+        return memcpy_sse2(dst, src, sz);
+#endif
+
+    if (sz >= MEM_REP_THRESHOLD)
+        return memcpy_rep(dst, src, sz);
+
     uint8_t* dp = (uint8_t*)dst;
     uint8_t* sp = (uint8_t*)src;
 
@@ -71,7 +276,44 @@ void* memcpy(void* restrict dst, const void* restrict src, size_t sz) {
     return dst;
 }
 
+void* memmove(void* dst, const void* src, size_t sz) {
+    const uint8_t* dp = dst;
+    const uint8_t* sp = src;
+
+    /* No overlap */
+    if (dp + sz <= sp || sp + sz <= dp)
+        return memcpy(dst, src, sz);
+
+    /* The destination is before the source, so copying forwards only
+     * overwrites bytes that we already copied */
+    if (dp < sp)
+        return memcpy_rep(dst, src, sz);
+
+    return memcpy_rep_back(dst, src, sz);
+}
+
 int strcmp(const char* a, const char* b) {
+    /* If both strings have the same alignment, we can compare them a word at a
+     * time once they are aligned */
+    if (UNALIGNED(a) == UNALIGNED(b)) {
+        for (; UNALIGNED(a) && *a == *b && *a != '\0'; a++, b++)
+            ;
+
+        if (!UNALIGNED(a)) {
+            const alias_u32* wa = (const alias_u32*)a;
+            const alias_u32* wb = (const alias_u32*)b;
+
+            /* Stop at the first word that is different or has the end */
+            while (*wa == *wb && !has_zero(*wa)) {
+                wa++;
+                wb++;
+            }
+
+            a = (const char*)wa;
+            b = (const char*)wb;
+        }
+    }
+
     /* See section 5.5 of TCPL (K&R) */
     while (*a == *b) {
         /* Because of the while condition, we know *b is '\0' too */
@@ -83,5 +325,17 @@ int strcmp(const char* a, const char* b) {
         b++;
     }
 
-    return *a - *b;
+    return *(const uint8_t*)a - *(const uint8_t*)b;
+}
+
+int strncmp(const char* a, const char* b, size_t sz) {
+    for (; sz > 0; sz--, a++, b++) {
+        if (*a != *b)
+            return *(const uint8_t*)a - *(const uint8_t*)b;
+
+        if (*a == '\0')
+            return 0;
+    }
+
+    return 0;
 }
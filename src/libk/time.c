@@ -2,7 +2,9 @@
 #include <stdint.h>
 #include <time.h>
 #include <kernel/pit.h>
+#include <kernel/clock.h>
 #include <kernel/rtc.h>
+#include <kernel/multitask.h> /* mt_sleep */
 
 #define MIN2SEC(x)  ((x)*60)
 #define HOUR2SEC(x) ((x)*3600)
@@ -32,24 +34,33 @@ void sleep(uint32_t sec) {
 }
 
 void sleep_ms(uint64_t ms) {
+    /* Block the task until the PIT wakes it up. If we can't, wait here */
+    if (mt_sleep(ms))
+        return;
+
     /* No need to translate ms to ticks because 1 tick is 1 ms */
     const uint64_t cur_ticks = pit_get_ticks();
+
     while (pit_get_ticks() < cur_ticks + ms)
         asm("hlt");
 }
 
 /**
- * @var timer_ticks
- * @brief 64 bit variable used to count the PIT ticks since boot.
+ * @var timer_cycles
+ * @brief Value of the clocksource when we called timer_start().
  */
-static uint64_t timer_ticks = 0;
+static uint64_t timer_cycles = 0;
 
 void timer_start(void) {
-    timer_ticks = pit_get_ticks();
+    timer_cycles = clock_cycles();
 }
 
 uint64_t timer_stop(void) {
+    return timer_stop_ns() / 1000000;
+}
+
+uint64_t timer_stop_ns(void) {
     /* Timer doesn't need to be reset to 0 afer stopping, since we will set it
      * anyway when starting next time. */
-    return pit_get_ticks() - timer_ticks;
+    return clock_cycles_to_ns(clock_cycles() - timer_cycles);
 }